@@ -0,0 +1,42 @@
+// Copyright 2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#ifndef ZUCKERLI_BENCHMARKS_BENCHMARK_UTILS_H
+#define ZUCKERLI_BENCHMARKS_BENCHMARK_UTILS_H
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <string>
+#include <vector>
+
+#include "common.h"
+
+namespace zuckerli {
+
+// Writes `data` to a file called `name` in the temporary directory, and
+// returns its path.
+inline std::string WriteBenchmarkFile(const std::string& name,
+                                      const std::vector<uint8_t>& data) {
+  const char* tmpdir = getenv("TMPDIR");
+  std::string path = std::string(tmpdir ? tmpdir : "/tmp") + "/" + name;
+  FILE* f = fopen(path.c_str(), "wb");
+  ZKR_ASSERT(f);
+  ZKR_ASSERT(fwrite(data.data(), 1, data.size(), f) == data.size());
+  fclose(f);
+  return path;
+}
+
+}  // namespace zuckerli
+
+#endif  // ZUCKERLI_BENCHMARKS_BENCHMARK_UTILS_H
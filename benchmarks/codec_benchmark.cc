@@ -0,0 +1,76 @@
+// Copyright 2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#include <string>
+#include <vector>
+
+#include "benchmark/benchmark.h"
+#include "benchmark_utils.h"
+#include "decode.h"
+#include "encode.h"
+#include "synthetic_graph.h"
+#include "uncompressed_graph.h"
+
+namespace zuckerli {
+namespace {
+
+std::string SyntheticGraphPath(size_t num_nodes) {
+  return WriteBenchmarkFile(
+      "codec_benchmark" + std::to_string(num_nodes),
+      SerializeUncompressedGraph(SyntheticGraph(num_nodes, 0)));
+}
+
+size_t NumEdges(const UncompressedGraph& g) {
+  size_t num_edges = 0;
+  for (size_t i = 0; i < g.size(); i++) num_edges += g.Degree(i);
+  return num_edges;
+}
+
+void BM_EncodeGraph(benchmark::State& state, const std::string& path) {
+  UncompressedGraph g(path);
+  bool allow_random_access = state.range(0);
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(EncodeGraph(g, allow_random_access));
+  }
+  state.SetItemsProcessed(state.iterations() * NumEdges(g));
+}
+
+void BM_DecodeGraph(benchmark::State& state, const std::string& path) {
+  UncompressedGraph g(path);
+  bool allow_random_access = state.range(0);
+  std::vector<uint8_t> compressed = EncodeGraph(g, allow_random_access);
+  for (auto _ : state) {
+    if (!DecodeGraph(compressed)) state.SkipWithError("Invalid graph");
+  }
+  state.SetItemsProcessed(state.iterations() * NumEdges(g));
+  state.counters["bits_per_edge"] = 8.0 * compressed.size() / NumEdges(g);
+}
+
+BENCHMARK_CAPTURE(BM_EncodeGraph, small, TESTDATA "/small")
+    ->ArgName("random_access")->Arg(0)->Arg(1);
+BENCHMARK_CAPTURE(BM_EncodeGraph, testdata1, TESTDATA "/testdata1")
+    ->ArgName("random_access")->Arg(0)->Arg(1);
+BENCHMARK_CAPTURE(BM_EncodeGraph, synthetic, SyntheticGraphPath(20000))
+    ->ArgName("random_access")->Arg(0)->Arg(1)
+    ->Unit(benchmark::kMillisecond);
+
+BENCHMARK_CAPTURE(BM_DecodeGraph, small, TESTDATA "/small")
+    ->ArgName("random_access")->Arg(0)->Arg(1);
+BENCHMARK_CAPTURE(BM_DecodeGraph, testdata1, TESTDATA "/testdata1")
+    ->ArgName("random_access")->Arg(0)->Arg(1);
+BENCHMARK_CAPTURE(BM_DecodeGraph, synthetic, SyntheticGraphPath(20000))
+    ->ArgName("random_access")->Arg(0)->Arg(1)
+    ->Unit(benchmark::kMillisecond);
+
+}  // namespace
+}  // namespace zuckerli
@@ -0,0 +1,91 @@
+// Copyright 2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#include <algorithm>
+#include <memory>
+#include <numeric>
+#include <random>
+#include <vector>
+
+#include "benchmark/benchmark.h"
+#include "benchmark_utils.h"
+#include "compressed_graph.h"
+#include "encode.h"
+#include "synthetic_graph.h"
+#include "uncompressed_graph.h"
+
+namespace zuckerli {
+namespace {
+
+constexpr size_t kNumNodes = 20000;
+
+// Random-access encoding of a synthetic graph, shared by all benchmarks.
+const std::string& CompressedGraphPath() {
+  static const std::string* path = [] {
+    UncompressedGraph g(WriteBenchmarkFile(
+        "compressed_graph_benchmark",
+        SerializeUncompressedGraph(SyntheticGraph(kNumNodes, 0))));
+    return new std::string(
+        WriteBenchmarkFile("compressed_graph_benchmark.zkr",
+                           EncodeGraph(g, /*allow_random_access=*/true)));
+  }();
+  return *path;
+}
+
+// Node ids in sequential order if `random` is false, and in a random order
+// otherwise.
+std::vector<uint32_t> NodeOrder(bool random) {
+  std::vector<uint32_t> nodes(kNumNodes);
+  std::iota(nodes.begin(), nodes.end(), 0);
+  if (random) std::shuffle(nodes.begin(), nodes.end(), std::mt19937(0));
+  return nodes;
+}
+
+void BM_Degree(benchmark::State& state) {
+  CompressedGraph graph(CompressedGraphPath());
+  if (state.range(1)) graph.BuildDegreeIndex();
+  std::vector<uint32_t> nodes = NodeOrder(state.range(0));
+  for (auto _ : state) {
+    size_t sum = 0;
+    for (uint32_t node : nodes) sum += graph.Degree(node);
+    benchmark::DoNotOptimize(sum);
+  }
+  state.SetItemsProcessed(state.iterations() * nodes.size());
+}
+BENCHMARK(BM_Degree)
+    ->ArgNames({"random", "degree_index"})
+    ->ArgsProduct({{0, 1}, {0, 1}});
+
+void BM_Neighbours(benchmark::State& state) {
+  CompressedGraph graph(CompressedGraphPath());
+  if (state.range(1)) graph.EnableMultiSymbolDecoding();
+  std::vector<uint32_t> nodes = NodeOrder(state.range(0));
+  NeighboursContext context;
+  size_t num_edges = 0;
+  for (auto _ : state) {
+    for (uint32_t node : nodes) {
+      span<const uint32_t> neighbours = graph.Neighbours(node, &context);
+      num_edges += neighbours.size();
+      benchmark::DoNotOptimize(neighbours.data());
+    }
+  }
+  state.SetItemsProcessed(num_edges);
+  state.counters["nodes"] = benchmark::Counter(
+      state.iterations() * nodes.size(), benchmark::Counter::kIsRate);
+}
+BENCHMARK(BM_Neighbours)
+    ->ArgNames({"random", "multi_symbol"})
+    ->ArgsProduct({{0, 1}, {0, 1}});
+
+}  // namespace
+}  // namespace zuckerli
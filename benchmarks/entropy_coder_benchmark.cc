@@ -0,0 +1,132 @@
+// Copyright 2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#include <random>
+#include <vector>
+
+#include "ans.h"
+#include "benchmark/benchmark.h"
+#include "bit_reader.h"
+#include "bit_writer.h"
+#include "huffman.h"
+#include "integer_coder.h"
+
+namespace zuckerli {
+namespace {
+
+constexpr size_t kNumValues = 1 << 20;
+constexpr size_t kNumBenchmarkContexts = 8;
+
+// Mostly small values, as for residuals, with a few large ones.
+IntegerData RandomIntegers() {
+  std::mt19937 rng(0);
+  std::geometric_distribution<uint32_t> small(0.3);
+  IntegerData data;
+  for (size_t i = 0; i < kNumValues; i++) {
+    uint32_t value = rng() % 16 == 0 ? rng() % (1 << 20) : small(rng);
+    data.Add(i % kNumBenchmarkContexts, value);
+  }
+  return data;
+}
+
+std::vector<uint8_t> HuffmanData() {
+  BitWriter writer;
+  std::vector<double> bits_per_ctx;
+  HuffmanEncode(RandomIntegers(), kNumBenchmarkContexts, &writer,
+                /*node_degree_indices=*/{}, &bits_per_ctx);
+  return std::move(writer).GetData();
+}
+
+std::vector<uint8_t> ANSData() {
+  BitWriter writer;
+  std::vector<double> bits_per_ctx;
+  ANSEncode(RandomIntegers(), kNumBenchmarkContexts, &writer, &bits_per_ctx);
+  return std::move(writer).GetData();
+}
+
+void BM_BitReaderReadBits(benchmark::State& state) {
+  size_t nbits = state.range(0);
+  std::vector<uint8_t> data(kNumValues * nbits / 8 + 8, 0xA5);
+  for (auto _ : state) {
+    BitReader reader(data.data(), data.size());
+    uint64_t sum = 0;
+    for (size_t i = 0; i < kNumValues; i++) sum += reader.ReadBits(nbits);
+    benchmark::DoNotOptimize(sum);
+  }
+  state.SetItemsProcessed(state.iterations() * kNumValues);
+}
+BENCHMARK(BM_BitReaderReadBits)->Arg(1)->Arg(8)->Arg(24)->Arg(56);
+
+void BM_HuffmanReaderRead(benchmark::State& state) {
+  std::vector<uint8_t> data = HuffmanData();
+  HuffmanReader huffman_reader;
+  for (auto _ : state) {
+    BitReader reader(data.data(), data.size());
+    huffman_reader.Init(kNumBenchmarkContexts, &reader);
+    size_t sum = 0;
+    for (size_t i = 0; i < kNumValues; i++) {
+      reader.Refill();
+      sum += huffman_reader.Read(i % kNumBenchmarkContexts, &reader);
+    }
+    benchmark::DoNotOptimize(sum);
+  }
+  state.SetItemsProcessed(state.iterations() * kNumValues);
+}
+BENCHMARK(BM_HuffmanReaderRead);
+
+void BM_ANSReaderRead(benchmark::State& state) {
+  std::vector<uint8_t> data = ANSData();
+  ANSReader ans_reader;
+  for (auto _ : state) {
+    BitReader reader(data.data(), data.size());
+    ans_reader.Init(kNumBenchmarkContexts, &reader);
+    size_t sum = 0;
+    for (size_t i = 0; i < kNumValues; i++) {
+      reader.Refill();
+      sum += ans_reader.Read(i % kNumBenchmarkContexts, &reader);
+    }
+    benchmark::DoNotOptimize(sum);
+  }
+  state.SetItemsProcessed(state.iterations() * kNumValues);
+}
+BENCHMARK(BM_ANSReaderRead);
+
+template <typename Reader>
+void IntegerCoderRead(benchmark::State& state,
+                      const std::vector<uint8_t>& data) {
+  Reader entropy_reader;
+  for (auto _ : state) {
+    BitReader reader(data.data(), data.size());
+    entropy_reader.Init(kNumBenchmarkContexts, &reader);
+    size_t sum = 0;
+    for (size_t i = 0; i < kNumValues; i++) {
+      sum += IntegerCoder::Read(i % kNumBenchmarkContexts, &reader,
+                                &entropy_reader);
+    }
+    benchmark::DoNotOptimize(sum);
+  }
+  state.SetItemsProcessed(state.iterations() * kNumValues);
+}
+
+void BM_IntegerCoderReadHuffman(benchmark::State& state) {
+  IntegerCoderRead<HuffmanReader>(state, HuffmanData());
+}
+BENCHMARK(BM_IntegerCoderReadHuffman);
+
+void BM_IntegerCoderReadANS(benchmark::State& state) {
+  IntegerCoderRead<ANSReader>(state, ANSData());
+}
+BENCHMARK(BM_IntegerCoderReadANS);
+
+}  // namespace
+}  // namespace zuckerli
@@ -0,0 +1,70 @@
+// Copyright 2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#include "adjacency_cache.h"
+
+#include "common.h"
+
+namespace zuckerli {
+
+AdjacencyCache::AdjacencyCache(size_t max_edges, size_t num_shards) {
+  ZKR_ASSERT(num_shards > 0);
+  max_edges_per_shard_ = max_edges / num_shards;
+  shards_.reserve(num_shards);
+  for (size_t i = 0; i < num_shards; i++) {
+    shards_.emplace_back(new Shard());
+  }
+}
+
+AdjacencyCache::List AdjacencyCache::Lookup(size_t node) {
+  Shard& shard = ShardFor(node);
+  std::lock_guard<std::mutex> lock(shard.mutex);
+  auto it = shard.index.find(node);
+  if (it == shard.index.end()) {
+    misses_.fetch_add(1, std::memory_order_relaxed);
+    return nullptr;
+  }
+  hits_.fetch_add(1, std::memory_order_relaxed);
+  shard.lru.splice(shard.lru.begin(), shard.lru, it->second);
+  return it->second->second;
+}
+
+void AdjacencyCache::Insert(size_t node, List list) {
+  ZKR_ASSERT(list != nullptr);
+  size_t cost = Cost(list);
+  if (cost > max_edges_per_shard_) return;
+  Shard& shard = ShardFor(node);
+  std::lock_guard<std::mutex> lock(shard.mutex);
+  // Another reader might have inserted the same list concurrently.
+  if (shard.index.count(node)) return;
+  while (shard.num_edges + cost > max_edges_per_shard_) {
+    auto& last = shard.lru.back();
+    shard.num_edges -= Cost(last.second);
+    shard.index.erase(last.first);
+    shard.lru.pop_back();
+  }
+  shard.lru.emplace_front(node, std::move(list));
+  shard.index[node] = shard.lru.begin();
+  shard.num_edges += cost;
+}
+
+size_t AdjacencyCache::NumEdges() const {
+  size_t num_edges = 0;
+  for (auto& shard : shards_) {
+    std::lock_guard<std::mutex> lock(shard->mutex);
+    num_edges += shard->num_edges;
+  }
+  return num_edges;
+}
+
+}  // namespace zuckerli
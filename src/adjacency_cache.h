@@ -0,0 +1,79 @@
+// Copyright 2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#ifndef ZUCKERLI_ADJACENCY_CACHE_H
+#define ZUCKERLI_ADJACENCY_CACHE_H
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#include <atomic>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace zuckerli {
+
+// Bounded least-recently-used cache of decoded adjacency lists, keyed by node
+// id. The capacity is expressed in number of edges; nodes are spread across
+// shards that each hold an equal part of the capacity and their own lock, so
+// the cache can be shared by concurrent readers.
+class AdjacencyCache {
+ public:
+  using List = std::shared_ptr<const std::vector<uint32_t>>;
+
+  explicit AdjacencyCache(size_t max_edges, size_t num_shards = 16);
+
+  // Returns the cached list of `node`, or nullptr if it is not present.
+  List Lookup(size_t node);
+
+  // Adds the list of `node` to the cache, evicting the least recently used
+  // lists of its shard if needed. Lists larger than the capacity of a shard
+  // are not cached.
+  void Insert(size_t node, List list);
+
+  size_t Hits() const { return hits_.load(std::memory_order_relaxed); }
+  size_t Misses() const { return misses_.load(std::memory_order_relaxed); }
+  // Number of edges currently stored in the cache.
+  size_t NumEdges() const;
+
+ private:
+  struct Shard {
+    std::mutex mutex;
+    // Most recently used lists first.
+    std::list<std::pair<size_t, List>> lru;
+    std::unordered_map<size_t, std::list<std::pair<size_t, List>>::iterator>
+        index;
+    size_t num_edges = 0;
+  };
+
+  // Entries are charged at least one edge, so that the number of empty lists
+  // is also bounded.
+  static size_t Cost(const List& list) {
+    return list->empty() ? 1 : list->size();
+  }
+
+  Shard& ShardFor(size_t node) { return *shards_[node % shards_.size()]; }
+
+  size_t max_edges_per_shard_;
+  std::vector<std::unique_ptr<Shard>> shards_;
+  std::atomic<size_t> hits_{0};
+  std::atomic<size_t> misses_{0};
+};
+
+}  // namespace zuckerli
+
+#endif  // ZUCKERLI_ADJACENCY_CACHE_H
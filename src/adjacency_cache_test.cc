@@ -0,0 +1,77 @@
+// Copyright 2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#include "adjacency_cache.h"
+
+#include <thread>
+
+#include "gtest/gtest.h"
+
+namespace zuckerli {
+namespace {
+
+AdjacencyCache::List MakeList(size_t size) {
+  return std::make_shared<const std::vector<uint32_t>>(size, 0);
+}
+
+TEST(AdjacencyCacheTest, TestHitsAndMisses) {
+  AdjacencyCache cache(/*max_edges=*/100, /*num_shards=*/1);
+  EXPECT_EQ(cache.Lookup(1), nullptr);
+  AdjacencyCache::List list = MakeList(10);
+  cache.Insert(1, list);
+  EXPECT_EQ(cache.Lookup(1), list);
+  EXPECT_EQ(cache.Hits(), 1);
+  EXPECT_EQ(cache.Misses(), 1);
+  EXPECT_EQ(cache.NumEdges(), 10);
+}
+
+TEST(AdjacencyCacheTest, TestEvictsLeastRecentlyUsed) {
+  AdjacencyCache cache(/*max_edges=*/30, /*num_shards=*/1);
+  cache.Insert(1, MakeList(10));
+  cache.Insert(2, MakeList(10));
+  cache.Insert(3, MakeList(10));
+  // Makes 1 the most recently used list.
+  EXPECT_NE(cache.Lookup(1), nullptr);
+  cache.Insert(4, MakeList(10));
+  EXPECT_NE(cache.Lookup(1), nullptr);
+  EXPECT_EQ(cache.Lookup(2), nullptr);
+  EXPECT_NE(cache.Lookup(3), nullptr);
+  EXPECT_NE(cache.Lookup(4), nullptr);
+  EXPECT_EQ(cache.NumEdges(), 30);
+}
+
+TEST(AdjacencyCacheTest, TestTooLargeListsAreNotCached) {
+  AdjacencyCache cache(/*max_edges=*/100, /*num_shards=*/4);
+  cache.Insert(1, MakeList(26));
+  EXPECT_EQ(cache.Lookup(1), nullptr);
+  EXPECT_EQ(cache.NumEdges(), 0);
+}
+
+TEST(AdjacencyCacheTest, TestConcurrentAccess) {
+  AdjacencyCache cache(/*max_edges=*/1000, /*num_shards=*/8);
+  std::vector<std::thread> threads;
+  for (size_t t = 0; t < 4; t++) {
+    threads.emplace_back([&cache, t]() {
+      for (size_t i = 0; i < 10000; i++) {
+        size_t node = (i * 7 + t) % 300;
+        if (!cache.Lookup(node)) cache.Insert(node, MakeList(node % 20));
+      }
+    });
+  }
+  for (auto& thread : threads) thread.join();
+  EXPECT_LE(cache.NumEdges(), 1000);
+  EXPECT_EQ(cache.Hits() + cache.Misses(), 40000);
+}
+
+}  // namespace
+}  // namespace zuckerli
@@ -15,7 +15,7 @@
 
 namespace zuckerli {
 BitReader::BitReader(const uint8_t *ZKR_RESTRICT data, size_t size)
-    : next_byte_(data), end_minus_8_(data + size - 8) {}
+    : next_byte_(data), end_(data + size) {}
 
 BitReader::BitReader(const uint8_t *ZKR_RESTRICT data, size_t bit_offset,
                      size_t size)
@@ -26,10 +26,8 @@ BitReader::BitReader(const uint8_t *ZKR_RESTRICT data, size_t bit_offset,
 }
 
 void BitReader::BoundsCheckedRefill() {
-  const uint8_t *end = end_minus_8_ + 8;
   for (; bits_in_buf_ < 56; bits_in_buf_ += 8) {
-    if (next_byte_ >= end)
-      break;
+    if (next_byte_ >= end_) break;
     buf_ |= static_cast<uint64_t>(*next_byte_++) << bits_in_buf_;
   }
   size_t extra_bytes = (63 - bits_in_buf_) / 8;
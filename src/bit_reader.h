@@ -25,8 +25,8 @@ namespace zuckerli {
 // fgiesen.wordpress.com/2018/02/20/reading-bits-in-far-too-many-ways-part-2/)
 // that can handle 56 bits per call. Simple implementation that only handles
 // little endian systems.
-// TODO: does not handle reads past the end of the stream (assumed to be
-// 0 bits).
+// Never reads memory past `data + size`, so it can be used on memory-mapped
+// files; reads past the end of the stream return 0 bits.
 class BitReader {
  public:
   static constexpr size_t kMaxBitsPerCall = 56;
@@ -49,7 +49,7 @@ class BitReader {
   }
 
   ZKR_INLINE void Refill() {
-    if (next_byte_ > end_minus_8_) {
+    if (end_ - next_byte_ < 8) {
       BoundsCheckedRefill();
     } else {
       uint64_t bits;
@@ -72,7 +72,7 @@ class BitReader {
   uint64_t buf_{0};
   size_t bits_in_buf_{0};
   const uint8_t *ZKR_RESTRICT next_byte_;
-  const uint8_t *ZKR_RESTRICT end_minus_8_;
+  const uint8_t *ZKR_RESTRICT end_;
   size_t nbits_read_ = 0;
   void BoundsCheckedRefill();
 };
@@ -68,5 +68,16 @@ TEST(BitsTest, TestWriteRead) {
     EXPECT_EQ(reader.ReadBits(all_bits[i].first), all_bits[i].second);
   }
 }
+TEST(BitsTest, TestReadPastEnd) {
+  // Short buffers must be read without accessing memory after their end.
+  for (size_t size = 1; size <= 16; size++) {
+    std::vector<uint8_t> data(size, 0xFF);
+    BitReader reader(data.data(), data.size());
+    for (size_t i = 0; i < size; i++) {
+      EXPECT_EQ(reader.ReadBits(8), 0xFF);
+    }
+    EXPECT_EQ(reader.ReadBits(16), 0);
+  }
+}
 }  // namespace
 }  // namespace zuckerli
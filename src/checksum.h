@@ -1,13 +1,43 @@
 #ifndef ZUCKERLI_CHECKSUM_H
 #define ZUCKERLI_CHECKSUM_H
+#include <stdint.h>
+
 #include <cstdlib>
 
 #include "common.h"
 
 namespace zuckerli {
-ZKR_INLINE size_t Checksum(size_t chk, size_t a, size_t b) {
-  return chk + (a ^ b) + (((chk << 23) | (chk >> 41)) ^ ~b);
+
+// The checksum of a graph is the sum (modulo 2^64) of a hash of each of its
+// edges. It does not depend on the order in which edges are visited, so the
+// checksums of disjoint sets of edges (e.g. of adjacency lists, segments, or
+// the edges seen by each thread) can be computed independently and combined by
+// adding them.
+
+// Hash of the edge from `a` to `b`.
+ZKR_INLINE uint64_t EdgeHash(uint64_t a, uint64_t b) {
+  // Finalizer of MurmurHash3.
+  uint64_t x = (a * 0x9E3779B97F4A7C15ull) ^ b;
+  x ^= x >> 33;
+  x *= 0xFF51AFD7ED558CCDull;
+  x ^= x >> 33;
+  x *= 0xC4CEB9FE1A85EC53ull;
+  x ^= x >> 33;
+  return x;
 }
+
+// Checksum of the edges from `node` to each element of `neighbours`. The loop
+// has no dependencies between iterations other than the sum, so that the
+// compiler can vectorize it.
+ZKR_INLINE uint64_t ListChecksum(size_t node, span<const uint32_t> neighbours) {
+  uint64_t sum = 0;
+  const uint32_t* ZKR_RESTRICT data = neighbours.data();
+  for (size_t i = 0; i < neighbours.size(); i++) {
+    sum += EdgeHash(node, data[i]);
+  }
+  return sum;
+}
+
 }  // namespace zuckerli
 
 #endif  // ZUCKERLI_CHECKSUM_H
@@ -15,6 +15,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdarg.h>
+#include <unistd.h>
 
 namespace zuckerli {
 __attribute__((noreturn, __format__(__printf__, 3, 4))) void
@@ -29,4 +30,14 @@ Abort(const char *file, int line, const char *format, ...) {
   fprintf(stderr, "Abort at %s:%d: %s\n", file, line, buf);
   abort();
 }
+
+FILE *CreateTemporaryFile(const std::string &dir) {
+  std::string path = dir + "/zuckerli_XXXXXX";
+  int fd = mkstemp(&path[0]);
+  if (fd == -1) return nullptr;
+  unlink(path.c_str());
+  FILE *file = fdopen(fd, "w+b");
+  if (file == nullptr) close(fd);
+  return file;
+}
 } // namespace zuckerli
@@ -14,7 +14,11 @@
 #ifndef ZUCKERLI_COMMON_H
 #define ZUCKERLI_COMMON_H
 
+#include <stddef.h>
 #include <stdint.h>
+#include <stdio.h>
+
+#include <string>
 
 #define ZKR_ASSERT(cond)                                                       \
   do {                                                                         \
@@ -47,6 +51,9 @@
 
 #define ZKR_INLINE inline __attribute__((always_inline))
 
+// Hints that the cache line containing `ptr` will be read soon. Never faults.
+#define ZKR_PREFETCH(ptr) __builtin_prefetch(ptr)
+
 #define ZKR_RETURN_IF_ERROR(cond) \
   if (!(cond)) return false;
 
@@ -67,7 +74,41 @@ ZKR_INLINE int FloorLog2Nonzero(uint64_t value) {
   return 63 - __builtin_clzll(value);
 }
 
+// Read-only view of `size` consecutive elements starting at `data`.
+template <typename T>
+class span {
+ public:
+  using iterator = const T *;
+  span() : data_(nullptr), size_(0) {}
+  span(const T *data, size_t size) : data_(data), size_(size) {}
+  iterator begin() const { return data_; }
+  iterator end() const { return data_ + size_; }
+  const T &operator[](size_t pos) const { return data_[pos]; }
+  ZKR_INLINE T &at(size_t pos) {
+    ZKR_DASSERT(pos < size_);
+    return data_[pos];
+  }
+  ZKR_INLINE const T &at(size_t pos) const {
+    ZKR_DASSERT(pos < size_);
+    return data_[pos];
+  }
+  ZKR_INLINE size_t size() const { return size_; }
+  ZKR_INLINE const T *data() const { return data_; }
+
+ private:
+  const T *data_;
+  size_t size_;
+};
+
+// Creates a file in the directory `dir`, open for reading and writing, that is
+// deleted as soon as it is closed. Returns nullptr on errors.
+FILE *CreateTemporaryFile(const std::string &dir);
+
+// If set (for example with -DZKR_HONOR_FLAGS=1), the encoder reads the
+// IntegerCoder and reference search parameters from the command line flags.
+#ifndef ZKR_HONOR_FLAGS
 #define ZKR_HONOR_FLAGS 0
+#endif
 
 }  // namespace zuckerli
 
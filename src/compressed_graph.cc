@@ -1,5 +1,6 @@
 #include "compressed_graph.h"
 
+#include <algorithm>
 #include <cstddef>
 #include <cstdio>
 #include <cstdlib>
@@ -8,50 +9,80 @@
 #include "common.h"
 #include "context_model.h"
 #include "decode.h"
+#include "graph_header.h"
 #include "integer_coder.h"
 
 namespace zuckerli {
 
-CompressedGraph::CompressedGraph(const std::string& file) {
-  FILE* in = std::fopen(file.c_str(), "r");
-  ZKR_ASSERT(in);
+CompressedGraph::CompressedGraph(const std::string& file, bool memory_map) {
+  if (memory_map) {
+    // Pages are only loaded when accessed, and shared with any other process
+    // that maps the same file.
+    mapped_.reset(new MemoryMappedFile(file, /*populate=*/false));
+    data_ = mapped_->data();
+    size_ = mapped_->size();
+  } else {
+    FILE* in = std::fopen(file.c_str(), "r");
+    ZKR_ASSERT(in);
 
-  fseek(in, 0, SEEK_END);
-  size_t len = ftell(in);
-  fseek(in, 0, SEEK_SET);
+    fseek(in, 0, SEEK_END);
+    size_t len = ftell(in);
+    fseek(in, 0, SEEK_SET);
 
-  compressed_.resize(len);
-  ZKR_ASSERT(fread(compressed_.data(), 1, len, in) == len);
-  if (compressed_.empty()) ZKR_ABORT("Empty file");
+    compressed_.resize(len);
+    ZKR_ASSERT(fread(compressed_.data(), 1, len, in) == len);
+    fclose(in);
+    data_ = compressed_.data();
+    size_ = compressed_.size();
+  }
+  if (size_ == 0) ZKR_ABORT("Empty file");
 
-  BitReader reader(compressed_.data(), compressed_.size());
-  num_nodes_ = reader.ReadBits(48);
-  bool allow_random_access = reader.ReadBits(1);
-  if (!allow_random_access) {
+  GraphHeader header;
+  if (!ReadGraphHeader(data_, size_, &header)) {
+    ZKR_ABORT("Invalid header");
+  }
+  num_nodes_ = header.num_nodes;
+  if (!header.allow_random_access) {
     ZKR_ABORT("No random access allowed");
   }
+  degree_chunk_mask_ = header.degree_chunk_size - 1;
+  max_chain_length_ = header.max_chain_length;
+  // Decoding is specialized for the parameters of IntegerCoder.
+  if (header.integer_coder != IntegerCoder::GetParams()) {
+    ZKR_ABORT("Unsupported integer coder parameters");
+  }
+  data_start_ = header.data_start;
 
+  BitReader reader(data_ + data_start_, size_ - data_start_);
   huff_reader_.Init(kNumContexts, &reader);
 
-  node_start_indices_.clear();
-  node_start_indices_.reserve(num_nodes_);
-  if (!DecodeGraph(compressed_, nullptr, &node_start_indices_)) {
-    ZKR_ABORT("Invalid graph");
+  if (header.has_offset_index) {
+    if (!node_start_indices_.Init(num_nodes_, data_ + header.offset_index_start,
+                                  header.data_start -
+                                      header.offset_index_start)) {
+      ZKR_ABORT("Invalid offset index");
+    }
+  } else {
+    // Files written without an index: find node positions by decoding the
+    // whole graph.
+    std::vector<size_t> node_start_indices;
+    node_start_indices.reserve(num_nodes_);
+    if (!DecodeGraph(data_, size_, nullptr, &node_start_indices)) {
+      ZKR_ABORT("Invalid graph");
+    }
+    node_start_indices_.Build(node_start_indices);
   }
 }
 
-uint32_t CompressedGraph::ReadDegreeBits(uint32_t node_id, size_t context) {
-  BitReader bit_reader(compressed_.data() + node_start_indices_[node_id] / 8,
-                       compressed_.size());
-  bit_reader.ReadBits(node_start_indices_[node_id] % 8);
+uint32_t CompressedGraph::ReadDegreeBits(uint32_t node_id,
+                                         size_t context) const {
+  BitReader bit_reader(data_, NodeStart(node_id), size_);
   return zuckerli::IntegerCoder::Read(context, &bit_reader, &huff_reader_);
 }
 
 std::pair<uint32_t, size_t> CompressedGraph::ReadDegreeAndRefBits(
-    uint32_t node_id, size_t context, size_t last_reference_offset) {
-  BitReader bit_reader(compressed_.data() + node_start_indices_[node_id] / 8,
-                       compressed_.size());
-  bit_reader.ReadBits(node_start_indices_[node_id] % 8);
+    uint32_t node_id, size_t context, size_t last_reference_offset) const {
+  BitReader bit_reader(data_, NodeStart(node_id), size_);
   uint32_t degree =
       zuckerli::IntegerCoder::Read(context, &bit_reader, &huff_reader_);
   // If this is not the first node, read the offset of the list to be used as
@@ -64,8 +95,50 @@ std::pair<uint32_t, size_t> CompressedGraph::ReadDegreeAndRefBits(
   return std::make_pair(degree, reference_offset);
 }
 
-uint32_t CompressedGraph::Degree(size_t node_id) {
-  uint32_t first_node_in_chunk = node_id - node_id % kDegreeReferenceChunkSize;
+void CompressedGraph::EnableReferenceCache(size_t max_edges,
+                                           size_t num_shards) {
+  reference_cache_.reset(new AdjacencyCache(max_edges, num_shards));
+}
+
+void CompressedGraph::EnableMultiSymbolDecoding() {
+  // Tokens below the split token are the residuals themselves. Zeros stop the
+  // chain, as they may be followed by a run length.
+  const size_t split_token = size_t{1} << IntegerCoder::Log2NumExplicit();
+  huff_reader_.BuildMultiSymbolTables(
+      kResidualBaseContext, kRleContext, [&](size_t ctx, size_t symbol) {
+        if (symbol == 0 || symbol >= split_token) return kRleContext;
+        return ResidualContext(symbol);
+      });
+  multi_symbol_ = true;
+}
+
+void CompressedGraph::BuildDegreeIndex(size_t bits_per_degree) {
+  ZKR_ASSERT(bits_per_degree > 0 && bits_per_degree <= 32);
+  PackedArray degree_index(num_nodes_, bits_per_degree);
+  size_t degree = 0;
+  size_t last_degree_delta = 0;
+  for (size_t node_id = 0; node_id < num_nodes_; node_id++) {
+    if ((node_id & degree_chunk_mask_) == 0) {
+      degree = ReadDegreeBits(node_id, kFirstDegreeContext);
+      last_degree_delta = degree;
+    } else {
+      last_degree_delta =
+          ReadDegreeBits(node_id, DegreeContext(last_degree_delta));
+      degree += UnpackSigned(last_degree_delta);
+    }
+    if (degree > num_nodes_) ZKR_ABORT("Invalid degree");
+    degree_index.Set(node_id,
+                     std::min<uint64_t>(degree, degree_index.max_value()));
+  }
+  degree_index_ = std::move(degree_index);
+}
+
+uint32_t CompressedGraph::Degree(size_t node_id) const {
+  if (degree_index_.size() != 0) {
+    uint64_t degree = degree_index_.Get(node_id);
+    if (degree != degree_index_.max_value()) return degree;
+  }
+  uint32_t first_node_in_chunk = node_id & ~degree_chunk_mask_;
   uint32_t reconstructed_degree =
       ReadDegreeBits(first_node_in_chunk, kFirstDegreeContext);
   size_t context;
@@ -79,19 +152,136 @@ uint32_t CompressedGraph::Degree(size_t node_id) {
   return reconstructed_degree;
 }
 
-std::vector<uint32_t> CompressedGraph::Neighbours(size_t node_id) {
-  BitReader bit_reader(compressed_.data() + node_start_indices_[node_id] / 8,
-                       compressed_.size());
-  bit_reader.ReadBits(node_start_indices_[node_id] % 8);
-  std::vector<uint32_t> neighbours;
+std::vector<uint32_t> CompressedGraph::Neighbours(size_t node_id) const {
+  NeighboursContext context;
+  span<const uint32_t> neighbours = Neighbours(node_id, &context);
+  return std::vector<uint32_t>(neighbours.begin(), neighbours.end());
+}
+
+span<const uint32_t> CompressedGraph::Neighbours(
+    size_t node_id, NeighboursContext* context) const {
+  return DecodeNeighbours(node_id, /*depth=*/0, context);
+}
+
+void CompressedGraph::NeighboursBatch(span<const uint32_t> nodes,
+                                      NeighboursBatchResult* result) const {
+  std::vector<uint32_t>& sorted_nodes = result->nodes_;
+  sorted_nodes.assign(nodes.begin(), nodes.end());
+  std::sort(sorted_nodes.begin(), sorted_nodes.end());
+  sorted_nodes.erase(std::unique(sorted_nodes.begin(), sorted_nodes.end()),
+                     sorted_nodes.end());
+  if (!sorted_nodes.empty() && sorted_nodes.back() >= num_nodes_) {
+    ZKR_ABORT("Invalid node");
+  }
+  result->offsets_.assign(1, 0);
+  result->edges_.clear();
+  NeighboursContext* context = &result->context_;
+  context->batch_ = result;
+
+  size_t next = 0;  // Index of the next node of the batch to decode.
+  while (next < sorted_nodes.size()) {
+    size_t first_node_in_chunk = sorted_nodes[next] & ~degree_chunk_mask_;
+    uint32_t degree = 0;
+    size_t last_degree_delta = 0;
+    size_t last_reference_offset = 0;
+    // Walk the chunk up to its last node in the batch, decoding degrees and
+    // references only once.
+    for (size_t node_id = first_node_in_chunk;
+         next < sorted_nodes.size() &&
+         (sorted_nodes[next] & ~degree_chunk_mask_) == first_node_in_chunk;
+         node_id++) {
+      BitReader bit_reader(data_, NodeStart(node_id), size_);
+      if (node_id == first_node_in_chunk) {
+        last_degree_delta =
+            IntegerCoder::Read(kFirstDegreeContext, &bit_reader, &huff_reader_);
+        degree = last_degree_delta;
+      } else {
+        last_degree_delta = IntegerCoder::Read(
+            DegreeContext(last_degree_delta), &bit_reader, &huff_reader_);
+        degree += UnpackSigned(last_degree_delta);
+      }
+      if (degree > num_nodes_) ZKR_ABORT("Invalid degree");
+      size_t reference_offset = 0;
+      if (degree != 0 && node_id != 0) {
+        reference_offset =
+            IntegerCoder::Read(ReferenceContext(last_reference_offset),
+                               &bit_reader, &huff_reader_);
+      }
+      if (degree != 0) last_reference_offset = reference_offset;
+      if (node_id != sorted_nodes[next]) continue;
+      if (degree != 0) {
+        span<const uint32_t> neighbours =
+            DecodeList(node_id, degree, reference_offset, &bit_reader,
+                       /*depth=*/0, context);
+        result->edges_.insert(result->edges_.end(), neighbours.begin(),
+                              neighbours.end());
+      }
+      result->offsets_.push_back(result->edges_.size());
+      next++;
+    }
+  }
+  context->batch_ = nullptr;
+}
+
+void CompressedGraph::Prefetch(span<const uint32_t> nodes) const {
+  // Bytes of each list prefetched after its start, and maximum number of
+  // bytes prefetched for each node.
+  constexpr size_t kListBytes = 128;
+  constexpr size_t kMaxBytes = 1024;
+  constexpr size_t kCacheLineSize = 64;
+  // Invalid ids are ignored, as hints must never fault.
+  for (uint32_t node_id : nodes) {
+    if (node_id >= num_nodes_) continue;
+    node_start_indices_.Prefetch(node_id & ~degree_chunk_mask_);
+    node_start_indices_.Prefetch(node_id);
+  }
+  for (uint32_t node_id : nodes) {
+    if (node_id >= num_nodes_) continue;
+    // Decoding reads the degree at the start of each previous list of the
+    // chunk, and then the list itself.
+    size_t begin = NodeStart(node_id & ~degree_chunk_mask_) / 8;
+    size_t end = std::min(
+        {NodeStart(node_id) / 8 + kListBytes, begin + kMaxBytes, size_});
+    for (size_t pos = begin; pos < end; pos += kCacheLineSize) {
+      ZKR_PREFETCH(data_ + pos);
+    }
+    if (begin < end) ZKR_PREFETCH(data_ + end - 1);
+  }
+}
 
-  uint32_t first_node_in_chunk = node_id - node_id % kDegreeReferenceChunkSize;
+span<const uint32_t> CompressedGraph::ReferenceNeighbours(
+    size_t node_id, size_t depth, NeighboursContext* context) const {
+  if (context->batch_) {
+    // Lists are decoded in increasing order, and references always precede the
+    // node that uses them.
+    const NeighboursBatchResult* batch = context->batch_;
+    size_t num_decoded = batch->offsets_.size() - 1;
+    size_t index = batch->Find(node_id, num_decoded);
+    if (index != batch->size()) return batch->neighbours(index);
+  }
+  if (!reference_cache_) return DecodeNeighbours(node_id, depth, context);
+  NeighboursContext::DecodedList& level = context->Level(depth);
+  level.cached = reference_cache_->Lookup(node_id);
+  if (!level.cached) {
+    span<const uint32_t> neighbours =
+        DecodeNeighbours(node_id, depth, context);
+    level.cached = std::make_shared<const std::vector<uint32_t>>(
+        neighbours.begin(), neighbours.end());
+    reference_cache_->Insert(node_id, level.cached);
+  }
+  return span<const uint32_t>(level.cached->data(), level.cached->size());
+}
+
+span<const uint32_t> CompressedGraph::DecodeNeighbours(
+    size_t node_id, size_t depth, NeighboursContext* context) const {
+  BitReader bit_reader(data_, NodeStart(node_id), size_);
+  uint32_t first_node_in_chunk = node_id & ~degree_chunk_mask_;
   uint32_t reconstructed_degree;
   size_t reference_offset = 0;
   size_t last_reference_offset = 0;
   size_t last_degree_delta = 0;
   if (first_node_in_chunk != node_id) {
-    size_t context;
+    size_t ctx;
     std::tie(reconstructed_degree, reference_offset) = ReadDegreeAndRefBits(
         first_node_in_chunk, kFirstDegreeContext, last_reference_offset);
     if (reconstructed_degree != 0) {
@@ -99,23 +289,23 @@ std::vector<uint32_t> CompressedGraph::Neighbours(size_t node_id) {
     }
     last_degree_delta = reconstructed_degree;
     for (int node = first_node_in_chunk + 1; node < node_id; ++node) {
-      context = DegreeContext(last_degree_delta);
+      ctx = DegreeContext(last_degree_delta);
       std::tie(last_degree_delta, reference_offset) =
-          ReadDegreeAndRefBits(node, context, last_reference_offset);
+          ReadDegreeAndRefBits(node, ctx, last_reference_offset);
       reconstructed_degree += UnpackSigned(last_degree_delta);
       if (reconstructed_degree != 0) {
         last_reference_offset = reference_offset;
       }
     }
-    context = DegreeContext(last_degree_delta);
-    last_degree_delta = IntegerCoder::Read(context, &bit_reader, &huff_reader_);
+    ctx = DegreeContext(last_degree_delta);
+    last_degree_delta = IntegerCoder::Read(ctx, &bit_reader, &huff_reader_);
     reconstructed_degree += UnpackSigned(last_degree_delta);
   } else {
     reconstructed_degree =
         IntegerCoder::Read(kFirstDegreeContext, &bit_reader, &huff_reader_);
   }
 
-  if (reconstructed_degree == 0) return {};
+  if (reconstructed_degree == 0) return span<const uint32_t>();
 
   if (node_id != 0) {
     reference_offset = IntegerCoder::Read(
@@ -123,27 +313,45 @@ std::vector<uint32_t> CompressedGraph::Neighbours(size_t node_id) {
   }
 
   if (reconstructed_degree > num_nodes_) ZKR_ABORT("Invalid degree");
+  return DecodeList(node_id, reconstructed_degree, reference_offset,
+                    &bit_reader, depth, context);
+}
+
+span<const uint32_t> CompressedGraph::DecodeList(
+    size_t node_id, uint32_t degree, size_t reference_offset,
+    BitReader* bit_reader, size_t depth, NeighboursContext* context) const {
+  // References are decoded in deeper levels, which do not overwrite this one.
+  NeighboursContext::DecodedList& level = context->Level(depth);
+  std::vector<uint32_t>& neighbours = level.neighbours;
+  std::vector<uint32_t>& block_lengths = level.block_lengths;
+  neighbours.clear();
+  block_lengths.clear();
+
   if (reference_offset > node_id) ZKR_ABORT("Invalid reference_offset");
 
-  std::vector<uint32_t> ref_list;
-  std::vector<uint32_t> block_lengths;
+  neighbours.reserve(degree);
+  span<const uint32_t> ref_list;
+  if (reference_offset != 0) {
+    // Bounds the work done for a list, whatever the file contains.
+    if (depth >= max_chain_length_) ZKR_ABORT("Reference chain too long");
+    ref_list =
+        ReferenceNeighbours(node_id - reference_offset, depth + 1, context);
+  }
   // If a reference_offset is used, read the list of blocks of (alternating)
   // copied and skipped edges.
   size_t num_to_copy = 0;
   if (reference_offset != 0) {
-    size_t ref_id = node_id - reference_offset;
-    ref_list = Neighbours(ref_id);
     size_t block_count =
-        IntegerCoder::Read(kBlockCountContext, &bit_reader, &huff_reader_);
+        IntegerCoder::Read(kBlockCountContext, bit_reader, &huff_reader_);
     size_t block_end = 0;  // end of current block
     for (size_t j = 0; j < block_count; j++) {
       size_t ctx = j == 0 ? kBlockContext
                           : (j % 2 == 0 ? kBlockContextEven : kBlockContextOdd);
       size_t block_len;
       if (j == 0) {
-        block_len = IntegerCoder::Read(ctx, &bit_reader, &huff_reader_);
+        block_len = IntegerCoder::Read(ctx, bit_reader, &huff_reader_);
       } else {
-        block_len = IntegerCoder::Read(ctx, &bit_reader, &huff_reader_) + 1;
+        block_len = IntegerCoder::Read(ctx, bit_reader, &huff_reader_) + 1;
       }
       block_end += block_len;
       block_lengths.push_back(block_len);
@@ -162,7 +370,7 @@ std::vector<uint32_t> CompressedGraph::Neighbours(size_t node_id) {
   // reference_offset node for delta-coding of neighbours.
   size_t last_dest_plus_one = 0;  // will not be used
   // Number of edges to read.
-  size_t num_residuals = reconstructed_degree - num_to_copy;
+  size_t num_residuals = degree - num_to_copy;
   // Last delta for the residual edges, used for context modeling.
   size_t last_residual_delta = 0;
   // Current position in the reference list (because we are making a sorted
@@ -192,19 +400,39 @@ std::vector<uint32_t> CompressedGraph::Neighbours(size_t node_id) {
     neighbours.push_back(destination);
     return true;
   };
+  // Residuals decoded by the last multi-symbol lookup, of which the first
+  // `num_used_symbols` have already been consumed.
+  HuffmanSymbols symbols;
+  size_t num_used_symbols = 0;
   for (size_t j = 0; j < num_residuals; j++) {
     size_t destination_node;
     if (j == 0) {
       last_residual_delta = IntegerCoder::Read(
-          FirstResidualContext(num_residuals), &bit_reader, &huff_reader_);
+          FirstResidualContext(num_residuals), bit_reader, &huff_reader_);
       destination_node = node_id + UnpackSigned(last_residual_delta);
     } else if (num_zeros_to_skip >
                0) {  // If in a zero run, don't read anything.
       last_residual_delta = 0;
       destination_node = last_dest_plus_one;
+    } else if (multi_symbol_) {
+      // The symbols of a lookup are only chained through residual contexts,
+      // and the chain stops at zeros, so the remaining ones are always the
+      // next residuals of this list.
+      if (num_used_symbols >= symbols.count()) {
+        bit_reader->Refill();
+        symbols = huff_reader_.PeekSymbols(ResidualContext(last_residual_delta),
+                                           bit_reader);
+        num_used_symbols = 0;
+      }
+      bit_reader->Advance(
+          symbols.nbits(num_used_symbols) -
+          (num_used_symbols == 0 ? 0 : symbols.nbits(num_used_symbols - 1)));
+      last_residual_delta = IntegerCoder::DecodeToken(
+          symbols.symbol(num_used_symbols++), bit_reader);
+      destination_node = last_dest_plus_one + last_residual_delta;
     } else {
       last_residual_delta = IntegerCoder::Read(
-          ResidualContext(last_residual_delta), &bit_reader, &huff_reader_);
+          ResidualContext(last_residual_delta), bit_reader, &huff_reader_);
       destination_node = last_dest_plus_one + last_residual_delta;
     }
     // Compute run of zeros if we read a zero and we are not already in one.
@@ -242,7 +470,7 @@ std::vector<uint32_t> CompressedGraph::Neighbours(size_t node_id) {
     // zeros to decode from the bitstream.
     if (contiguous_zeroes_len >= kRleMin) {
       num_zeros_to_skip =
-          IntegerCoder::Read(kRleContext, &bit_reader, &huff_reader_);
+          IntegerCoder::Read(kRleContext, bit_reader, &huff_reader_);
       contiguous_zeroes_len = 0;
     }
     if (!append(destination_node)) ZKR_ABORT("Invalid residual");
@@ -261,7 +489,7 @@ std::vector<uint32_t> CompressedGraph::Neighbours(size_t node_id) {
       next_block += 2;
     }
   }
-  return neighbours;
-}  // namespace zuckerli
+  return span<const uint32_t>(neighbours.data(), neighbours.size());
+}
 
 }  // namespace zuckerli
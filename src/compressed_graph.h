@@ -1,11 +1,15 @@
 #ifndef THIRD_PARTY_ZUCKERLI_SRC_COMPRESSED_GRAPH_H_
 #define THIRD_PARTY_ZUCKERLI_SRC_COMPRESSED_GRAPH_H_
 
+#include <algorithm>
 #include <chrono>
+#include <deque>
 #include <iostream>
 #include <limits>
+#include <memory>
 #include <vector>
 
+#include "adjacency_cache.h"
 #include "ans.h"
 #include "bit_reader.h"
 #include "checksum.h"
@@ -13,25 +17,180 @@
 #include "context_model.h"
 #include "huffman.h"
 #include "integer_coder.h"
+#include "memory_mapped_file.h"
+#include "offset_index.h"
+#include "packed_array.h"
 
 namespace zuckerli {
 
+class NeighboursBatchResult;
+
+// Reusable scratch space for decoding adjacency lists. Once its buffers have
+// grown to fit the lists being decoded, decoding does not allocate memory.
+// Each thread should use its own context.
+class NeighboursContext {
+ private:
+  friend class CompressedGraph;
+  struct DecodedList {
+    std::vector<uint32_t> neighbours;
+    std::vector<uint32_t> block_lengths;
+    // Keeps alive the list returned by the reference cache, if any.
+    AdjacencyCache::List cached;
+  };
+  // Level `i+1` holds the reference of the list at level `i`. A deque keeps
+  // references to existing levels valid when adding new ones.
+  DecodedList &Level(size_t depth) {
+    if (levels_.size() <= depth) levels_.resize(depth + 1);
+    return levels_[depth];
+  }
+  std::deque<DecodedList> levels_;
+  // Batch being decoded, if any: its lists are used as references.
+  const NeighboursBatchResult *batch_ = nullptr;
+};
+
+// Adjacency lists decoded by CompressedGraph::NeighboursBatch. Reusing the same
+// object for several batches avoids allocating memory once its buffers have
+// grown large enough.
+class NeighboursBatchResult {
+ public:
+  // Number of distinct nodes in the batch.
+  size_t size() const { return nodes_.size(); }
+  // Nodes are sorted in increasing order.
+  uint32_t node(size_t i) const { return nodes_[i]; }
+  span<const uint32_t> neighbours(size_t i) const {
+    return span<const uint32_t>(edges_.data() + offsets_[i],
+                                offsets_[i + 1] - offsets_[i]);
+  }
+
+ private:
+  friend class CompressedGraph;
+  // Returns the index of `node_id` among the first `num_decoded` nodes, or
+  // size() if it is not there.
+  size_t Find(uint32_t node_id, size_t num_decoded) const {
+    auto end = nodes_.begin() + num_decoded;
+    auto it = std::lower_bound(nodes_.begin(), end, node_id);
+    return it != end && *it == node_id ? it - nodes_.begin() : size();
+  }
+  std::vector<uint32_t> nodes_;
+  // The neighbours of nodes_[i] are edges_[offsets_[i], offsets_[i+1]).
+  std::vector<size_t> offsets_;
+  std::vector<uint32_t> edges_;
+  NeighboursContext context_;
+};
+
+// Random access to the adjacency lists of a graph encoded with
+// allow_random_access.
+//
+// Thread safety: the setup methods (BuildDegreeIndex, EnableMultiSymbolDecoding
+// and EnableReferenceCache) must be called before any query, and not
+// concurrently with anything else. After that, all const methods can be called
+// concurrently from any number of threads on the same object, provided that
+// each thread passes its own NeighboursContext or NeighboursBatchResult: these
+// hold all the mutable decoding state. The reference cache, which is shared,
+// is internally synchronized.
+//
+// The object owns (or maps) the whole compressed graph, so it cannot be copied:
+// share it by reference or pointer instead.
 class CompressedGraph {
  public:
-  CompressedGraph(const std::string &file);
-  ZKR_INLINE size_t size() { return num_nodes_; }
-  uint32_t Degree(size_t node_id);
-  std::vector<uint32_t> Neighbours(size_t node_id);
+  // If `memory_map` is true, the file is memory-mapped instead of being read
+  // into memory: this avoids copying it, and allows several processes to share
+  // the same copy of the graph.
+  explicit CompressedGraph(const std::string &file, bool memory_map = false);
+  CompressedGraph(const CompressedGraph &) = delete;
+  CompressedGraph &operator=(const CompressedGraph &) = delete;
+
+  ZKR_INLINE size_t size() const { return num_nodes_; }
+  // Granularity of the graph, chosen when encoding it (see graph_header.h):
+  // decoding a list decodes the degrees and references of up to
+  // degree_chunk_size() nodes, and then up to max_chain_length() other lists.
+  size_t degree_chunk_size() const { return degree_chunk_mask_ + 1; }
+  size_t max_chain_length() const { return max_chain_length_; }
+  uint32_t Degree(size_t node_id) const;
+  std::vector<uint32_t> Neighbours(size_t node_id) const;
+  // Decodes the neighbours of `node_id` into the buffers of `context`, without
+  // allocating memory once they are large enough (except when inserting into
+  // the reference cache). The result is valid until the next call that uses
+  // the same context.
+  span<const uint32_t> Neighbours(size_t node_id,
+                                  NeighboursContext *context) const;
+  // Decodes the neighbours of all the nodes in `nodes` into `result`. Nodes in
+  // the same chunk (see degree_chunk_size()) share the decoding of the degrees
+  // and references of the chunk, and lists of the batch are not
+  // decoded again when used as a reference by other lists of the batch.
+  void NeighboursBatch(span<const uint32_t> nodes,
+                       NeighboursBatchResult *result) const;
+
+  // Hints that the lists of `nodes` will be decoded soon. Prefetches the
+  // positions of their lists and then the start of their data, issuing the
+  // accesses for all the nodes before waiting for any of them, so that their
+  // cache misses overlap. Calling this a few hundred nodes ahead of decoding
+  // hides most of the memory latency of traversals of graphs larger than the
+  // cache. Reference lists are not prefetched: finding them requires decoding.
+  // Ids that are not smaller than size() are ignored.
+  void Prefetch(span<const uint32_t> nodes) const;
+
+  // Stores the degree of every node with `bits_per_degree` bits, so that
+  // Degree() takes a single memory access instead of decoding up to
+  // degree_chunk_size() degrees. Degrees that do not fit are still
+  // decoded on every call. Building the index decodes the degree of every node.
+  void BuildDegreeIndex(size_t bits_per_degree = 32);
+
+  // Builds tables that decode up to kMaxSymbolsPerLookup consecutive small
+  // residuals with a single table lookup, and uses them when decoding
+  // residuals.
+  void EnableMultiSymbolDecoding();
+
+  // Keeps up to `max_edges` edges of recently decoded lists that were used as
+  // a reference by other lists, so that following the same reference chains
+  // again does not require decoding them.
+  void EnableReferenceCache(size_t max_edges, size_t num_shards = 16);
+  // Returns nullptr if the cache is not enabled.
+  const AdjacencyCache *reference_cache() const {
+    return reference_cache_.get();
+  }
 
  private:
   size_t num_nodes_;
+  size_t degree_chunk_mask_;
+  size_t max_chain_length_;
+  // Storage for the compressed graph: either `compressed_` or `mapped_`.
   std::vector<uint8_t> compressed_;
-  std::vector<size_t> node_start_indices_;
+  std::unique_ptr<MemoryMappedFile> mapped_;
+  const uint8_t *data_;
+  size_t size_;
+  // Byte position of the data section in the file.
+  size_t data_start_;
+  // Bit positions of each node, relative to the data section.
+  OffsetIndex node_start_indices_;
   HuffmanReader huff_reader_;
+  bool multi_symbol_ = false;
+  // Not const when the graph is: it is shared by all queries, and locks
+  // internally.
+  std::unique_ptr<AdjacencyCache> reference_cache_;
+  // Empty if not built. Its maximum value marks degrees that did not fit.
+  PackedArray degree_index_;
+
+  ZKR_INLINE size_t NodeStart(size_t node_id) const {
+    return data_start_ * 8 + node_start_indices_[node_id];
+  }
 
-  uint32_t ReadDegreeBits(uint32_t node_id, size_t context);
+  // Decodes the neighbours of `node_id` in the level `depth` of `context`.
+  span<const uint32_t> DecodeNeighbours(size_t node_id, size_t depth,
+                                        NeighboursContext *context) const;
+  // Same as DecodeNeighbours, for a node used as a reference: goes through the
+  // reference cache if enabled.
+  span<const uint32_t> ReferenceNeighbours(size_t node_id, size_t depth,
+                                           NeighboursContext *context) const;
+  // Decodes the rest of the list of `node_id`, given its degree (non-zero) and
+  // reference offset, with `bit_reader` positioned right after the latter.
+  span<const uint32_t> DecodeList(size_t node_id, uint32_t degree,
+                                  size_t reference_offset,
+                                  BitReader *bit_reader, size_t depth,
+                                  NeighboursContext *context) const;
+  uint32_t ReadDegreeBits(uint32_t node_id, size_t context) const;
   std::pair<uint32_t, size_t> ReadDegreeAndRefBits(
-      uint32_t node_id, size_t context, size_t last_reference_offset);
+      uint32_t node_id, size_t context, size_t last_reference_offset) const;
 };
 
 }  // namespace zuckerli
@@ -0,0 +1,322 @@
+// Copyright 2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#include "compressed_graph.h"
+
+#include <algorithm>
+#include <atomic>
+#include <new>
+#include <numeric>
+#include <random>
+#include <thread>
+
+#include "absl/flags/flag.h"
+#include "encode.h"
+#include "gtest/gtest.h"
+#include "test_utils.h"
+#include "uncompressed_graph.h"
+
+// Counts heap allocations, to check that decoding with a NeighboursContext
+// does not allocate.
+static std::atomic<size_t> num_allocations{0};
+
+void* operator new(size_t size) {
+  num_allocations.fetch_add(1, std::memory_order_relaxed);
+  void* ptr = malloc(size);
+  if (ptr == nullptr) throw std::bad_alloc();
+  return ptr;
+}
+
+void operator delete(void* ptr) noexcept { free(ptr); }
+
+void operator delete(void* ptr, size_t size) noexcept { free(ptr); }
+
+namespace zuckerli {
+namespace {
+
+void CheckGraph(const UncompressedGraph& g, const CompressedGraph& compressed) {
+  ASSERT_EQ(compressed.size(), g.size());
+  for (size_t i = 0; i < g.size(); i++) {
+    ASSERT_EQ(compressed.Degree(i), g.Degree(i)) << "node " << i;
+    std::vector<uint32_t> neighbours = compressed.Neighbours(i);
+    ASSERT_EQ(neighbours.size(), g.Degree(i)) << "node " << i;
+    for (size_t j = 0; j < neighbours.size(); j++) {
+      EXPECT_EQ(neighbours[j], g.Neighbours(i)[j]) << "node " << i;
+    }
+  }
+}
+
+void TestRandomAccess(bool offset_index, bool memory_map) {
+  absl::SetFlag(&FLAGS_offset_index, offset_index);
+  std::string name = std::string("compressed_graph_test") +
+                     (offset_index ? "_index" : "") +
+                     (memory_map ? "_mmap" : "");
+  UncompressedGraph g(WriteTestGraph(name, SyntheticGraph(1000, 1)));
+  std::vector<uint8_t> compressed =
+      EncodeGraph(g, /*allow_random_access=*/true);
+  CompressedGraph graph(WriteTestFile(name + ".zkr", compressed), memory_map);
+  CheckGraph(g, graph);
+}
+
+TEST(CompressedGraphTest, TestWithOffsetIndex) {
+  TestRandomAccess(/*offset_index=*/true, /*memory_map=*/false);
+}
+
+TEST(CompressedGraphTest, TestWithoutOffsetIndex) {
+  TestRandomAccess(/*offset_index=*/false, /*memory_map=*/false);
+}
+
+TEST(CompressedGraphTest, TestMemoryMapped) {
+  TestRandomAccess(/*offset_index=*/true, /*memory_map=*/true);
+}
+
+TEST(CompressedGraphTest, TestMemoryMappedWithoutOffsetIndex) {
+  TestRandomAccess(/*offset_index=*/false, /*memory_map=*/true);
+}
+
+TEST(CompressedGraphTest, TestReferenceCache) {
+  absl::SetFlag(&FLAGS_offset_index, true);
+  UncompressedGraph g(
+      WriteTestGraph("compressed_graph_test_cache", SyntheticGraph(1000, 2)));
+  std::vector<uint8_t> compressed =
+      EncodeGraph(g, /*allow_random_access=*/true);
+  CompressedGraph graph(
+      WriteTestFile("compressed_graph_test_cache.zkr", compressed));
+  graph.EnableReferenceCache(/*max_edges=*/2048, /*num_shards=*/4);
+  // Twice, so that the second pass hits the cache.
+  CheckGraph(g, graph);
+  CheckGraph(g, graph);
+  EXPECT_GT(graph.reference_cache()->Hits(), 0);
+  EXPECT_GT(graph.reference_cache()->Misses(), 0);
+  EXPECT_LE(graph.reference_cache()->NumEdges(), 2048);
+}
+
+void TestGranularity(size_t degree_chunk_size, size_t max_chain_length) {
+  absl::SetFlag(&FLAGS_offset_index, true);
+  std::string name = "compressed_graph_test_granularity" +
+                     std::to_string(degree_chunk_size) + "_" +
+                     std::to_string(max_chain_length);
+  UncompressedGraph g(WriteTestGraph(name, SyntheticGraph(1000, 7)));
+  EncodeOptions options;
+  options.allow_random_access = true;
+  options.degree_chunk_size = degree_chunk_size;
+  options.max_chain_length = max_chain_length;
+  CompressedGraph graph(WriteTestFile(name + ".zkr", EncodeGraph(g, options)));
+  EXPECT_EQ(graph.degree_chunk_size(), degree_chunk_size);
+  EXPECT_EQ(graph.max_chain_length(), max_chain_length);
+  CheckGraph(g, graph);
+  NeighboursBatchResult result;
+  std::vector<uint32_t> nodes(g.size());
+  std::iota(nodes.begin(), nodes.end(), 0);
+  graph.NeighboursBatch(span<const uint32_t>(nodes.data(), nodes.size()),
+                        &result);
+  ASSERT_EQ(result.size(), g.size());
+  for (size_t i = 0; i < g.size(); i++) {
+    ASSERT_EQ(result.neighbours(i).size(), g.Degree(i)) << "node " << i;
+  }
+}
+
+TEST(CompressedGraphTest, TestSmallChunksNoChains) { TestGranularity(1, 0); }
+
+TEST(CompressedGraphTest, TestSmallChunksShortChains) {
+  TestGranularity(4, 1);
+}
+
+TEST(CompressedGraphTest, TestLargeChunksLongChains) {
+  TestGranularity(1024, 7);
+}
+
+void TestDegreeIndex(size_t bits_per_degree) {
+  absl::SetFlag(&FLAGS_offset_index, true);
+  std::string name =
+      "compressed_graph_test_degrees" + std::to_string(bits_per_degree);
+  UncompressedGraph g(WriteTestGraph(name, SyntheticGraph(1000, 4)));
+  std::vector<uint8_t> compressed =
+      EncodeGraph(g, /*allow_random_access=*/true);
+  CompressedGraph graph(WriteTestFile(name + ".zkr", compressed));
+  graph.BuildDegreeIndex(bits_per_degree);
+  CheckGraph(g, graph);
+}
+
+// Most degrees do not fit.
+TEST(CompressedGraphTest, TestNarrowDegreeIndex) { TestDegreeIndex(3); }
+
+TEST(CompressedGraphTest, TestDegreeIndex) { TestDegreeIndex(32); }
+
+TEST(CompressedGraphTest, TestMultiSymbolDecoding) {
+  absl::SetFlag(&FLAGS_offset_index, true);
+  UncompressedGraph g(WriteTestGraph("compressed_graph_test_multi_symbol",
+                                     SyntheticGraph(1000, 6)));
+  std::vector<uint8_t> compressed =
+      EncodeGraph(g, /*allow_random_access=*/true);
+  CompressedGraph graph(
+      WriteTestFile("compressed_graph_test_multi_symbol.zkr", compressed));
+  graph.EnableMultiSymbolDecoding();
+  CheckGraph(g, graph);
+}
+
+TEST(CompressedGraphTest, TestPrefetch) {
+  absl::SetFlag(&FLAGS_offset_index, true);
+  UncompressedGraph g(WriteTestGraph("compressed_graph_test_prefetch",
+                                     SyntheticGraph(1000, 9)));
+  std::vector<uint8_t> compressed =
+      EncodeGraph(g, /*allow_random_access=*/true);
+  CompressedGraph graph(
+      WriteTestFile("compressed_graph_test_prefetch.zkr", compressed));
+  // Prefetching has no visible effect, including for the last nodes, for
+  // empty spans and for invalid ids.
+  std::vector<uint32_t> nodes(g.size());
+  std::iota(nodes.begin(), nodes.end(), 0);
+  std::shuffle(nodes.begin(), nodes.end(), std::mt19937(0));
+  graph.Prefetch(span<const uint32_t>());
+  const uint32_t invalid[] = {static_cast<uint32_t>(g.size()), ~uint32_t{0}};
+  graph.Prefetch(span<const uint32_t>(invalid, 2));
+  graph.Prefetch(span<const uint32_t>(nodes.data(), nodes.size()));
+  NeighboursContext context;
+  for (size_t i = 0; i < nodes.size(); i++) {
+    graph.Prefetch(span<const uint32_t>(&nodes[i], 1));
+    span<const uint32_t> neighbours = graph.Neighbours(nodes[i], &context);
+    ASSERT_TRUE(std::equal(neighbours.begin(), neighbours.end(),
+                           g.Neighbours(nodes[i]).begin(),
+                           g.Neighbours(nodes[i]).end()))
+        << "node " << nodes[i];
+  }
+}
+
+void TestNeighboursBatch(bool reference_cache) {
+  absl::SetFlag(&FLAGS_offset_index, true);
+  std::string name = std::string("compressed_graph_test_batch") +
+                     (reference_cache ? "_cache" : "");
+  UncompressedGraph g(WriteTestGraph(name, SyntheticGraph(1000, 5)));
+  std::vector<uint8_t> compressed =
+      EncodeGraph(g, /*allow_random_access=*/true);
+  CompressedGraph graph(WriteTestFile(name + ".zkr", compressed));
+  if (reference_cache) graph.EnableReferenceCache(/*max_edges=*/1024);
+  std::mt19937 rng(0);
+  NeighboursBatchResult result;
+  for (size_t batch_size : {1, 7, 50, 400, 2000}) {
+    // Includes duplicates, and both dense and sparse chunks.
+    std::vector<uint32_t> nodes;
+    for (size_t i = 0; i < batch_size; i++) {
+      nodes.push_back(i % 2 == 0 ? rng() % g.size() : rng() % 100);
+    }
+    graph.NeighboursBatch(span<const uint32_t>(nodes.data(), nodes.size()),
+                          &result);
+    std::sort(nodes.begin(), nodes.end());
+    nodes.erase(std::unique(nodes.begin(), nodes.end()), nodes.end());
+    ASSERT_EQ(result.size(), nodes.size());
+    for (size_t i = 0; i < result.size(); i++) {
+      ASSERT_EQ(result.node(i), nodes[i]);
+      span<const uint32_t> neighbours = result.neighbours(i);
+      ASSERT_EQ(neighbours.size(), g.Degree(nodes[i])) << "node " << nodes[i];
+      for (size_t j = 0; j < neighbours.size(); j++) {
+        EXPECT_EQ(neighbours[j], g.Neighbours(nodes[i])[j])
+            << "node " << nodes[i];
+      }
+    }
+  }
+}
+
+TEST(CompressedGraphTest, TestNeighboursBatch) {
+  TestNeighboursBatch(/*reference_cache=*/false);
+}
+
+TEST(CompressedGraphTest, TestNeighboursBatchWithReferenceCache) {
+  TestNeighboursBatch(/*reference_cache=*/true);
+}
+
+TEST(CompressedGraphTest, TestNeighboursContextDoesNotAllocate) {
+  absl::SetFlag(&FLAGS_offset_index, true);
+  UncompressedGraph g(
+      WriteTestGraph("compressed_graph_test_ctx", SyntheticGraph(1000, 3)));
+  std::vector<uint8_t> compressed =
+      EncodeGraph(g, /*allow_random_access=*/true);
+  CompressedGraph graph(
+      WriteTestFile("compressed_graph_test_ctx.zkr", compressed));
+  NeighboursContext context;
+  // Let the buffers of the context grow.
+  for (size_t i = 0; i < g.size(); i++) graph.Neighbours(i, &context);
+  size_t allocations_before = num_allocations.load();
+  size_t num_edges = 0;
+  for (size_t i = 0; i < g.size(); i++) {
+    span<const uint32_t> neighbours = graph.Neighbours(i, &context);
+    num_edges += neighbours.size();
+    ASSERT_EQ(neighbours.size(), g.Degree(i));
+    for (size_t j = 0; j < neighbours.size(); j++) {
+      ASSERT_EQ(neighbours[j], g.Neighbours(i)[j]);
+    }
+  }
+  EXPECT_EQ(num_allocations.load(), allocations_before);
+  EXPECT_GT(num_edges, 0);
+}
+
+void TestConcurrentQueries(bool reference_cache) {
+  absl::SetFlag(&FLAGS_offset_index, true);
+  std::string name = std::string("compressed_graph_test_concurrent") +
+                     (reference_cache ? "_cache" : "");
+  UncompressedGraph g(WriteTestGraph(name, SyntheticGraph(1000, 8)));
+  std::vector<uint8_t> compressed =
+      EncodeGraph(g, /*allow_random_access=*/true);
+  CompressedGraph graph(WriteTestFile(name + ".zkr", compressed));
+  graph.BuildDegreeIndex(/*bits_per_degree=*/4);
+  graph.EnableMultiSymbolDecoding();
+  // Small, so that threads keep evicting each other's lists.
+  if (reference_cache) graph.EnableReferenceCache(/*max_edges=*/512);
+  const CompressedGraph& shared = graph;
+
+  constexpr size_t kNumThreads = 8;
+  std::vector<size_t> num_errors(kNumThreads);
+  std::vector<std::thread> threads;
+  for (size_t t = 0; t < kNumThreads; t++) {
+    threads.emplace_back([&, t]() {
+      std::mt19937 rng(t);
+      NeighboursContext context;
+      NeighboursBatchResult result;
+      for (size_t i = 0; i < 5000; i++) {
+        uint32_t node = rng() % g.size();
+        span<const uint32_t> neighbours = shared.Neighbours(node, &context);
+        if (shared.Degree(node) != g.Degree(node) ||
+            !std::equal(neighbours.begin(), neighbours.end(),
+                        g.Neighbours(node).begin(), g.Neighbours(node).end())) {
+          num_errors[t]++;
+        }
+        if (i % 100 != 0) continue;
+        uint32_t batch[] = {node, node / 2, static_cast<uint32_t>(rng() % 64)};
+        shared.NeighboursBatch(span<const uint32_t>(batch, 3), &result);
+        for (size_t j = 0; j < result.size(); j++) {
+          span<const uint32_t> list = result.neighbours(j);
+          uint32_t n = result.node(j);
+          if (!std::equal(list.begin(), list.end(), g.Neighbours(n).begin(),
+                          g.Neighbours(n).end())) {
+            num_errors[t]++;
+          }
+        }
+      }
+    });
+  }
+  for (std::thread& thread : threads) thread.join();
+  for (size_t t = 0; t < kNumThreads; t++) {
+    EXPECT_EQ(num_errors[t], 0) << "thread " << t;
+  }
+}
+
+TEST(CompressedGraphTest, TestConcurrentQueries) {
+  TestConcurrentQueries(/*reference_cache=*/false);
+}
+
+TEST(CompressedGraphTest, TestConcurrentQueriesWithReferenceCache) {
+  TestConcurrentQueries(/*reference_cache=*/true);
+}
+
+}  // namespace
+}  // namespace zuckerli
@@ -12,9 +12,12 @@ ABSL_DECLARE_FLAG(int32_t, ref_block);
 
 namespace zuckerli {
 
+// Upper bound for SearchNum(), as stored in the graph header.
+static constexpr size_t kMaxSearchNum = 1023;
+
 ZKR_INLINE size_t SearchNum() {
 #if ZKR_HONOR_FLAGS
-  ZKR_ASSERT(absl::GetFlag(FLAGS_ref_block) <= 64);
+  ZKR_ASSERT(absl::GetFlag(FLAGS_ref_block) <= kMaxSearchNum);
   return absl::GetFlag(FLAGS_ref_block);
 #else
   return 32;
@@ -42,33 +45,42 @@ static constexpr size_t kNumResidualContexts = 80;  // Slightly lax bound
 static constexpr size_t kRleContext =
     kResidualBaseContext + kNumResidualContexts;
 
+template <typename Coder = IntegerCoder>
 ZKR_INLINE size_t DegreeContext(size_t last_residual) {
-  uint32_t token = IntegerCoder::Token(last_residual);
+  uint32_t token = Coder::Token(last_residual);
   return kDegreeBaseContext + std::min<size_t>(token, kNumDegreeContexts - 1);
 }
 
 ZKR_INLINE size_t ReferenceContext(size_t last_reference) {
-  return kReferenceContextBase + last_reference;
+  return kReferenceContextBase +
+         std::min<size_t>(last_reference, kNumReferenceContexts - 1);
 }
 
+template <typename Coder = IntegerCoder>
 ZKR_INLINE size_t FirstResidualContext(size_t edges_left) {
-  uint32_t token = IntegerCoder::Token(edges_left);
+  uint32_t token = Coder::Token(edges_left);
   size_t ctx = kFirstResidualBaseContext;
   ctx += std::min<size_t>(kFirstResidualNumContexts - 1, token);
   return ctx;
 }
 
+template <typename Coder = IntegerCoder>
 ZKR_INLINE size_t ResidualContext(size_t last_residual) {
-  uint32_t token = IntegerCoder::Token(last_residual);
+  uint32_t token = Coder::Token(last_residual);
   return kResidualBaseContext +
          std::min<size_t>(token, kNumResidualContexts - 1);
 }
 
 static constexpr size_t kNumContexts = kRleContext + 1;
 
-// Random access only parameters: minimum length for RLE and size of chunk of
-// nodes for which residuals and references are delta-coded.
+// Random access only parameters: minimum length for RLE, default size of chunk
+// of nodes for which degrees and references are delta-coded (see
+// graph_header.h) and its maximum, and default and maximum length of chains of
+// references.
 static constexpr size_t kDegreeReferenceChunkSize = 32;
+static constexpr size_t kMaxDegreeChunkSize = 1 << 15;
+static constexpr size_t kDefaultMaxChainLength = 3;
+static constexpr size_t kMaxChainLength = 7;
 
 static constexpr size_t kRleMin = 3;
 
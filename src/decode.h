@@ -1,7 +1,9 @@
 #ifndef ZUCKERLI_DECODE_H
 #define ZUCKERLI_DECODE_H
+#include <algorithm>
 #include <chrono>
 #include <limits>
+#include <utility>
 #include <vector>
 
 #include "ans.h"
@@ -9,28 +11,76 @@
 #include "checksum.h"
 #include "common.h"
 #include "context_model.h"
+#include "graph_header.h"
 #include "huffman.h"
 #include "integer_coder.h"
+#include "list_window.h"
+#include "parallel.h"
 
 namespace zuckerli {
 namespace detail {
 
-template <typename Reader, typename CB>
-bool DecodeGraphImpl(size_t N, bool allow_random_access, Reader* reader,
-                     BitReader* br, const CB& cb,
+// Reads the next degree, which is coded on its own if `first` (at the start of
+// a segment or of a random-access chunk) and as a delta from `*last_degree`
+// otherwise.
+template <typename Coder, typename Reader>
+ZKR_INLINE size_t ReadDegree(bool first, size_t* last_degree,
+                             size_t* last_degree_delta, BitReader* br,
+                             Reader* reader) {
+  size_t degree;
+  if (first) {
+    degree = Coder::Read(kFirstDegreeContext, br, reader);
+    // Special case: we assume a node -1 with degree 0.
+    *last_degree_delta = degree;
+  } else {
+    size_t ctx = DegreeContext<Coder>(*last_degree_delta);
+    *last_degree_delta = Coder::Read(ctx, br, reader);
+    // This can be negative, hence calling UnpackSigned.
+    degree = *last_degree + UnpackSigned(*last_degree_delta);
+  }
+  *last_degree = degree;
+  return degree;
+}
+
+// Decodes the degree section of the segment of nodes in [begin, end), calling
+// `cb(node, degree)` for each node.
+template <typename Coder, typename Reader, typename CB>
+bool DecodeDegreeSection(const GraphHeader& header, size_t begin, size_t end,
+                         Reader* reader, BitReader* br, const CB& cb) {
+  size_t last_degree = 0;
+  size_t last_degree_delta = 0;
+  for (size_t current_node = begin; current_node < end; current_node++) {
+    size_t degree =
+        ReadDegree<Coder>(current_node == begin, &last_degree,
+                          &last_degree_delta, br, reader);
+    if (degree > header.num_nodes) return ZKR_FAILURE("Invalid degree");
+    cb(current_node, degree);
+  }
+  if (!reader->CheckFinalState()) {
+    return ZKR_FAILURE("Invalid stream");
+  }
+  return true;
+}
+
+// Decodes the lists of nodes in [begin, end), where `begin` is the first node
+// of a segment, of the graph described by `header`, whose integers are coded
+// with Coder (an IntegerCoderImpl). Degrees are read from `degree_reader` and
+// `degree_br`, which are the same as `reader` and `br` unless the graph has a
+// degree section.
+template <typename Coder, typename Reader, typename CB>
+bool DecodeGraphImpl(const GraphHeader& header, size_t begin, size_t end,
+                     Reader* reader, BitReader* br, Reader* degree_reader,
+                     BitReader* degree_br, const CB& cb,
                      std::vector<size_t>* node_start_indices) {
-  using IntegerCoder = zuckerli::IntegerCoder;
-  // Storage for the previous up-to-MaxNodesBackwards() lists to be used as a
-  // reference.
-  std::vector<std::vector<uint32_t>> prev_lists(
-      std::min(MaxNodesBackwards(), N));
-  std::vector<uint32_t> residuals;
+  size_t N = header.num_nodes;
+  bool allow_random_access = header.allow_random_access;
+  // Storage for the previous lists that can be used as a reference.
+  ListWindow prev_lists(header.search_num + 1);
   std::vector<uint32_t> block_lengths;
-  for (size_t i = 0; i < prev_lists.size(); i++) prev_lists[i].clear();
   size_t rle_min =
       allow_random_access ? kRleMin : std::numeric_limits<size_t>::max();
-  // The three quantities below get reset to after kDegreeReferenceChunkSize
-  // adjacency lists if in random-access mode.
+  // The three quantities below get reset at the start of each chunk of
+  // header.degree_chunk_size adjacency lists if in random-access mode.
   //
   // Reference degree for degree delta coding.
   size_t last_degree = 0;
@@ -38,47 +88,40 @@ bool DecodeGraphImpl(size_t N, bool allow_random_access, Reader* reader,
   size_t last_degree_delta = 0;
   // Last reference offset for context modeling.
   size_t last_reference_offset = 0;
-  for (size_t current_node = 0; current_node < N; current_node++) {
-    size_t i_mod = current_node % MaxNodesBackwards();
-    prev_lists[i_mod].clear();
+  for (size_t current_node = begin; current_node < end; current_node++) {
     block_lengths.clear();
-    size_t degree;
     if (node_start_indices) node_start_indices->push_back(br->NumBitsRead());
-    if ((allow_random_access &&
-         current_node % kDegreeReferenceChunkSize == 0) ||
-        current_node == 0) {
-      degree = IntegerCoder::Read(kFirstDegreeContext, br, reader);
-      last_degree_delta =
-          degree;  // special case: we assume a node -1 with degree 0
-      last_reference_offset = 0;
-    } else {
-      size_t ctx = DegreeContext(last_degree_delta);
-      last_degree_delta = IntegerCoder::Read(ctx, br, reader);
-      degree =
-          last_degree +
-          UnpackSigned(
-              last_degree_delta);  // this can be negative, hence calling this
-    }
-    last_degree = degree;
+    bool first = (allow_random_access && header.IsFirstInChunk(current_node)) ||
+                 current_node == begin;
+    if (first) last_reference_offset = 0;
+    size_t degree = ReadDegree<Coder>(first, &last_degree, &last_degree_delta,
+                                      degree_br, degree_reader);
     if (degree > N) return ZKR_FAILURE("Invalid degree");
+    prev_lists.StartList(current_node, degree);
     if (degree == 0) continue;
 
-    // If this is not the first node, read the offset of the list to be used as
-    // a reference.
+    // If this is not the first node of the segment, read the offset of the
+    // list to be used as a reference.
     size_t reference_offset = 0;
-    if (current_node != 0) {
-      reference_offset = IntegerCoder::Read(
+    if (current_node != begin) {
+      reference_offset = Coder::Read(
           ReferenceContext(last_reference_offset), br, reader);
       last_reference_offset = reference_offset;
     }
-    if (reference_offset > current_node)
+    if (reference_offset > current_node - begin ||
+        reference_offset > header.search_num) {
       return ZKR_FAILURE("Invalid reference_offset");
+    }
+    span<const uint32_t> ref_list;
+    if (reference_offset != 0) {
+      ref_list = prev_lists.List(current_node - reference_offset);
+    }
 
     // If a reference_offset is used, read the list of blocks of (alternating)
     // copied and skipped edges.
     size_t num_to_copy = 0;
     if (reference_offset != 0) {
-      size_t block_count = IntegerCoder::Read(kBlockCountContext, br, reader);
+      size_t block_count = Coder::Read(kBlockCountContext, br, reader);
       size_t block_end = 0;  // end of current block
       for (size_t j = 0; j < block_count; j++) {
         size_t ctx = j == 0
@@ -86,22 +129,18 @@ bool DecodeGraphImpl(size_t N, bool allow_random_access, Reader* reader,
                          : (j % 2 == 0 ? kBlockContextEven : kBlockContextOdd);
         size_t block_len;
         if (j == 0) {
-          block_len = IntegerCoder::Read(ctx, br, reader);
+          block_len = Coder::Read(ctx, br, reader);
         } else {
-          block_len = IntegerCoder::Read(ctx, br, reader) + 1;
+          block_len = Coder::Read(ctx, br, reader) + 1;
         }
         block_end += block_len;
         block_lengths.push_back(block_len);
       }
-      if (prev_lists[(current_node - reference_offset) % MaxNodesBackwards()]
-              .size() < block_end) {
+      if (ref_list.size() < block_end) {
         return ZKR_FAILURE("Invalid block copy pattern");
       }
       // Last block is implicit and goes to the end of the reference list.
-      block_lengths.push_back(
-          prev_lists[(current_node - reference_offset) % MaxNodesBackwards()]
-              .size() -
-          block_end);
+      block_lengths.push_back(ref_list.size() - block_end);
       // Blocks in even positions are to be copied.
       for (size_t i = 0; i < block_lengths.size(); i += 2) {
         num_to_copy += block_lengths[i];
@@ -113,6 +152,9 @@ bool DecodeGraphImpl(size_t N, bool allow_random_access, Reader* reader,
     // reference_offset node for delta-coding of neighbours.
     size_t last_dest_plus_one = 0;  // will not be used
     // Number of edges to read.
+    if (num_to_copy > degree) {
+      return ZKR_FAILURE("Invalid block copy pattern");
+    }
     size_t num_residuals = degree - num_to_copy;
     // Last delta for the residual edges, used for context modeling.
     size_t last_residual_delta = 0;
@@ -132,8 +174,6 @@ bool DecodeGraphImpl(size_t N, bool allow_random_access, Reader* reader,
       num_to_copy_from_current_block = block_lengths[2];
       next_block = 3;
     }
-    // ID of reference list.
-    size_t ref_id = (current_node - reference_offset) % MaxNodesBackwards();
     // Number of consecutive zeros that have been decoded last.
     // Delta encoding with -1.
     size_t contiguous_zeroes_len = 0;
@@ -141,23 +181,23 @@ bool DecodeGraphImpl(size_t N, bool allow_random_access, Reader* reader,
     size_t num_zeros_to_skip = 0;
     const auto append = [&](size_t x) {
       if (x >= N) return ZKR_FAILURE("Invalid residual");
-      prev_lists[i_mod].push_back(x);
+      prev_lists.Append(x);
       cb(current_node, x);
       return true;
     };
     for (size_t j = 0; j < num_residuals; j++) {
       size_t destination_node;
       if (j == 0) {
-        last_residual_delta =
-            IntegerCoder::Read(FirstResidualContext(num_residuals), br, reader);
+        last_residual_delta = Coder::Read(
+            FirstResidualContext<Coder>(num_residuals), br, reader);
         destination_node = current_node + UnpackSigned(last_residual_delta);
       } else if (num_zeros_to_skip >
                  0) {  // If in a zero run, don't read anything.
         last_residual_delta = 0;
         destination_node = last_dest_plus_one;
       } else {
-        last_residual_delta = IntegerCoder::Read(
-            ResidualContext(last_residual_delta), br, reader);
+        last_residual_delta = Coder::Read(
+            ResidualContext<Coder>(last_residual_delta), br, reader);
         destination_node = last_dest_plus_one + last_residual_delta;
       }
       // Compute run of zeros if we read a zero and we are not already in one.
@@ -173,14 +213,14 @@ bool DecodeGraphImpl(size_t N, bool allow_random_access, Reader* reader,
       // Merge the edges copied from the reference_offset list with the ones
       // read from the bitstream.
       while (num_to_copy_from_current_block > 0 &&
-             prev_lists[ref_id][ref_pos] <= destination_node) {
+             ref_list[ref_pos] <= destination_node) {
         num_to_copy_from_current_block--;
-        ZKR_RETURN_IF_ERROR(append(prev_lists[ref_id][ref_pos]));
+        ZKR_RETURN_IF_ERROR(append(ref_list[ref_pos]));
         // If our delta coding would produce an edge to destination_node, but y
         // with y<=destination_node is copied from the reference_offset list, we
         // increase destination_node. In other words, it's delta coding with
         // respect to both lists (prev_lists and residuals).
-        if (j != 0 && prev_lists[ref_id][ref_pos] >= last_dest_plus_one) {
+        if (j != 0 && ref_list[ref_pos] >= last_dest_plus_one) {
           destination_node++;
         }
         ref_pos++;
@@ -194,19 +234,18 @@ bool DecodeGraphImpl(size_t N, bool allow_random_access, Reader* reader,
       // If the current run of zeros is large enough, read how many further
       // zeros to decode from the bitstream.
       if (contiguous_zeroes_len >= rle_min) {
-        num_zeros_to_skip = IntegerCoder::Read(kRleContext, br, reader);
+        num_zeros_to_skip = Coder::Read(kRleContext, br, reader);
         contiguous_zeroes_len = 0;
       }
 
       ZKR_RETURN_IF_ERROR(append(destination_node));
       last_dest_plus_one = destination_node + 1;
     }
-    ZKR_ASSERT(ref_pos + num_to_copy_from_current_block <=
-               prev_lists[ref_id].size());
+    ZKR_ASSERT(ref_pos + num_to_copy_from_current_block <= ref_list.size());
     // Process the rest of the block-copy list.
     while (num_to_copy_from_current_block > 0) {
       num_to_copy_from_current_block--;
-      ZKR_RETURN_IF_ERROR(append(prev_lists[ref_id][ref_pos]));
+      ZKR_RETURN_IF_ERROR(append(ref_list[ref_pos]));
       ref_pos++;
       if (num_to_copy_from_current_block == 0 &&
           next_block + 1 < block_lengths.size()) {
@@ -216,39 +255,130 @@ bool DecodeGraphImpl(size_t N, bool allow_random_access, Reader* reader,
       }
     }
   }
-  if (!reader->CheckFinalState()) {
+  if (!reader->CheckFinalState() ||
+      (degree_reader != reader && !degree_reader->CheckFinalState())) {
     return ZKR_FAILURE("Invalid stream");
   }
   return true;
 }
 
+// First node of segment `segment` of a sequential graph, and the first node
+// after it.
+inline std::pair<size_t, size_t> SegmentNodes(const GraphHeader& header,
+                                              size_t segment) {
+  size_t N = header.num_nodes;
+  size_t begin = header.nodes_per_segment * segment;
+  size_t end = header.nodes_per_segment == 0
+                   ? N
+                   : std::min(N, begin + header.nodes_per_segment);
+  return {begin, end};
+}
+
+// Returns decode(edge_cb), where `edge_cb` passes the edges on to `cb`. If the
+// graph has segment hashes, also fails if the checksum of these edges does not
+// match the one of segment `segment`.
+template <typename Decode, typename CB>
+bool DecodeVerified(const GraphHeader& header, size_t segment,
+                    const Decode& decode, const CB& cb) {
+  if (!header.has_segment_hashes) return decode(cb);
+  uint64_t hash = 0;
+  ZKR_RETURN_IF_ERROR(decode([&](size_t a, size_t b) {
+    hash += EdgeHash(a, b);
+    cb(a, b);
+  }));
+  if (hash != header.segment_hashes[segment]) {
+    return ZKR_FAILURE("Checksum mismatch");
+  }
+  return true;
+}
+
+// Decodes segment `segment` of a sequential graph, which starts at byte
+// `segment_start` of `compressed`.
+template <typename CB>
+bool DecodeSegment(const uint8_t* compressed, const GraphHeader& header,
+                   size_t segment, size_t segment_start, const CB& cb) {
+  size_t degree_section_size =
+      header.has_degree_section ? header.degree_section_sizes[segment] : 0;
+  BitReader reader(compressed + segment_start + degree_section_size,
+                   header.segment_sizes[segment] - degree_section_size);
+  ANSReader ans_reader;
+  ZKR_RETURN_IF_ERROR(ans_reader.Init(kNumContexts, &reader));
+  BitReader degree_reader(compressed + segment_start, degree_section_size);
+  ANSReader degree_ans_reader;
+  if (header.has_degree_section) {
+    ZKR_RETURN_IF_ERROR(
+        degree_ans_reader.Init(kReferenceContextBase, &degree_reader));
+  }
+  std::pair<size_t, size_t> nodes = SegmentNodes(header, segment);
+  auto decode = [&](const auto& edge_cb) {
+    return WithIntegerCoder(header.integer_coder, [&](auto coder) {
+      if (!header.has_degree_section) {
+        return DecodeGraphImpl<decltype(coder)>(
+            header, nodes.first, nodes.second, &ans_reader, &reader,
+            &ans_reader, &reader, edge_cb, /*node_start_indices=*/nullptr);
+      }
+      return DecodeGraphImpl<decltype(coder)>(
+          header, nodes.first, nodes.second, &ans_reader, &reader,
+          &degree_ans_reader, &degree_reader, edge_cb,
+          /*node_start_indices=*/nullptr);
+    });
+  };
+  return DecodeVerified(header, segment, decode, cb);
+}
+
+// Decodes a random-access graph.
+template <typename CB>
+bool DecodeRandomAccess(const uint8_t* compressed, size_t compressed_size,
+                        const GraphHeader& header, const CB& cb,
+                        std::vector<size_t>* node_start_indices) {
+  // Positions in `node_start_indices` are relative to the data section.
+  BitReader reader(compressed + header.data_start,
+                   compressed_size - header.data_start);
+  HuffmanReader huff_reader;
+  ZKR_RETURN_IF_ERROR(huff_reader.Init(kNumContexts, &reader));
+  auto decode = [&](const auto& edge_cb) {
+    return WithIntegerCoder(header.integer_coder, [&](auto coder) {
+      return DecodeGraphImpl<decltype(coder)>(
+          header, /*begin=*/0, /*end=*/header.num_nodes, &huff_reader,
+          &reader, &huff_reader, &reader, edge_cb, node_start_indices);
+    });
+  };
+  return DecodeVerified(header, /*segment=*/0, decode, cb);
+}
+
+// Decodes all the segments of a sequential graph, in order.
+template <typename CB>
+bool DecodeSequential(const uint8_t* compressed, const GraphHeader& header,
+                      const CB& cb) {
+  size_t segment_start = header.data_start;
+  for (size_t i = 0; i < header.NumSegments(); i++) {
+    ZKR_RETURN_IF_ERROR(
+        DecodeSegment(compressed, header, i, segment_start, cb));
+    segment_start += header.segment_sizes[i];
+  }
+  return true;
+}
+
 }  // namespace detail
 
-bool DecodeGraph(const std::vector<uint8_t>& compressed,
-                 size_t* checksum = nullptr,
-                 std::vector<size_t>* node_start_indices = nullptr) {
-  if (compressed.empty()) return ZKR_FAILURE("Empty file");
+inline bool DecodeGraph(const uint8_t* compressed, size_t compressed_size,
+                        size_t* checksum = nullptr,
+                        std::vector<size_t>* node_start_indices = nullptr) {
   auto start = std::chrono::high_resolution_clock::now();
-  BitReader reader(compressed.data(), compressed.size());
-  size_t N = reader.ReadBits(48);
-  bool allow_random_access = reader.ReadBits(1);
+  GraphHeader header;
+  ZKR_RETURN_IF_ERROR(ReadGraphHeader(compressed, compressed_size, &header));
   size_t edges = 0, chksum = 0;
   auto edge_callback = [&](size_t a, size_t b) {
     edges++;
-    chksum = Checksum(chksum, a, b);
+    chksum += EdgeHash(a, b);
   };
-  if (allow_random_access) {
-    HuffmanReader huff_reader;
-    huff_reader.Init(kNumContexts, &reader);
-    ZKR_RETURN_IF_ERROR(
-        detail::DecodeGraphImpl(N, allow_random_access, &huff_reader, &reader,
-                                edge_callback, node_start_indices));
+  if (header.allow_random_access) {
+    ZKR_RETURN_IF_ERROR(detail::DecodeRandomAccess(
+        compressed, compressed_size, header, edge_callback,
+        node_start_indices));
   } else {
-    ANSReader ans_reader;
-    ans_reader.Init(kNumContexts, &reader);
     ZKR_RETURN_IF_ERROR(
-        detail::DecodeGraphImpl(N, allow_random_access, &ans_reader, &reader,
-                                edge_callback, node_start_indices));
+        detail::DecodeSequential(compressed, header, edge_callback));
   }
   auto stop = std::chrono::high_resolution_clock::now();
 
@@ -257,10 +387,99 @@ bool DecodeGraph(const std::vector<uint8_t>& compressed,
           .count();
 
   fprintf(stderr, "Decompressed %.2f ME/s (%zu) from %.2f BPE. Checksum: %lx\n",
-          edges / elapsed, edges, 8.0 * compressed.size() / edges, chksum);
+          edges / elapsed, edges, 8.0 * compressed_size / edges, chksum);
   if (checksum) *checksum = chksum;
   return true;
 }
+
+// Decodes the graph using up to `num_threads` threads (0 means one per
+// hardware thread), each of which decodes whole segments. Calls
+// `cb(thread, node, neighbour)` for every edge, where `thread` is in
+// [0, NumThreads(num_threads)) and identifies the calling thread, so that the
+// callback can keep per-thread state. Edges of the same segment are reported
+// in order by the same thread. Graphs that are not split in segments, and
+// random-access graphs, are decoded by a single thread.
+template <typename CB>
+bool DecodeGraphParallel(const uint8_t* compressed, size_t compressed_size,
+                         size_t num_threads, const CB& cb) {
+  GraphHeader header;
+  ZKR_RETURN_IF_ERROR(ReadGraphHeader(compressed, compressed_size, &header));
+  if (header.allow_random_access) {
+    return detail::DecodeRandomAccess(
+        compressed, compressed_size, header,
+        [&](size_t a, size_t b) { cb(0, a, b); },
+        /*node_start_indices=*/nullptr);
+  }
+  std::vector<size_t> segment_starts(header.NumSegments());
+  size_t segment_start = header.data_start;
+  for (size_t i = 0; i < header.NumSegments(); i++) {
+    segment_starts[i] = segment_start;
+    segment_start += header.segment_sizes[i];
+  }
+  return ParallelFor(
+      header.NumSegments(), num_threads, [&](size_t thread, size_t segment) {
+        return detail::DecodeSegment(
+            compressed, header, segment, segment_starts[segment],
+            [&](size_t a, size_t b) { cb(thread, a, b); });
+      });
+}
+
+// Calls `cb(node, degree)` for every node, in order. If the graph has a degree
+// section, only that section is decoded, which is much faster than decoding
+// the graph; otherwise, this falls back to decoding the whole graph.
+template <typename CB>
+bool DecodeDegrees(const uint8_t* compressed, size_t compressed_size,
+                   const CB& cb) {
+  GraphHeader header;
+  ZKR_RETURN_IF_ERROR(ReadGraphHeader(compressed, compressed_size, &header));
+  if (!header.has_degree_section) {
+    // Edges are reported in node order, but nodes without edges are not
+    // reported at all.
+    size_t node = 0, degree = 0;
+    auto report_until = [&](size_t end) {
+      for (; node < end; node++) {
+        cb(node, degree);
+        degree = 0;
+      }
+    };
+    auto edge_callback = [&](size_t a, size_t b) {
+      report_until(a);
+      degree++;
+    };
+    if (header.allow_random_access) {
+      ZKR_RETURN_IF_ERROR(detail::DecodeRandomAccess(
+          compressed, compressed_size, header, edge_callback,
+          /*node_start_indices=*/nullptr));
+    } else {
+      ZKR_RETURN_IF_ERROR(
+          detail::DecodeSequential(compressed, header, edge_callback));
+    }
+    report_until(header.num_nodes);
+    return true;
+  }
+  size_t segment_start = header.data_start;
+  for (size_t i = 0; i < header.NumSegments(); i++) {
+    BitReader reader(compressed + segment_start,
+                     header.degree_section_sizes[i]);
+    ANSReader ans_reader;
+    ZKR_RETURN_IF_ERROR(ans_reader.Init(kReferenceContextBase, &reader));
+    std::pair<size_t, size_t> nodes = detail::SegmentNodes(header, i);
+    ZKR_RETURN_IF_ERROR(
+        WithIntegerCoder(header.integer_coder, [&](auto coder) {
+          return detail::DecodeDegreeSection<decltype(coder)>(
+              header, nodes.first, nodes.second, &ans_reader, &reader, cb);
+        }));
+    segment_start += header.segment_sizes[i];
+  }
+  return true;
+}
+
+inline bool DecodeGraph(const std::vector<uint8_t>& compressed,
+                        size_t* checksum = nullptr,
+                        std::vector<size_t>* node_start_indices = nullptr) {
+  return DecodeGraph(compressed.data(), compressed.size(), checksum,
+                     node_start_indices);
+}
 }  // namespace zuckerli
 
 #endif  // ZUCKERLI_DECODE_H
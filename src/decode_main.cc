@@ -1,18 +1,38 @@
+#include <algorithm>
+#include <chrono>
 #include <cstdio>
+#include <vector>
 
+#include "checksum.h"
 #include "common.h"
 #include "decode.h"
+#include "decode_uncompressed.h"
+#include "graph_header.h"
 #include "encode.h"
+#include "node_ordering.h"
 #include "absl/flags/flag.h"
 #include "absl/flags/parse.h"
 
 ABSL_FLAG(std::string, input_path, "", "Input file path");
+ABSL_FLAG(std::string, output_path, "",
+          "If not empty, write the decoded graph to this path, in the format "
+          "of uncompressed_graph.h");
+ABSL_FLAG(std::string, permutation_path, "",
+          "With --output_path, map node ids back to the original ones, with "
+          "the permutation written by the encoder (8 more bytes per node)");
+ABSL_FLAG(bool, degrees_only, false,
+          "Only decode the degrees, and print some statistics about them");
 
 int main(int argc, char** argv) {
   absl::ParseCommandLine(argc, argv);
   // Ensure that encoder-only flags are recognized by the decoder too.
   (void)absl::GetFlag(FLAGS_allow_random_access);
   (void)absl::GetFlag(FLAGS_greedy_random_access);
+  if (absl::GetFlag(FLAGS_num_threads) < 0) {
+    fprintf(stderr, "Invalid --num_threads %d: must be at least 0\n",
+            absl::GetFlag(FLAGS_num_threads));
+    return EXIT_FAILURE;
+  }
   FILE* in = fopen(absl::GetFlag(FLAGS_input_path).c_str(), "r");
   ZKR_ASSERT(in);
 
@@ -23,9 +43,96 @@ int main(int argc, char** argv) {
   std::vector<uint8_t> data(len);
   ZKR_ASSERT(fread(data.data(), 1, len, in) == len);
 
-  if (!zuckerli::DecodeGraph(data)) {
+  size_t num_threads = absl::GetFlag(FLAGS_num_threads);
+  if (absl::GetFlag(FLAGS_degrees_only)) {
+    auto start = std::chrono::high_resolution_clock::now();
+    size_t nodes = 0, edges = 0, max_degree = 0;
+    if (!zuckerli::DecodeDegrees(data.data(), data.size(),
+                                 [&](size_t node, size_t degree) {
+                                   nodes++;
+                                   edges += degree;
+                                   max_degree = std::max(max_degree, degree);
+                                 })) {
+      fprintf(stderr, "Invalid graph\n");
+      return EXIT_FAILURE;
+    }
+    auto stop = std::chrono::high_resolution_clock::now();
+    float elapsed =
+        std::chrono::duration_cast<std::chrono::microseconds>(stop - start)
+            .count();
+    fprintf(stderr,
+            "Decoded %zu degrees at %.2f MN/s: %zu edges, max degree %zu\n",
+            nodes, nodes / elapsed, edges, max_degree);
+    return EXIT_SUCCESS;
+  }
+  if (!absl::GetFlag(FLAGS_output_path).empty()) {
+    auto start = std::chrono::high_resolution_clock::now();
+    zuckerli::NodePermutation permutation;
+    const std::vector<uint32_t>* new_ids = nullptr;
+    if (!absl::GetFlag(FLAGS_permutation_path).empty()) {
+      if (!zuckerli::NodePermutation::Read(
+              absl::GetFlag(FLAGS_permutation_path), &permutation)) {
+        fprintf(stderr, "Invalid permutation\n");
+        return EXIT_FAILURE;
+      }
+      zuckerli::GraphHeader header;
+      if (!zuckerli::ReadGraphHeader(data.data(), data.size(), &header)) {
+        fprintf(stderr, "Invalid graph\n");
+        return EXIT_FAILURE;
+      }
+      if (header.num_nodes != permutation.size()) {
+        fprintf(stderr, "The permutation does not match the graph\n");
+        return EXIT_FAILURE;
+      }
+      new_ids = &permutation.original_ids();
+    }
+    if (!zuckerli::DecodeToUncompressedGraph(data.data(), data.size(),
+                                             absl::GetFlag(FLAGS_output_path),
+                                             num_threads, new_ids)) {
+      fprintf(stderr, "Invalid graph\n");
+      return EXIT_FAILURE;
+    }
+    auto stop = std::chrono::high_resolution_clock::now();
+    fprintf(stderr, "Wrote %s in %.3fs\n",
+            absl::GetFlag(FLAGS_output_path).c_str(),
+            std::chrono::duration<double>(stop - start).count());
+    return EXIT_SUCCESS;
+  }
+  if (num_threads == 1) {
+    if (!zuckerli::DecodeGraph(data)) {
+      fprintf(stderr, "Invalid graph\n");
+      return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+  }
+
+  auto start = std::chrono::high_resolution_clock::now();
+  // Padded to avoid false sharing between threads.
+  struct alignas(64) ThreadEdges {
+    size_t edges = 0;
+    size_t checksum = 0;
+  };
+  std::vector<ThreadEdges> thread_edges(zuckerli::NumThreads(num_threads));
+  if (!zuckerli::DecodeGraphParallel(
+          data.data(), data.size(), num_threads,
+          [&](size_t thread, size_t a, size_t b) {
+            thread_edges[thread].edges++;
+            thread_edges[thread].checksum += zuckerli::EdgeHash(a, b);
+          })) {
     fprintf(stderr, "Invalid graph\n");
     return EXIT_FAILURE;
   }
+  auto stop = std::chrono::high_resolution_clock::now();
+  // Checksums of disjoint sets of edges add up to the checksum of the graph.
+  size_t edges = 0, checksum = 0;
+  for (const ThreadEdges& e : thread_edges) {
+    edges += e.edges;
+    checksum += e.checksum;
+  }
+  float elapsed =
+      std::chrono::duration_cast<std::chrono::microseconds>(stop - start)
+          .count();
+  fprintf(stderr, "Decompressed %.2f ME/s (%zu) from %.2f BPE. Checksum: %lx\n",
+          edges / elapsed, edges, 8.0 * data.size() / edges, checksum);
   return EXIT_SUCCESS;
 }
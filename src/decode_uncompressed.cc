@@ -0,0 +1,135 @@
+// Copyright 2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#include "decode_uncompressed.h"
+
+#include <string.h>
+
+#include <algorithm>
+#include <vector>
+
+#include "common.h"
+#include "decode.h"
+#include "graph_header.h"
+#include "memory_mapped_file.h"
+#include "parallel.h"
+#include "uncompressed_graph.h"
+
+namespace zuckerli {
+
+bool DecodeToUncompressedGraph(const uint8_t* compressed,
+                               size_t compressed_size,
+                               const std::string& output_path,
+                               size_t num_threads,
+                               const std::vector<uint32_t>* new_ids) {
+  GraphHeader header;
+  ZKR_RETURN_IF_ERROR(ReadGraphHeader(compressed, compressed_size, &header));
+  if (header.num_nodes > UINT32_MAX) {
+    return ZKR_FAILURE("Too many nodes for the uncompressed format");
+  }
+  size_t num_nodes = header.num_nodes;
+  if (new_ids != nullptr && new_ids->size() != num_nodes) {
+    return ZKR_FAILURE("The renumbering does not match the graph");
+  }
+  auto id = [&](size_t node) -> size_t {
+    return new_ids == nullptr ? node : (*new_ids)[node];
+  };
+
+  // Degree of node i (after renumbering) in offsets[i + 1], then prefix sums.
+  // Without a degree section, each node is only touched by the thread
+  // decoding its segment.
+  std::vector<uint64_t> offsets(num_nodes + 1);
+  if (header.symmetric) {
+    // Each stored edge also appears in the list of its other endpoint, which
+    // may be in another segment, so symmetric graphs use a single thread.
+    ZKR_RETURN_IF_ERROR(DecodeGraphParallel(
+        compressed, compressed_size, /*num_threads=*/1,
+        [&](size_t thread, size_t a, size_t b) {
+          offsets[id(a) + 1]++;
+          if (a != b) offsets[id(b) + 1]++;
+        }));
+  } else if (header.has_degree_section) {
+    ZKR_RETURN_IF_ERROR(DecodeDegrees(
+        compressed, compressed_size,
+        [&](size_t node, size_t degree) { offsets[id(node) + 1] = degree; }));
+  } else {
+    ZKR_RETURN_IF_ERROR(DecodeGraphParallel(
+        compressed, compressed_size, num_threads,
+        [&](size_t thread, size_t a, size_t b) { offsets[id(a) + 1]++; }));
+  }
+  for (size_t i = 0; i < num_nodes; i++) offsets[i + 1] += offsets[i];
+  size_t num_edges = offsets[num_nodes];
+
+  uint64_t fingerprint = UncompressedGraph::kFingerprint;
+  uint32_t n = num_nodes;
+  size_t offsets_start = sizeof(fingerprint) + sizeof(n);
+  size_t edges_start = offsets_start + offsets.size() * sizeof(uint64_t);
+  WritableMemoryMappedFile out;
+  ZKR_RETURN_IF_ERROR(
+      out.Create(output_path, edges_start + num_edges * sizeof(uint32_t)));
+  memcpy(out.data(), &fingerprint, sizeof(fingerprint));
+  memcpy(out.data() + sizeof(fingerprint), &n, sizeof(n));
+  // Offsets start at byte 12, so they are not necessarily aligned.
+  memcpy(out.data() + offsets_start, offsets.data(),
+         offsets.size() * sizeof(uint64_t));
+  uint32_t* edges = reinterpret_cast<uint32_t*>(out.data() + edges_start);
+
+  // Position of the next edge of each node. Edges beyond the degree computed
+  // by the first pass are counted but not written, so that a degree section
+  // that does not match the lists (or an input that changes between the
+  // passes) is detected below instead of producing a corrupt file.
+  std::vector<uint64_t> next(offsets.begin(), offsets.end() - 1);
+  auto add = [&](size_t a, size_t b) {
+    a = id(a);
+    uint64_t pos = next[a]++;
+    if (pos < offsets[a + 1]) edges[pos] = id(b);
+  };
+  bool ok;
+  if (header.symmetric) {
+    // Stored edges (a, b) have b <= a. The list of node a first gets its own
+    // stored neighbours, in increasing order, and then each larger node whose
+    // list contains a, in the order in which they are decoded, so the lists
+    // end up sorted.
+    ok = DecodeGraphParallel(compressed, compressed_size, /*num_threads=*/1,
+                             [&](size_t thread, size_t a, size_t b) {
+                               add(a, b);
+                               if (a != b) add(b, a);
+                             });
+  } else {
+    // Each node is only touched by the thread decoding its segment.
+    ok = DecodeGraphParallel(
+        compressed, compressed_size, num_threads,
+        [&](size_t thread, size_t a, size_t b) { add(a, b); });
+  }
+  ZKR_RETURN_IF_ERROR(ok);
+  for (size_t i = 0; i < num_nodes; i++) {
+    if (next[i] != offsets[i + 1]) {
+      return ZKR_FAILURE("The lists do not match the degrees");
+    }
+  }
+  if (new_ids != nullptr) {
+    // Renumbering the neighbours does not keep the lists sorted.
+    constexpr size_t kNodesPerTask = 1024;
+    ParallelFor(DivCeil(num_nodes, kNodesPerTask), num_threads,
+                [&](size_t thread, size_t task) {
+                  size_t end = std::min(num_nodes, (task + 1) * kNodesPerTask);
+                  for (size_t i = task * kNodesPerTask; i < end; i++) {
+                    std::sort(edges + offsets[i], edges + offsets[i + 1]);
+                  }
+                  return true;
+                });
+  }
+  return out.Close();
+}
+
+}  // namespace zuckerli
@@ -0,0 +1,46 @@
+// Copyright 2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#ifndef ZUCKERLI_DECODE_UNCOMPRESSED_H
+#define ZUCKERLI_DECODE_UNCOMPRESSED_H
+#include <stddef.h>
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+namespace zuckerli {
+
+// Decodes the graph into `output_path`, in the format described in
+// uncompressed_graph.h, using up to `num_threads` threads (0 means one per
+// hardware thread). A first pass computes the degrees (only decoding the degree
+// section if the graph has one), so that the file can be created with its
+// final size and the offsets written up front; the second pass then writes the
+// edges of each segment directly into a memory mapping of the file, without
+// ever keeping the whole graph in memory.
+//
+// Symmetric graphs (see graph_header.h) are written with their full lists,
+// and are decoded by a single thread.
+//
+// If `new_ids` is not null, node i is written as node `(*new_ids)[i]`, and
+// each list is sorted again in the output file; passing the original ids of
+// a NodePermutation undoes the renumbering done by the encoder.
+bool DecodeToUncompressedGraph(const uint8_t* compressed,
+                               size_t compressed_size,
+                               const std::string& output_path,
+                               size_t num_threads = 1,
+                               const std::vector<uint32_t>* new_ids = nullptr);
+
+}  // namespace zuckerli
+
+#endif  // ZUCKERLI_DECODE_UNCOMPRESSED_H
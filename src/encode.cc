@@ -10,8 +10,11 @@
 #include "checksum.h"
 #include "common.h"
 #include "context_model.h"
+#include "graph_header.h"
 #include "huffman.h"
 #include "integer_coder.h"
+#include "offset_index.h"
+#include "parallel.h"
 #include "absl/flags/flag.h"
 #include "uncompressed_graph.h"
 
@@ -21,8 +24,11 @@ ABSL_FLAG(bool, print_bits_breakdown, false,
 namespace zuckerli {
 
 namespace {
+// Splits `list` into blocks of edges alternately copied from and skipped in
+// `ref_list`, and residual edges that are not copied.
 // TODO: consider discarding short "copy" runs.
-void ComputeBlocksAndResiduals(const UncompressedGraph &g, size_t i, size_t ref,
+void ComputeBlocksAndResiduals(span<const uint32_t> list,
+                               span<const uint32_t> ref_list,
                                std::vector<uint32_t> *blocks,
                                std::vector<uint32_t> *residuals) {
   blocks->clear();
@@ -32,9 +38,9 @@ void ComputeBlocksAndResiduals(const UncompressedGraph &g, size_t i, size_t ref,
   size_t rpos = 0;
   bool is_same = true;
   blocks->push_back(0);
-  while (ipos < g.Degree(i) && rpos < g.Degree(i - ref)) {
-    size_t a = g.Neighbours(i)[ipos];
-    size_t b = g.Neighbours(i - ref)[rpos];
+  while (ipos < list.size() && rpos < ref_list.size()) {
+    size_t a = list[ipos];
+    size_t b = ref_list[rpos];
     if (a == b) {
       ipos++;
       rpos++;
@@ -55,9 +61,9 @@ void ComputeBlocksAndResiduals(const UncompressedGraph &g, size_t i, size_t ref,
       rpos++;
     }
   }
-  if (ipos != g.Degree(i)) {
-    for (size_t j = ipos; j < g.Degree(i); j++) {
-      residuals->push_back(g.Neighbours(i)[j]);
+  if (ipos != list.size()) {
+    for (size_t j = ipos; j < list.size(); j++) {
+      residuals->push_back(list[j]);
     }
   }
   size_t pos = 0;
@@ -69,7 +75,7 @@ void ComputeBlocksAndResiduals(const UncompressedGraph &g, size_t i, size_t ref,
       size_t skip = (*blocks)[k + 1];
       (*blocks)[cur - 1] += add + skip;
       for (size_t j = 0; j < add; j++) {
-        residuals->push_back(g.Neighbours(i)[pos + j]);
+        residuals->push_back(list[pos + j]);
       }
       pos += add + skip;
       k++;
@@ -80,15 +86,14 @@ void ComputeBlocksAndResiduals(const UncompressedGraph &g, size_t i, size_t ref,
     }
   }
   std::sort(residuals->begin(), residuals->end());
-  if (rpos == g.Degree(i - ref) || !is_same) {
+  if (rpos == ref_list.size() || !is_same) {
     blocks->pop_back();
   }
 }
 
 template <typename CB1, typename CB2>
 void ProcessBlocks(const std::vector<uint32_t> &blocks,
-                   const UncompressedGraph &g, size_t i, size_t reference,
-                   CB1 copy_cb, CB2 cb) {
+                   span<const uint32_t> ref_list, CB1 copy_cb, CB2 cb) {
   // TODO: more ctx modeling.
   cb(kBlockCountContext, blocks.size());
   bool copy = true;
@@ -103,7 +108,7 @@ void ProcessBlocks(const std::vector<uint32_t> &blocks,
     cb(ctx, b);
     if (copy) {
       for (size_t k = 0; k < blocks[j]; k++) {
-        copy_cb(g.Neighbours(i - reference)[pos++]);
+        copy_cb(ref_list[pos++]);
       }
     } else {
       pos += blocks[j];
@@ -111,8 +116,8 @@ void ProcessBlocks(const std::vector<uint32_t> &blocks,
     copy = !copy;
   }
   if (copy) {
-    for (size_t k = pos; k < g.Neighbours(i - reference).size(); k++) {
-      copy_cb(g.Neighbours(i - reference)[pos++]);
+    for (size_t k = pos; k < ref_list.size(); k++) {
+      copy_cb(ref_list[pos++]);
     }
   }
 }
@@ -166,72 +171,364 @@ void ProcessResiduals(const std::vector<uint32_t> &residuals, size_t i,
   }
 }
 
-void UpdateReferencesForMaxLength(const std::vector<float> &saved_costs,
-                                  std::vector<size_t> &references,
-                                  size_t max_length) {
-  ZKR_ASSERT(saved_costs.size() == references.size());
-  size_t N = references.size();
-  for (size_t i = 0; i < N; i++) {
-    ZKR_ASSERT(references[i] <= i);
-    ZKR_ASSERT(saved_costs[i] >= 0);
-    if (references[i] == 0) ZKR_ASSERT(saved_costs[i] == 0);
+// Estimates the cost of coding adjacency lists with the current symbol costs,
+// and counts the symbols that would be used. Each thread uses its own instance.
+class CostEstimator {
+ public:
+  explicit CostEstimator(const std::vector<float> *symbol_cost)
+      : symbol_cost_(symbol_cost), symbol_count_(kNumContexts * kNumSymbols) {}
+
+  // Returns the cost of `list`, the neighbours of node `i`, when using
+  // `ref_list`, the neighbours of node `i - ref`, as a reference, or no
+  // reference if `ref` is 0.
+  float Cost(span<const uint32_t> list, size_t i, size_t ref,
+             span<const uint32_t> ref_list, bool allow_random_access) {
+    cost_ = 0;
+    adj_block_.clear();
+    auto token_cost = [&](size_t ctx, size_t v) {
+      int token = IntegerCoder::Token(v);
+      cost_ += IntegerCoder::Cost(ctx, v, symbol_cost_->data());
+      symbol_count_[ctx * kNumSymbols + token]++;
+    };
+    // Very rough estimate.
+    auto rle_undo = [&]() {
+      cost_ -= (*symbol_cost_)[kResidualBaseContext * kNumSymbols];
+    };
+    if (ref == 0) {
+      residuals_.assign(list.begin(), list.end());
+    } else {
+      ComputeBlocksAndResiduals(list, ref_list, &blocks_, &residuals_);
+      ProcessBlocks(
+          blocks_, ref_list, [&](size_t x) { adj_block_.push_back(x); },
+          token_cost);
+    }
+    ProcessResiduals(residuals_, i, adj_block_, allow_random_access, rle_undo,
+                     token_cost);
+    return cost_;
   }
-  size_t has_ref = 0;
-  for (size_t i = 0; i < N; i++) {
-    if (references[i]) {
-      has_ref++;
+
+  float Cost(const UncompressedGraph &g, size_t i, size_t ref,
+             bool allow_random_access) {
+    return Cost(g.Neighbours(i), i, ref,
+                ref == 0 ? span<const uint32_t>() : g.Neighbours(i - ref),
+                allow_random_access);
+  }
+
+  void ClearCounts() {
+    std::fill(symbol_count_.begin(), symbol_count_.end(), 0);
+  }
+
+  // Number of uses of each symbol, indexed by ctx * kNumSymbols + symbol.
+  const std::vector<size_t> &symbol_count() const { return symbol_count_; }
+
+ private:
+  const std::vector<float> *symbol_cost_;
+  std::vector<size_t> symbol_count_;
+  float cost_ = 0;
+  std::vector<uint32_t> residuals_;
+  std::vector<uint32_t> blocks_;
+  std::vector<uint32_t> adj_block_;
+};
+
+// Sets the cost of each symbol to its entropy according to `symbol_count`,
+// indexed by ctx * kNumSymbols + symbol. Contexts with no symbols are left
+// unchanged.
+void UpdateSymbolCosts(const std::vector<size_t> &symbol_count,
+                       std::vector<float> *symbol_cost) {
+  for (size_t i = 0; i < kNumContexts; i++) {
+    const size_t *ctx_count = &symbol_count[i * kNumSymbols];
+    float total_symbols =
+        std::accumulate(ctx_count, ctx_count + kNumSymbols, 0ul);
+    if (total_symbols < 0.5f) {
+      continue;
+    }
+    for (size_t s = 0; s < kNumSymbols; s++) {
+      float cnt = std::max(1.0f * ctx_count[s], 0.1f);
+      (*symbol_cost)[i * kNumSymbols + s] = std::log(total_symbols / cnt);
     }
   }
-  fprintf(stderr, "has ref pre: %lu\n", has_ref);
-  std::vector<std::vector<uint32_t>> out_edges(N);
-  for (size_t i = 0; i < N; i++) {
-    if (references[i] != 0) {
-      out_edges[i - references[i]].push_back(i);
+}
+
+// Symbol counts indexed by ctx * kNumSymbols + symbol, from histograms indexed
+// by context and symbol, as computed by IntegerData::Histograms.
+std::vector<size_t> SymbolCounts(
+    const std::vector<std::vector<size_t>> &histograms) {
+  std::vector<size_t> symbol_count(kNumContexts * kNumSymbols);
+  for (size_t ctx = 0; ctx < histograms.size(); ctx++) {
+    for (size_t s = 0; s < histograms[ctx].size(); s++) {
+      symbol_count[ctx * kNumSymbols + s] = histograms[ctx][s];
     }
   }
-  std::vector<float> dyn(N * (max_length + 1));
-  std::vector<bool> choice(N * (max_length + 1));  // true -> use reference.
+  return symbol_count;
+}
 
-  // TODO: check this.
+// Bitmap of hashes of the neighbours of a node. Lists whose sketches have no
+// bits in common have no neighbours in common, and the number of common bits
+// is a cheap estimate of the number of common neighbours, as long as the lists
+// are not much longer than the number of bits.
+struct ListSketch {
+  static constexpr size_t kLogBits = 9;
+  static constexpr size_t kWords = (size_t{1} << kLogBits) / 64;
+  uint64_t words[kWords];
+
+  void Compute(span<const uint32_t> list) {
+    std::fill(words, words + kWords, 0);
+    for (uint32_t x : list) {
+      uint32_t bit = (x * 0x9E3779B1u) >> (32 - kLogBits);
+      words[bit / 64] |= uint64_t{1} << (bit % 64);
+    }
+  }
+
+  size_t Similarity(const ListSketch &other) const {
+    size_t common = 0;
+    for (size_t i = 0; i < kWords; i++) {
+      common += __builtin_popcountll(words[i] & other.words[i]);
+    }
+    return common;
+  }
+};
+
+// Selects the previous lists to evaluate as references of a node, so that the
+// full cost only needs to be computed for a few of them.
+class ReferenceCandidates {
+ public:
+  // `num_candidates` is the number of lists to select, or 0 to select all of
+  // them, in which case sketches are not used.
+  explicit ReferenceCandidates(size_t num_candidates)
+      : num_candidates_(num_candidates) {}
+
+  bool UsesSketches(size_t max_ref) const {
+    return num_candidates_ != 0 && num_candidates_ < max_ref;
+  }
+
+  // Returns, in increasing order, the reference offsets in [1, max_ref] of
+  // the (at most) `num_candidates` lists whose sketches have the most bits in
+  // common with the one of the current list, ties going to closer lists. Lists
+  // with no common bits cannot be useful references, and are never selected.
+  // `sketch_of(ref)` returns the sketch of the list `ref` nodes before the
+  // current one, and is only called if UsesSketches(max_ref).
+  template <typename SketchOf>
+  const std::vector<size_t> &Select(size_t max_ref,
+                                    const SketchOf &sketch_of) {
+    candidates_.clear();
+    if (!UsesSketches(max_ref)) {
+      for (size_t ref = 1; ref <= max_ref; ref++) candidates_.push_back(ref);
+      return candidates_;
+    }
+    scored_.clear();
+    const ListSketch &sketch = sketch_of(0);
+    for (size_t ref = 1; ref <= max_ref; ref++) {
+      size_t common = sketch.Similarity(sketch_of(ref));
+      // Sorted by decreasing similarity, then increasing offset.
+      if (common != 0) scored_.emplace_back(~common, ref);
+    }
+    size_t num = std::min(num_candidates_, scored_.size());
+    std::partial_sort(scored_.begin(), scored_.begin() + num, scored_.end());
+    for (size_t j = 0; j < num; j++) candidates_.push_back(scored_[j].second);
+    std::sort(candidates_.begin(), candidates_.end());
+    return candidates_;
+  }
+
+ private:
+  size_t num_candidates_;
+  std::vector<std::pair<size_t, size_t>> scored_;
+  std::vector<size_t> candidates_;
+};
+
+// Produces the tokens of consecutive adjacency lists.
+class ListTokenizer {
+ public:
+  // `degree_chunk_size` is as in GraphHeader, and only used with random
+  // access.
+  explicit ListTokenizer(bool allow_random_access,
+                         size_t degree_chunk_size = kDegreeReferenceChunkSize)
+      : allow_random_access_(allow_random_access),
+        degree_chunk_mask_(degree_chunk_size - 1) {}
+
+  // Appends to `tokens` the tokens of `list`, the neighbours of node `i`, using
+  // `ref_list`, the neighbours of node `i - reference`, as a reference if
+  // `reference` is not 0. The degree token goes to `degree_tokens`, which may
+  // be `tokens`. Lists must be added in node order.
+  void Add(size_t i, size_t segment_start, span<const uint32_t> list,
+           size_t reference, span<const uint32_t> ref_list,
+           IntegerData *tokens, IntegerData *degree_tokens) {
+    if ((allow_random_access_ && (i & degree_chunk_mask_) == 0) ||
+        i == segment_start) {
+      last_reference_ = 0;
+      last_degree_delta_ = list.size();
+      degree_tokens->Add(kFirstDegreeContext, last_degree_delta_);
+    } else {
+      size_t ctx = DegreeContext(last_degree_delta_);
+      last_degree_delta_ = PackSigned(list.size() - last_degree_);
+      degree_tokens->Add(ctx, last_degree_delta_);
+    }
+    last_degree_ = list.size();
+    if (list.size() == 0) {
+      return;
+    }
+    if (reference == 0) {
+      residuals_.assign(list.begin(), list.end());
+    } else {
+      ComputeBlocksAndResiduals(list, ref_list, &blocks_, &residuals_);
+    }
+    adj_block_.clear();
+    if (i != segment_start) {
+      tokens->Add(ReferenceContext(last_reference_), reference);
+      last_reference_ = reference;
+      if (reference != 0) {
+        ProcessBlocks(
+            blocks_, ref_list, [&](size_t x) { adj_block_.push_back(x); },
+            [&](size_t ctx, size_t v) { tokens->Add(ctx, v); });
+      }
+    }
+    // Residuals.
+    ProcessResiduals(
+        residuals_, i, adj_block_, allow_random_access_,
+        [&]() { tokens->RemoveLast(); },
+        [&](size_t ctx, size_t v) { tokens->Add(ctx, v); });
+  }
+
+ private:
+  bool allow_random_access_;
+  size_t degree_chunk_mask_;
+  // Reference degree for degree delta coding.
+  size_t last_degree_ = 0;
+  // Last degree delta for context modeling.
+  size_t last_degree_delta_ = 0;
+  // Last reference offset for context modeling.
+  size_t last_reference_ = 0;
+  std::vector<uint32_t> residuals_;
+  std::vector<uint32_t> blocks_;
+  std::vector<uint32_t> adj_block_;
+};
+
+// Entropy codes the tokens of a segment of a sequential graph, with its own
+// tables, and records its size in `header`. If the graph has a degree section,
+// `degree_tokens` are coded first, in that section; otherwise, they must be
+// empty.
+std::vector<uint8_t> EncodeSegment(const IntegerData &tokens,
+                                   const IntegerData &degree_tokens,
+                                   GraphHeader *header,
+                                   std::vector<double> *bits_per_ctx) {
+  BitWriter writer;
+  ANSEncode(tokens, kNumContexts, &writer, bits_per_ctx);
+  std::vector<uint8_t> lists = std::move(writer).GetData();
+  if (!header->has_degree_section) {
+    ZKR_ASSERT(degree_tokens.Size() == 0);
+    header->segment_sizes.push_back(lists.size());
+    return lists;
+  }
+  BitWriter degree_writer;
+  std::vector<double> degree_bits_per_ctx;
+  ANSEncode(degree_tokens, kReferenceContextBase, &degree_writer,
+            &degree_bits_per_ctx);
+  for (size_t i = 0; i < degree_bits_per_ctx.size(); i++) {
+    (*bits_per_ctx)[i] += degree_bits_per_ctx[i];
+  }
+  std::vector<uint8_t> data = std::move(degree_writer).GetData();
+  header->degree_section_sizes.push_back(data.size());
+  data.insert(data.end(), lists.begin(), lists.end());
+  header->segment_sizes.push_back(data.size());
+  return data;
+}
+
+// Removes references so that no chain of references is longer than
+// `max_length`, keeping the ones that maximize the sum of `saved_costs`.
+// References form a forest, where the parent of node i is i - references[i];
+// for each node and number l of links still available to it, the dynamic
+// programming computes the best saving in the subtree of the node, which either
+// uses the reference of the node (and leaves l - 1 links to its children) or
+// drops it (and leaves `max_length` links).
+//
+// As references are at most `max_reference` nodes back, the savings of the
+// children of a node are all summed within `max_reference` nodes of it, so they
+// are kept in a ring buffer rather than per node; only a byte with the choices
+// of each node is kept for the whole graph. The graph is split in ranges at
+// nodes that no reference crosses, so that each range holds whole trees, and
+// ranges are processed in parallel.
+void UpdateReferencesForMaxLength(const std::vector<float> &saved_costs,
+                                  std::vector<uint16_t> &references,
+                                  size_t max_length, size_t max_reference,
+                                  size_t num_threads) {
+  ZKR_ASSERT(saved_costs.size() == references.size());
+  // The choices of a node fit in a byte.
+  ZKR_ASSERT(max_length <= kMaxChainLength);
+  size_t N = references.size();
+  size_t has_ref = 0;
+  // Starts of the ranges (in decreasing order), and N.
+  constexpr size_t kMinNodesPerRange = 1 << 16;
+  std::vector<size_t> cuts = {N};
+  size_t min_parent = N;
   for (size_t ip1 = N; ip1 > 0; ip1--) {
     size_t i = ip1 - 1;
-    float child_sum_full_chain = 0;
-    for (uint64_t child : out_edges[i]) {
-      child_sum_full_chain += dyn[child * (max_length + 1) + max_length];
+    ZKR_ASSERT(references[i] <= std::min(i, max_reference));
+    ZKR_ASSERT(saved_costs[i] >= 0);
+    if (references[i] == 0) ZKR_ASSERT(saved_costs[i] == 0);
+    if (references[i] != 0) {
+      has_ref++;
+      min_parent = std::min(min_parent, i - references[i]);
     }
+    if ((min_parent >= i && cuts.back() - i >= kMinNodesPerRange) || i == 0) {
+      cuts.push_back(i);
+    }
+  }
+  std::reverse(cuts.begin(), cuts.end());
+  fprintf(stderr, "has ref pre: %lu\n", has_ref);
 
-    choice[i * (max_length + 1)] = false;
-    dyn[i * (max_length + 1)] = child_sum_full_chain;
-
-    // counting parent link, if any.
-    for (size_t links_to_use = 1; links_to_use <= max_length; links_to_use++) {
-      float child_sum = saved_costs[i];
-      // Take it.
-      for (uint64_t child : out_edges[i]) {
-        child_sum += dyn[child * (max_length + 1) + links_to_use - 1];
+  size_t window = 1;
+  while (window <= max_reference) window *= 2;
+  size_t mask = window - 1;
+  size_t row = max_length + 1;
+  // Bit l is set if the node uses its reference when l links are available.
+  std::vector<uint8_t> choices(N);
+  ParallelFor(cuts.size() - 1, num_threads, [&](size_t thread, size_t range) {
+    size_t begin = cuts[range];
+    size_t end = cuts[range + 1];
+    // Row of a node: for each l, the sum over its children seen so far of the
+    // best saving in their subtree with l links available.
+    std::vector<float> child_savings(window * row);
+    for (size_t ip1 = end; ip1 > begin; ip1--) {
+      size_t i = ip1 - 1;
+      float *children = &child_savings[(i & mask) * row];
+      float best[kMaxChainLength + 1];
+      float full_chain = children[max_length];
+      uint8_t choice = 0;
+      best[0] = full_chain;
+      for (size_t l = 1; l <= max_length; l++) {
+        float take = saved_costs[i] + children[l - 1];
+        if (take > full_chain) {
+          choice |= 1 << l;
+          best[l] = take;
+        } else {
+          best[l] = full_chain;
+        }
       }
-      if (child_sum > child_sum_full_chain) {
-        choice[i * (max_length + 1) + links_to_use] = true;
-        dyn[i * (max_length + 1) + links_to_use] = child_sum;
+      choices[i] = choice;
+      if (references[i] != 0) {
+        float *parent = &child_savings[((i - references[i]) & mask) * row];
+        for (size_t l = 0; l <= max_length; l++) parent[l] += best[l];
+      }
+      // The row is reused by node i - window.
+      std::fill(children, children + row, 0.0f);
+    }
+    // Number of links available to the children of a node.
+    std::vector<uint8_t> child_links(window);
+    for (size_t i = begin; i < end; i++) {
+      uint8_t &links = child_links[i & mask];
+      links = max_length;
+      if (references[i] == 0) continue;
+      size_t available = child_links[(i - references[i]) & mask];
+      if (choices[i] & (1 << available)) {
+        links = available - 1;
       } else {
-        choice[i * (max_length + 1) + links_to_use] = false;
-        dyn[i * (max_length + 1) + links_to_use] = child_sum_full_chain;
+        references[i] = 0;
       }
     }
-  }
+    return true;
+  });
 
-  std::vector<size_t> available_length(N, max_length);
   has_ref = 0;
   for (size_t i = 0; i < N; i++) {
-    if (choice[i * (max_length + 1) + available_length[i]]) {
-      // Taken: push available_length.
-      for (uint64_t child : out_edges[i]) {
-        available_length[child] = available_length[i] - 1;
-      }
-    } else {
-      // Not taken: remove reference.
-      references[i] = 0;
-    }
     if (references[i]) {
       has_ref++;
     }
@@ -240,31 +537,90 @@ void UpdateReferencesForMaxLength(const std::vector<float> &saved_costs,
 }
 }  // namespace
 
+EncodeOptions EncodeOptions::FromFlags(bool allow_random_access) {
+  EncodeOptions options;
+  options.allow_random_access = allow_random_access;
+  options.degree_chunk_size = absl::GetFlag(FLAGS_degree_chunk_size);
+  options.max_chain_length = absl::GetFlag(FLAGS_max_chain_length);
+  return options;
+}
+
+bool CheckEncodeOptionFlags() {
+  int32_t degree_chunk_size = absl::GetFlag(FLAGS_degree_chunk_size);
+  if (degree_chunk_size <= 0 ||
+      static_cast<size_t>(degree_chunk_size) > kMaxDegreeChunkSize ||
+      (degree_chunk_size & (degree_chunk_size - 1)) != 0) {
+    fprintf(stderr,
+            "Invalid --degree_chunk_size %d: must be a power of two between 1 "
+            "and %zu\n",
+            degree_chunk_size, kMaxDegreeChunkSize);
+    return false;
+  }
+  int32_t max_chain_length = absl::GetFlag(FLAGS_max_chain_length);
+  if (max_chain_length < 0 ||
+      static_cast<size_t>(max_chain_length) > kMaxChainLength) {
+    fprintf(stderr,
+            "Invalid --max_chain_length %d: must be between 0 and %zu\n",
+            max_chain_length, kMaxChainLength);
+    return false;
+  }
+  return true;
+}
+
 std::vector<uint8_t> EncodeGraph(const UncompressedGraph &g,
                                  bool allow_random_access, size_t *checksum) {
+  return EncodeGraph(g, EncodeOptions::FromFlags(allow_random_access),
+                     checksum);
+}
+
+std::vector<uint8_t> EncodeGraph(const UncompressedGraph &g,
+                                 const EncodeOptions &options,
+                                 size_t *checksum) {
   auto start = std::chrono::high_resolution_clock::now();
+  bool allow_random_access = options.allow_random_access;
   size_t N = g.size();
   size_t chksum = 0;
   size_t edges = 0;
-  BitWriter writer;
-  writer.Reserve(64);
-  writer.Write(48, N);
-  writer.Write(1, allow_random_access);
-  size_t with_blocks = 0;
+  GraphHeader header;
+  header.num_nodes = N;
+  header.allow_random_access = allow_random_access;
+  if (allow_random_access) {
+    ZKR_ASSERT(options.degree_chunk_size != 0 &&
+               options.degree_chunk_size <= kMaxDegreeChunkSize &&
+               (options.degree_chunk_size & (options.degree_chunk_size - 1)) ==
+                   0);
+    header.degree_chunk_size = options.degree_chunk_size;
+    header.max_chain_length = options.max_chain_length;
+  }
+  header.integer_coder = IntegerCoder::GetParams();
+  header.search_num = SearchNum();
+  header.has_offset_index =
+      allow_random_access && absl::GetFlag(FLAGS_offset_index);
+  if (!allow_random_access && absl::GetFlag(FLAGS_nodes_per_segment) < N) {
+    header.nodes_per_segment = absl::GetFlag(FLAGS_nodes_per_segment);
+  }
+  if (!allow_random_access) {
+    header.has_degree_section = absl::GetFlag(FLAGS_degree_section);
+  }
+  header.has_segment_hashes = absl::GetFlag(FLAGS_segment_hashes);
   IntegerData tokens;
-  size_t ref = 0;
-  size_t last_degree_delta = 0;
-  std::vector<size_t> references(N);
+  IntegerData degree_tokens;
+  // At most SearchNum() <= kMaxSearchNum.
+  std::vector<uint16_t> references(N);
   std::vector<float> saved_costs(N);
+  size_t max_chain_length = options.max_chain_length;
+  ZKR_ASSERT(max_chain_length <= kMaxChainLength);
 
   std::vector<float> symbol_cost(kNumContexts * kNumSymbols, 1.0f);
-  std::vector<uint32_t> residuals;
-  std::vector<uint32_t> blocks;
-  std::vector<uint32_t> adj_block;
-  std::vector<std::vector<size_t>> symbol_count(kNumContexts);
-  for (size_t i = 0; i < kNumContexts; i++) {
-    symbol_count[i].resize(kNumSymbols, 0);
-  }
+  size_t num_threads = NumThreads(absl::GetFlag(FLAGS_num_threads));
+  std::vector<CostEstimator> estimators(num_threads,
+                                        CostEstimator(&symbol_cost));
+  std::vector<ReferenceCandidates> candidates(
+      num_threads, ReferenceCandidates(absl::GetFlag(FLAGS_ref_candidates)));
+  std::vector<std::vector<ListSketch>> sketches(num_threads);
+  // Nodes are processed in tasks of this many consecutive nodes.
+  constexpr size_t kNodesPerTask = 1024;
+  size_t num_tasks = DivCeil(N, kNodesPerTask);
 
   // More rounds improve compression a bit, but are also much slower.
   // TODO: sometimes, it actually makes things worse (???). Might be max
@@ -272,98 +628,104 @@ std::vector<uint8_t> EncodeGraph(const UncompressedGraph &g,
   for (size_t round = 0; round < absl::GetFlag(FLAGS_num_rounds); round++) {
     fprintf(stderr, "Selecting references, round %lu%20s\n", round + 1, "");
     std::fill(references.begin(), references.end(), 0);
-    float c = 0;
-    auto token_cost = [&](size_t ctx, size_t v) {
-      int token = IntegerCoder::Token(v);
-      c += IntegerCoder::Cost(ctx, v, symbol_cost.data());
-      symbol_count[ctx][token]++;
-    };
-    // Very rough estimate.
-    auto rle_undo = [&]() {
-      c -= symbol_cost[kResidualBaseContext * kNumSymbols];
-    };
 
-    static constexpr size_t kMaxChainLength = 3;
     bool greedy =
         allow_random_access && absl::GetFlag(FLAGS_greedy_random_access);
-    std::vector<uint32_t> chain_length(N, 0);
-    for (size_t i = 0; i < N; i++) {
-      if (i % 32 == 0) fprintf(stderr, "%lu/%lu\r", i, N);
-      c = 0;
+    std::vector<uint8_t> chain_length(N, 0);
+    // `sketch_of(node)` returns the sketch of the list of `node`.
+    auto search_references = [&](size_t i, size_t thread,
+                                 const auto &sketch_of) {
+      CostEstimator *estimator = &estimators[thread];
       // No block copying.
-      residuals.assign(g.Neighbours(i).begin(), g.Neighbours(i).end());
-      ProcessResiduals(residuals, i, adj_block, allow_random_access, rle_undo,
-                       token_cost);
-      float cost = c;
-      float base_cost = c;
+      float cost = estimator->Cost(g, i, 0, allow_random_access);
+      float base_cost = cost;
       saved_costs[i] = 0;
 
-      for (size_t ref = 1; ref < std::min(SearchNum(), i) + 1; ref++) {
-        if (greedy && chain_length[i - ref] >= kMaxChainLength) continue;
-        adj_block.clear();
-        c = 0;
-        ComputeBlocksAndResiduals(g, i, ref, &blocks, &residuals);
-        ProcessBlocks(
-            blocks, g, i, ref, [&](size_t x) { adj_block.push_back(x); },
-            token_cost);
-        ProcessResiduals(residuals, i, adj_block, allow_random_access, rle_undo,
-                         token_cost);
+      size_t max_ref = std::min(SearchNum(), i - header.SegmentStart(i));
+      const std::vector<size_t> &refs = candidates[thread].Select(
+          max_ref,
+          [&](size_t ref) -> const ListSketch & { return sketch_of(i - ref); });
+      for (size_t ref : refs) {
+        if (greedy && chain_length[i - ref] >= max_chain_length) continue;
+        float c = estimator->Cost(g, i, ref, allow_random_access);
         if (c + 1e-6f < cost) {
           references[i] = ref;
           cost = c;
           saved_costs[i] = base_cost - c;
         }
       }
-      if (references[i] != 0) {
+      if (greedy && references[i] != 0) {
         chain_length[i] = chain_length[i - references[i]] + 1;
       }
-    }
+    };
+    // The search for each node only depends on the symbol costs, except for
+    // the greedy heuristic, which depends on the references of previous nodes.
+    ParallelFor(
+        num_tasks, greedy ? 1 : num_threads, [&](size_t thread, size_t task) {
+          // Tasks are handed out in order, so the progress of one thread is
+          // monotonic and does not interleave with the others.
+          if (thread == 0) {
+            fprintf(stderr, "%lu/%lu\r", task * kNodesPerTask, N);
+          }
+          size_t begin = task * kNodesPerTask;
+          size_t end = std::min(N, begin + kNodesPerTask);
+          // Sketches of the lists of the task, and of the previous ones that
+          // they may use as references.
+          size_t first = begin - std::min(begin, SearchNum());
+          std::vector<ListSketch> &task_sketches = sketches[thread];
+          if (candidates[thread].UsesSketches(SearchNum())) {
+            task_sketches.resize(end - first);
+            for (size_t i = first; i < end; i++) {
+              task_sketches[i - first].Compute(g.Neighbours(i));
+            }
+          }
+          auto sketch_of = [&](size_t node) -> const ListSketch & {
+            return task_sketches[node - first];
+          };
+          for (size_t i = begin; i < end; i++) {
+            search_references(i, thread, sketch_of);
+          }
+          return true;
+        });
 
     // Ensure max reference chain length.
     if (allow_random_access && !greedy) {
-      UpdateReferencesForMaxLength(saved_costs, references, kMaxChainLength);
-      std::vector<size_t> chain_length(N);
+      UpdateReferencesForMaxLength(saved_costs, references, max_chain_length,
+                                   SearchNum(), num_threads);
+      std::vector<uint8_t> chain_length(N);
       for (size_t i = 0; i < N; i++) {
         if (references[i] != 0) {
           chain_length[i] = chain_length[i - references[i]] + 1;
         }
       }
-      std::vector<size_t> fwd_chain_length(N);
+      std::vector<uint8_t> fwd_chain_length(N);
       for (size_t ip1 = N; ip1 > 0; ip1--) {
         size_t i = ip1 - 1;
         if (references[i] != 0) {
-          fwd_chain_length[i - references[i]] = std::max(
-              fwd_chain_length[i] + 1, fwd_chain_length[i - references[i]]);
+          fwd_chain_length[i - references[i]] =
+              std::max<uint8_t>(fwd_chain_length[i] + 1,
+                                fwd_chain_length[i - references[i]]);
         }
       }
       fprintf(stderr, "Adding removed references, round %lu%20s\n", round + 1,
               "");
+      CostEstimator *estimator = &estimators[0];
       for (size_t i = 0; i < N; i++) {
         if (i % 32 == 0) fprintf(stderr, "%lu/%lu\r", i, N);
         if (references[i] != 0) {
           chain_length[i] = chain_length[i - references[i]] + 1;
           continue;
         }
-        c = 0;
         // No block copying
-        residuals.assign(g.Neighbours(i).begin(), g.Neighbours(i).end());
-        ProcessResiduals(residuals, i, adj_block, allow_random_access, rle_undo,
-                         token_cost);
-        float cost = c;
-
-        for (size_t ref = 1; ref < std::min(SearchNum(), i) + 1; ref++) {
-          if (chain_length[i - ref] + fwd_chain_length[i] + 1 >
-              kMaxChainLength) {
+        float cost = estimator->Cost(g, i, 0, allow_random_access);
+
+        size_t max_ref = std::min(SearchNum(), i - header.SegmentStart(i));
+        for (size_t ref = 1; ref < max_ref + 1; ref++) {
+          if (size_t{chain_length[i - ref]} + fwd_chain_length[i] + 1 >
+              max_chain_length) {
             continue;
           }
-          adj_block.clear();
-          c = 0;
-          ComputeBlocksAndResiduals(g, i, ref, &blocks, &residuals);
-          ProcessBlocks(
-              blocks, g, i, ref, [&](size_t x) { adj_block.push_back(x); },
-              token_cost);
-          ProcessResiduals(residuals, i, adj_block, allow_random_access,
-                           rle_undo, token_cost);
+          float c = estimator->Cost(g, i, ref, allow_random_access);
           if (c + 1e-6f < cost) {
             references[i] = ref;
             cost = c;
@@ -383,105 +745,86 @@ std::vector<uint8_t> EncodeGraph(const UncompressedGraph &g,
     }
 
     // TODO: update references to take into account max chain length.
-    for (size_t i = 0; i < kNumContexts; i++) {
-      symbol_count[i].clear();
-      symbol_count[i].resize(256, 0);
-    }
-
     if (round + 1 != absl::GetFlag(FLAGS_num_rounds)) {
       fprintf(stderr, "Computing freqs, round %lu%20s\n", round + 1, "");
-      for (size_t i = 0; i < N; i++) {
-        if (i % 32 == 0) fprintf(stderr, "%lu/%lu\r", i, N);
-        adj_block.clear();
-        if (references[i] == 0) {
-          residuals.assign(g.Neighbours(i).begin(), g.Neighbours(i).end());
-        } else {
-          ComputeBlocksAndResiduals(g, i, references[i], &blocks, &residuals);
-          ProcessBlocks(
-              blocks, g, i, references[i],
-              [&](size_t x) { adj_block.push_back(x); }, token_cost);
+      for (CostEstimator &estimator : estimators) estimator.ClearCounts();
+      ParallelFor(num_tasks, num_threads, [&](size_t thread, size_t task) {
+        if (thread == 0) fprintf(stderr, "%lu/%lu\r", task * kNodesPerTask, N);
+        size_t end = std::min(N, (task + 1) * kNodesPerTask);
+        for (size_t i = task * kNodesPerTask; i < end; i++) {
+          estimators[thread].Cost(g, i, references[i], allow_random_access);
         }
-        ProcessResiduals(residuals, i, adj_block, allow_random_access, rle_undo,
-                         token_cost);
-      }
-
-      for (size_t i = 0; i < kNumContexts; i++) {
-        float total_symbols = std::accumulate(symbol_count[i].begin(),
-                                              symbol_count[i].end(), 0ul);
-        if (total_symbols < 0.5f) {
-          continue;
-        }
-        for (size_t s = 0; s < 256; s++) {
-          float cnt = std::max(1.0f * symbol_count[i][s], 0.1f);
-          symbol_cost[i * kNumSymbols + s] = std::log(total_symbols / cnt);
-          symbol_count[i][s] = 0;
+        return true;
+      });
+      std::vector<size_t> symbol_count(kNumContexts * kNumSymbols);
+      for (const CostEstimator &estimator : estimators) {
+        for (size_t i = 0; i < symbol_count.size(); i++) {
+          symbol_count[i] += estimator.symbol_count()[i];
         }
       }
+      UpdateSymbolCosts(symbol_count, &symbol_cost);
     }
   }
 
   // Holds the index of every node degree delta in `tokens` .
   std::vector<size_t> node_degree_indices;
 
-  size_t last_reference = 0;
+  std::vector<double> bits_per_ctx;
+  BitWriter data_writer;
+  // Checksum of the edges of the current segment.
+  uint64_t segment_hash = 0;
+  auto end_segment_hash = [&]() {
+    if (header.has_segment_hashes) {
+      header.segment_hashes.push_back(segment_hash);
+    }
+    chksum += segment_hash;
+    segment_hash = 0;
+  };
+  // Entropy codes the tokens of a sequential segment, with its own tables.
+  auto encode_segment = [&]() {
+    std::vector<uint8_t> segment =
+        EncodeSegment(tokens, degree_tokens, &header, &bits_per_ctx);
+    data_writer.AppendAligned(segment.data(), segment.size());
+    tokens = IntegerData();
+    degree_tokens = IntegerData();
+    end_segment_hash();
+  };
+
+  ListTokenizer tokenizer(allow_random_access, header.degree_chunk_size);
   fprintf(stderr, "Compressing%20s\n", "");
   for (size_t i = 0; i < N; i++) {
     if (i % 32 == 0) fprintf(stderr, "%lu/%lu\r", i, N);
     fflush(stderr);
-    if ((allow_random_access && i % kDegreeReferenceChunkSize == 0) || i == 0) {
-      last_reference = 0;
-      last_degree_delta = g.Degree(i);
-      node_degree_indices.push_back(tokens.Size());
-      tokens.Add(kFirstDegreeContext, last_degree_delta);
-    } else {
-      size_t ctx = DegreeContext(last_degree_delta);
-      last_degree_delta = PackSigned(g.Degree(i) - ref);
-      node_degree_indices.push_back(tokens.Size());
-      tokens.Add(ctx, last_degree_delta);
-    }
-    ref = g.Degree(i);
-    if (g.Degree(i) == 0) {
-      continue;
+    if (i != 0 && i == header.SegmentStart(i)) {
+      encode_segment();
     }
     size_t reference = references[i];
-    std::vector<uint32_t> residuals;
-    std::vector<uint32_t> blocks;
-    if (reference == 0) {
-      residuals.assign(g.Neighbours(i).begin(), g.Neighbours(i).end());
-    } else {
-      ComputeBlocksAndResiduals(g, i, reference, &blocks, &residuals);
-    }
-    std::vector<uint32_t> adj_block;
-    if (i != 0) {
-      tokens.Add(ReferenceContext(last_reference), reference);
-      last_reference = reference;
-      if (reference != 0) {
-        with_blocks++;
-        ProcessBlocks(
-            blocks, g, i, reference, [&](size_t x) { adj_block.push_back(x); },
-            [&](size_t ctx, size_t v) { tokens.Add(ctx, v); });
-      }
-    }
-    // Residuals.
-    ProcessResiduals(
-        residuals, i, adj_block, allow_random_access,
-        [&]() { tokens.RemoveLast(); },
-        [&](size_t ctx, size_t v) { tokens.Add(ctx, v); });
-  }
-  for (size_t i = 0; i < N; i++) {
+    node_degree_indices.push_back(tokens.Size());
+    tokenizer.Add(
+        i, header.SegmentStart(i), g.Neighbours(i), reference,
+        reference == 0 ? span<const uint32_t>() : g.Neighbours(i - reference),
+        &tokens, header.has_degree_section ? &degree_tokens : &tokens);
     edges += g.Degree(i);
-    for (size_t j = 0; j < g.Degree(i); j++) {
-      chksum = Checksum(chksum, i, g.Neighbours(i)[j]);
-    }
+    segment_hash += ListChecksum(i, g.Neighbours(i));
   }
 
-  std::vector<double> bits_per_ctx;
+  BitWriter writer;
   if (allow_random_access) {
-    HuffmanEncode(tokens, kNumContexts, &writer, node_degree_indices,
-                  &bits_per_ctx);
+    end_segment_hash();
+    std::vector<size_t> node_degree_bit_pos =
+        HuffmanEncode(tokens, kNumContexts, &data_writer, node_degree_indices,
+                      &bits_per_ctx);
+    WriteGraphHeader(header, &writer);
+    if (header.has_offset_index) {
+      EncodeOffsetIndex(node_degree_bit_pos, &writer);
+    }
   } else {
-    ANSEncode(tokens, kNumContexts, &writer, &bits_per_ctx);
+    encode_segment();
+    if (header.nodes_per_segment == 0) header.segment_sizes.clear();
+    WriteGraphHeader(header, &writer);
   }
+  std::vector<uint8_t> data_section = std::move(data_writer).GetData();
+  writer.AppendAligned(data_section.data(), data_section.size());
   auto data = std::move(writer).GetData();
   auto stop = std::chrono::high_resolution_clock::now();
 
@@ -531,4 +874,381 @@ std::vector<uint8_t> EncodeGraph(const UncompressedGraph &g,
   return data;
 }
 
+size_t StreamingNodesPerSegment() {
+  size_t nodes_per_segment = absl::GetFlag(FLAGS_nodes_per_segment);
+  return nodes_per_segment != 0 ? nodes_per_segment
+                                : kDefaultStreamingNodesPerSegment;
+}
+
+struct StreamingEncoder::State {
+  explicit State(const std::vector<float> *symbol_cost)
+      : estimator(symbol_cost),
+        tokenizer(/*allow_random_access=*/false),
+        candidates(absl::GetFlag(FLAGS_ref_candidates)),
+        sketches(MaxNodesBackwards()) {}
+  CostEstimator estimator;
+  ListTokenizer tokenizer;
+  ReferenceCandidates candidates;
+  // Sketches of the previous lists, indexed like `window_`.
+  std::vector<ListSketch> sketches;
+};
+
+StreamingEncoder::StreamingEncoder(size_t num_nodes, size_t nodes_per_segment,
+                                   FILE *out, bool degree_section,
+                                   bool segment_hashes, bool symmetric)
+    : out_(out),
+      window_(MaxNodesBackwards()),
+      symbol_cost_(kNumContexts * kNumSymbols, 1.0f),
+      state_(new State(&symbol_cost_)) {
+  header_.num_nodes = num_nodes;
+  header_.integer_coder = IntegerCoder::GetParams();
+  header_.search_num = SearchNum();
+  header_.has_degree_section = degree_section;
+  header_.has_segment_hashes = segment_hashes;
+  header_.symmetric = symmetric;
+  // Placeholders, overwritten by Finish().
+  if (nodes_per_segment < num_nodes) {
+    header_.nodes_per_segment = nodes_per_segment;
+    header_.segment_sizes.resize(header_.NumSegments());
+  }
+  if (degree_section) {
+    header_.degree_section_sizes.resize(header_.NumSegments());
+  }
+  if (segment_hashes) {
+    header_.segment_hashes.resize(header_.NumSegments());
+  }
+  header_start_ = ftell(out_);
+  BitWriter writer;
+  WriteGraphHeader(header_, &writer);
+  std::vector<uint8_t> data = std::move(writer).GetData();
+  ZKR_ASSERT(fwrite(data.data(), 1, data.size(), out_) == data.size());
+  num_bytes_ += data.size();
+  header_.segment_sizes.clear();
+  header_.degree_section_sizes.clear();
+  header_.segment_hashes.clear();
+}
+
+StreamingEncoder::~StreamingEncoder() = default;
+
+bool StreamingEncoder::WriteSegment() {
+  std::vector<uint8_t> data =
+      EncodeSegment(tokens_, degree_tokens_, &header_, &bits_per_ctx_);
+  if (fwrite(data.data(), 1, data.size(), out_) != data.size()) {
+    return ZKR_FAILURE("Write error");
+  }
+  num_bytes_ += data.size();
+
+  // The next segment is coded with the statistics of this one.
+  std::vector<std::vector<size_t>> histograms(kNumContexts);
+  tokens_.Histograms(&histograms);
+  UpdateSymbolCosts(SymbolCounts(histograms), &symbol_cost_);
+  tokens_ = IntegerData();
+  degree_tokens_ = IntegerData();
+  if (header_.has_segment_hashes) {
+    header_.segment_hashes.push_back(segment_hash_);
+  }
+  checksum_ += segment_hash_;
+  segment_hash_ = 0;
+  return true;
+}
+
+bool StreamingEncoder::AddList(span<const uint32_t> neighbours) {
+  size_t i = next_node_;
+  if (i >= header_.num_nodes) return ZKR_FAILURE("Too many lists");
+  for (size_t j = 0; j < neighbours.size(); j++) {
+    if (neighbours[j] >= header_.num_nodes) {
+      return ZKR_FAILURE("Invalid neighbour");
+    }
+    if (j != 0 && neighbours[j] <= neighbours[j - 1]) {
+      return ZKR_FAILURE("Unsorted list");
+    }
+  }
+  if (header_.symmetric && neighbours.size() != 0 &&
+      neighbours[neighbours.size() - 1] > i) {
+    return ZKR_FAILURE("Larger neighbour in a symmetric graph");
+  }
+  size_t segment_start = header_.SegmentStart(i);
+  if (i != 0 && i == segment_start) {
+    ZKR_RETURN_IF_ERROR(WriteSegment());
+  }
+
+  auto previous_list = [&](size_t ref) {
+    const std::vector<uint32_t> &list =
+        window_[(i - ref) % MaxNodesBackwards()];
+    return span<const uint32_t>(list.data(), list.size());
+  };
+  auto sketch_of = [&](size_t ref) -> const ListSketch & {
+    return state_->sketches[(i - ref) % MaxNodesBackwards()];
+  };
+  if (state_->candidates.UsesSketches(SearchNum())) {
+    state_->sketches[i % MaxNodesBackwards()].Compute(neighbours);
+  }
+  size_t reference = 0;
+  if (neighbours.size() != 0) {
+    CostEstimator &estimator = state_->estimator;
+    float cost = estimator.Cost(neighbours, i, 0, span<const uint32_t>(),
+                                /*allow_random_access=*/false);
+    size_t max_ref = std::min(SearchNum(), i - segment_start);
+    for (size_t ref : state_->candidates.Select(max_ref, sketch_of)) {
+      float c = estimator.Cost(neighbours, i, ref, previous_list(ref),
+                               /*allow_random_access=*/false);
+      if (c + 1e-6f < cost) {
+        reference = ref;
+        cost = c;
+      }
+    }
+  }
+  state_->tokenizer.Add(
+      i, segment_start, neighbours, reference,
+      reference == 0 ? span<const uint32_t>() : previous_list(reference),
+      &tokens_, header_.has_degree_section ? &degree_tokens_ : &tokens_);
+
+  window_[i % MaxNodesBackwards()].assign(neighbours.begin(),
+                                          neighbours.end());
+  num_edges_ += neighbours.size();
+  segment_hash_ += ListChecksum(i, neighbours);
+  next_node_++;
+  return true;
+}
+
+bool StreamingEncoder::Finish(size_t *checksum) {
+  if (next_node_ != header_.num_nodes) return ZKR_FAILURE("Missing lists");
+  ZKR_RETURN_IF_ERROR(WriteSegment());
+  if (header_.nodes_per_segment == 0) header_.segment_sizes.clear();
+  if (header_.nodes_per_segment != 0 || header_.has_degree_section ||
+      header_.has_segment_hashes) {
+    // Same size as the placeholder written by the constructor.
+    BitWriter writer;
+    WriteGraphHeader(header_, &writer);
+    std::vector<uint8_t> data = std::move(writer).GetData();
+    long end = ftell(out_);
+    if (fseek(out_, header_start_, SEEK_SET) != 0 ||
+        fwrite(data.data(), 1, data.size(), out_) != data.size() ||
+        fseek(out_, end, SEEK_SET) != 0) {
+      return ZKR_FAILURE("Write error");
+    }
+  }
+  if (fflush(out_) != 0) return ZKR_FAILURE("Write error");
+  fprintf(stderr, "Compressed %zu edges to %.2f BPE. Checksum: %lx\n",
+          num_edges_, 8.0 * num_bytes_ / num_edges_, checksum_);
+  if (checksum) *checksum = checksum_;
+  return true;
+}
+
+// Symbol costs are updated from the counts of the first pass every this many
+// nodes.
+constexpr size_t kRandomAccessNodesPerCostUpdate = size_t{1} << 16;
+// Coded lists are written to the temporary file in pieces of about this many
+// bits, so that the writer stays small.
+constexpr size_t kRandomAccessFlushBits = size_t{1} << 16;
+
+struct RandomAccessStreamingEncoder::State {
+  State(const std::vector<float> *symbol_cost, size_t degree_chunk_size)
+      : estimator(symbol_cost),
+        tokenizer(/*allow_random_access=*/true, degree_chunk_size),
+        candidates(absl::GetFlag(FLAGS_ref_candidates)),
+        sketches(MaxNodesBackwards()) {}
+  CostEstimator estimator;
+  ListTokenizer tokenizer;
+  ReferenceCandidates candidates;
+  // Sketches of the previous lists, indexed like `window_`.
+  std::vector<ListSketch> sketches;
+  // Created by StartSecondPass().
+  std::unique_ptr<HuffmanEncoder> huffman;
+};
+
+RandomAccessStreamingEncoder::RandomAccessStreamingEncoder(
+    size_t num_nodes, const EncodeOptions &options, FILE *out,
+    const std::string &temp_dir)
+    : out_(out),
+      temp_dir_(temp_dir),
+      window_(MaxNodesBackwards()),
+      chain_length_(MaxNodesBackwards()),
+      references_(num_nodes),
+      symbol_cost_(kNumContexts * kNumSymbols, 1.0f),
+      histograms_(kNumContexts),
+      state_(new State(&symbol_cost_, options.degree_chunk_size)) {
+  ZKR_ASSERT(options.allow_random_access);
+  ZKR_ASSERT(options.degree_chunk_size != 0 &&
+             options.degree_chunk_size <= kMaxDegreeChunkSize &&
+             (options.degree_chunk_size & (options.degree_chunk_size - 1)) ==
+                 0);
+  ZKR_ASSERT(options.max_chain_length <= kMaxChainLength);
+  header_.num_nodes = num_nodes;
+  header_.allow_random_access = true;
+  header_.degree_chunk_size = options.degree_chunk_size;
+  header_.max_chain_length = options.max_chain_length;
+  header_.integer_coder = IntegerCoder::GetParams();
+  header_.search_num = SearchNum();
+  header_.has_offset_index = absl::GetFlag(FLAGS_offset_index);
+  header_.has_segment_hashes = absl::GetFlag(FLAGS_segment_hashes);
+  if (header_.has_offset_index) positions_.resize(num_nodes);
+}
+
+RandomAccessStreamingEncoder::~RandomAccessStreamingEncoder() {
+  if (data_ != nullptr) fclose(data_);
+}
+
+bool RandomAccessStreamingEncoder::CheckList(
+    span<const uint32_t> neighbours) const {
+  if (next_node_ >= header_.num_nodes) return ZKR_FAILURE("Too many lists");
+  for (size_t j = 0; j < neighbours.size(); j++) {
+    if (neighbours[j] >= header_.num_nodes) {
+      return ZKR_FAILURE("Invalid neighbour");
+    }
+    if (j != 0 && neighbours[j] <= neighbours[j - 1]) {
+      return ZKR_FAILURE("Unsorted list");
+    }
+  }
+  return true;
+}
+
+bool RandomAccessStreamingEncoder::FlushData(bool all) {
+  size_t num_bits = writer_.NumBitsWritten();
+  std::vector<uint8_t> data = std::move(writer_).GetData();
+  size_t num_bytes = all ? data.size() : num_bits / 8;
+  if (fwrite(data.data(), 1, num_bytes, data_) != num_bytes) {
+    return ZKR_FAILURE("Write error");
+  }
+  data_bytes_ += num_bytes;
+  writer_ = BitWriter();
+  // Carry over the bits of the last, incomplete byte.
+  if (num_bytes != data.size() && num_bits % 8 != 0) {
+    writer_.Reserve(8);
+    writer_.Write(num_bits % 8, data[num_bytes] & ((1 << (num_bits % 8)) - 1));
+  }
+  return true;
+}
+
+bool RandomAccessStreamingEncoder::AddList(span<const uint32_t> neighbours) {
+  ZKR_RETURN_IF_ERROR(CheckList(neighbours));
+  size_t i = next_node_;
+  auto previous_list = [&](size_t ref) {
+    const std::vector<uint32_t> &list =
+        window_[(i - ref) % MaxNodesBackwards()];
+    return span<const uint32_t>(list.data(), list.size());
+  };
+  size_t reference = references_[i];
+  if (!second_pass_) {
+    auto sketch_of = [&](size_t ref) -> const ListSketch & {
+      return state_->sketches[(i - ref) % MaxNodesBackwards()];
+    };
+    if (state_->candidates.UsesSketches(SearchNum())) {
+      state_->sketches[i % MaxNodesBackwards()].Compute(neighbours);
+    }
+    if (neighbours.size() != 0) {
+      CostEstimator &estimator = state_->estimator;
+      float cost = estimator.Cost(neighbours, i, 0, span<const uint32_t>(),
+                                  /*allow_random_access=*/true);
+      size_t max_ref = std::min(SearchNum(), i);
+      for (size_t ref : state_->candidates.Select(max_ref, sketch_of)) {
+        if (chain_length_[(i - ref) % MaxNodesBackwards()] >=
+            header_.max_chain_length) {
+          continue;
+        }
+        float c = estimator.Cost(neighbours, i, ref, previous_list(ref),
+                                 /*allow_random_access=*/true);
+        if (c + 1e-6f < cost) {
+          reference = ref;
+          cost = c;
+        }
+      }
+    }
+    references_[i] = reference;
+    chain_length_[i % MaxNodesBackwards()] =
+        reference == 0
+            ? 0
+            : chain_length_[(i - reference) % MaxNodesBackwards()] + 1;
+  }
+  tokens_ = IntegerData();
+  state_->tokenizer.Add(
+      i, /*segment_start=*/0, neighbours, reference,
+      reference == 0 ? span<const uint32_t>() : previous_list(reference),
+      &tokens_, &tokens_);
+  if (!second_pass_) {
+    tokens_.Histograms(&histograms_);
+    if ((i + 1) % kRandomAccessNodesPerCostUpdate == 0) {
+      UpdateSymbolCosts(SymbolCounts(histograms_), &symbol_cost_);
+    }
+    num_edges_ += neighbours.size();
+    checksum_ += ListChecksum(i, neighbours);
+  } else {
+    if (header_.has_offset_index) {
+      positions_[i] = data_bytes_ * 8 + writer_.NumBitsWritten();
+    }
+    const HuffmanEncoder &huffman = *state_->huffman;
+    size_t num_bits = 0;
+    tokens_.ForEach([&](size_t ctx, size_t token, size_t nextrabits,
+                        size_t extrabits, size_t) {
+      num_bits += huffman.NumBits(ctx, token) + nextrabits;
+    });
+    writer_.Reserve(num_bits);
+    tokens_.ForEach([&](size_t ctx, size_t token, size_t nextrabits,
+                        size_t extrabits, size_t) {
+      huffman.Write(ctx, token, nextrabits, extrabits, &writer_);
+    });
+    if (writer_.NumBitsWritten() >= kRandomAccessFlushBits) {
+      ZKR_RETURN_IF_ERROR(FlushData(/*all=*/false));
+    }
+    second_pass_checksum_ += ListChecksum(i, neighbours);
+  }
+
+  window_[i % MaxNodesBackwards()].assign(neighbours.begin(),
+                                          neighbours.end());
+  next_node_++;
+  return true;
+}
+
+bool RandomAccessStreamingEncoder::StartSecondPass() {
+  if (second_pass_) return ZKR_FAILURE("Already in the second pass");
+  if (next_node_ != header_.num_nodes) return ZKR_FAILURE("Missing lists");
+  data_ = CreateTemporaryFile(temp_dir_);
+  if (data_ == nullptr) {
+    return ZKR_FAILURE("Could not create a temporary file");
+  }
+  state_->huffman.reset(new HuffmanEncoder(histograms_));
+  state_->huffman->WriteTables(&writer_);
+  state_->tokenizer =
+      ListTokenizer(/*allow_random_access=*/true, header_.degree_chunk_size);
+  second_pass_ = true;
+  next_node_ = 0;
+  return true;
+}
+
+bool RandomAccessStreamingEncoder::Finish(size_t *checksum) {
+  if (!second_pass_ || next_node_ != header_.num_nodes) {
+    return ZKR_FAILURE("Missing lists");
+  }
+  if (second_pass_checksum_ != checksum_) {
+    return ZKR_FAILURE("Lists changed between passes");
+  }
+  ZKR_RETURN_IF_ERROR(FlushData(/*all=*/true));
+  if (header_.has_segment_hashes) header_.segment_hashes = {checksum_};
+  BitWriter writer;
+  WriteGraphHeader(header_, &writer);
+  if (header_.has_offset_index) EncodeOffsetIndex(positions_, &writer);
+  std::vector<uint8_t> data = std::move(writer).GetData();
+  if (fwrite(data.data(), 1, data.size(), out_) != data.size() ||
+      fseek(data_, 0, SEEK_SET) != 0) {
+    return ZKR_FAILURE("Write error");
+  }
+  std::vector<uint8_t> buffer(1 << 16);
+  for (size_t copied = 0; copied < data_bytes_;) {
+    size_t size = std::min(buffer.size(), data_bytes_ - copied);
+    if (fread(buffer.data(), 1, size, data_) != size) {
+      return ZKR_FAILURE("Read error");
+    }
+    if (fwrite(buffer.data(), 1, size, out_) != size) {
+      return ZKR_FAILURE("Write error");
+    }
+    copied += size;
+  }
+  if (fflush(out_) != 0) return ZKR_FAILURE("Write error");
+  fprintf(stderr, "Compressed %zu edges to %.2f BPE. Checksum: %lx\n",
+          num_edges_, 8.0 * (data.size() + data_bytes_) / num_edges_,
+          checksum_);
+  if (checksum) *checksum = checksum_;
+  return true;
+}
+
 }  // namespace zuckerli
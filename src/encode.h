@@ -1,19 +1,193 @@
 #ifndef ZUCKERLI_ENCODE_H
 #define ZUCKERLI_ENCODE_H
+#include <stdio.h>
+
+#include <memory>
+#include <string>
 #include <vector>
 
 #include "absl/flags/declare.h"
 #include "absl/flags/flag.h"
+#include "bit_writer.h"
+#include "common.h"
+#include "context_model.h"
+#include "graph_header.h"
+#include "integer_coder.h"
 #include "uncompressed_graph.h"
 
 ABSL_DECLARE_FLAG(int32_t, num_rounds);
+ABSL_DECLARE_FLAG(int32_t, ref_candidates);
 ABSL_DECLARE_FLAG(bool, allow_random_access);
 ABSL_DECLARE_FLAG(bool, greedy_random_access);
+ABSL_DECLARE_FLAG(int32_t, max_chain_length);
+ABSL_DECLARE_FLAG(int32_t, degree_chunk_size);
+ABSL_DECLARE_FLAG(bool, offset_index);
+ABSL_DECLARE_FLAG(uint64_t, nodes_per_segment);
+ABSL_DECLARE_FLAG(int32_t, num_threads);
+ABSL_DECLARE_FLAG(bool, degree_section);
+ABSL_DECLARE_FLAG(bool, segment_hashes);
 
 namespace zuckerli {
+
+// Parameters chosen at encoding time that are recorded in the header (see
+// graph_header.h). The other parameters of the encoder are taken from the
+// flags.
+struct EncodeOptions {
+  bool allow_random_access = false;
+  // Random-access only: trade the latency of CompressedGraph for compression.
+  // A power of two, at most kMaxDegreeChunkSize.
+  size_t degree_chunk_size = kDegreeReferenceChunkSize;
+  // At most kMaxChainLength.
+  size_t max_chain_length = kDefaultMaxChainLength;
+
+  // Options given by --degree_chunk_size and --max_chain_length.
+  static EncodeOptions FromFlags(bool allow_random_access);
+};
+
+// Returns false, after printing the allowed range, if --degree_chunk_size or
+// --max_chain_length cannot be used by EncodeOptions::FromFlags().
+bool CheckEncodeOptionFlags();
+
+std::vector<uint8_t> EncodeGraph(const UncompressedGraph& g,
+                                 const EncodeOptions& options,
+                                 size_t* checksum = nullptr);
+
+// Same as above, with EncodeOptions::FromFlags(allow_random_access).
 std::vector<uint8_t> EncodeGraph(const UncompressedGraph& g,
                                  bool allow_random_access,
                                  size_t* checksum = nullptr);
-}
+
+// Segment size used when streaming by default: the segments of a
+// StreamingEncoder bound its memory use.
+constexpr size_t kDefaultStreamingNodesPerSegment = size_t{1} << 16;
+
+// Returns --nodes_per_segment, or kDefaultStreamingNodesPerSegment if it is 0.
+size_t StreamingNodesPerSegment();
+
+// Encodes a sequential graph from adjacency lists given in node order, without
+// holding the whole graph in memory: only the last MaxNodesBackwards() lists
+// and the tokens of the current segment are kept, and each segment is written
+// to the output as soon as it is complete. Memory use is thus proportional to
+// the number of edges of a segment. References are chosen greedily, with
+// symbol costs estimated on the previous segment. If `nodes_per_segment` is 0
+// or at least `num_nodes`, the whole graph is a single segment, which is only
+// written by Finish(): all its tokens are then held in memory.
+//
+// `out` must be seekable, as the sizes of the segments are written to the
+// header by Finish(). If `degree_section`, degrees are coded in their own
+// section, and if
+// `segment_hashes`, the checksum of each segment is stored, and if `symmetric`,
+// the graph is marked as symmetric, and lists must not contain neighbours
+// larger than their node (see graph_header.h).
+class StreamingEncoder {
+ public:
+  StreamingEncoder(size_t num_nodes, size_t nodes_per_segment, FILE* out,
+                   bool degree_section = false, bool segment_hashes = false,
+                   bool symmetric = false);
+  ~StreamingEncoder();
+
+  StreamingEncoder(const StreamingEncoder&) = delete;
+  StreamingEncoder& operator=(const StreamingEncoder&) = delete;
+
+  // Adds the neighbours of the next node, which must be sorted and without
+  // duplicates. Returns false on invalid lists or write errors.
+  bool AddList(span<const uint32_t> neighbours);
+
+  // Writes the last segment and the segment sizes. To be called after adding
+  // the lists of all the nodes.
+  bool Finish(size_t* checksum = nullptr);
+
+ private:
+  bool WriteSegment();
+
+  GraphHeader header_;
+  FILE* out_;
+  long header_start_;
+  size_t next_node_ = 0;
+  // Previous lists, indexed by node % MaxNodesBackwards().
+  std::vector<std::vector<uint32_t>> window_;
+  IntegerData tokens_;
+  IntegerData degree_tokens_;
+  std::vector<float> symbol_cost_;
+  size_t num_edges_ = 0;
+  size_t num_bytes_ = 0;
+  size_t checksum_ = 0;
+  // Checksum of the edges of the current segment.
+  uint64_t segment_hash_ = 0;
+  std::vector<double> bits_per_ctx_;
+  // Defined in encode.cc.
+  struct State;
+  std::unique_ptr<State> state_;
+};
+
+// Encodes a random-access graph from adjacency lists given in node order,
+// without holding the whole graph in memory, by going twice over the lists.
+// The first pass chooses references greedily, as with --greedy_random_access,
+// using symbol costs estimated on the lists seen so far, and counts the symbols
+// used. After StartSecondPass(), the same lists must be added again, and their
+// tokens are Huffman coded with tables built from these counts. As the header
+// and the offset index come before the lists, the coded lists go to a
+// temporary file in `temp_dir`, which Finish() then copies to `out`. Memory
+// use is that of the last MaxNodesBackwards() lists, plus a few bytes per node
+// for references and for the offset index.
+class RandomAccessStreamingEncoder {
+ public:
+  RandomAccessStreamingEncoder(size_t num_nodes, const EncodeOptions& options,
+                               FILE* out, const std::string& temp_dir);
+  ~RandomAccessStreamingEncoder();
+
+  RandomAccessStreamingEncoder(const RandomAccessStreamingEncoder&) = delete;
+  RandomAccessStreamingEncoder& operator=(const RandomAccessStreamingEncoder&) =
+      delete;
+
+  // Adds the neighbours of the next node, which must be sorted and without
+  // duplicates. Returns false on invalid lists or write errors.
+  bool AddList(span<const uint32_t> neighbours);
+
+  // Ends the first pass. To be called after adding the lists of all the nodes.
+  bool StartSecondPass();
+
+  // Writes the graph to `out`. To be called after adding the lists of all the
+  // nodes again; fails if they differ from the ones of the first pass.
+  bool Finish(size_t* checksum = nullptr);
+
+ private:
+  bool CheckList(span<const uint32_t> neighbours) const;
+  // Writes the whole bytes of `writer_` to the temporary file, or all of it
+  // if `all`.
+  bool FlushData(bool all);
+
+  GraphHeader header_;
+  FILE* out_;
+  std::string temp_dir_;
+  // Temporary file holding the data section, created by StartSecondPass().
+  FILE* data_ = nullptr;
+  size_t data_bytes_ = 0;
+  bool second_pass_ = false;
+  size_t next_node_ = 0;
+  // Previous lists, and the length of their chain of references, indexed by
+  // node % MaxNodesBackwards().
+  std::vector<std::vector<uint32_t>> window_;
+  std::vector<uint8_t> chain_length_;
+  // At most SearchNum() <= kMaxSearchNum.
+  std::vector<uint16_t> references_;
+  // Position of the first bit of each list in the data section.
+  std::vector<size_t> positions_;
+  std::vector<float> symbol_cost_;
+  // Symbol counts of the first pass, indexed by context and symbol.
+  std::vector<std::vector<size_t>> histograms_;
+  // Tokens of the current list.
+  IntegerData tokens_;
+  BitWriter writer_;
+  size_t num_edges_ = 0;
+  // Checksums of the lists of each pass.
+  size_t checksum_ = 0;
+  size_t second_pass_checksum_ = 0;
+  // Defined in encode.cc.
+  struct State;
+  std::unique_ptr<State> state_;
+};
+
+}  // namespace zuckerli
 
 #endif  // ZUCKERLI_ENCODE_H
@@ -1,12 +1,30 @@
 #include <string.h>
 
+#include <algorithm>
+#include <memory>
+
 #include "encode.h"
 #include "absl/flags/flag.h"
 #include "absl/flags/parse.h"
+#include "node_ordering.h"
 #include "uncompressed_graph.h"
 
 ABSL_FLAG(std::string, input_path, "", "Input file path");
 ABSL_FLAG(std::string, output_path, "", "Output file path");
+ABSL_FLAG(bool, streaming, false,
+          "Encode a sequential graph one list at a time, with greedy "
+          "reference selection, holding one segment in memory (see "
+          "--nodes_per_segment; 0 means 65536 nodes here)");
+ABSL_FLAG(bool, symmetric, false,
+          "The input graph is symmetric: store each undirected edge once, in "
+          "a sequential graph (implies --streaming). Fails if some edge of "
+          "the input has no reverse edge");
+ABSL_FLAG(std::string, ordering, "identity",
+          "Renumber the nodes before encoding: identity, bfs, degree or "
+          "shingle");
+ABSL_FLAG(std::string, permutation_path, "",
+          "Where to write the new id of each node, if --ordering renumbers "
+          "them (see node_ordering.h)");
 
 int main(int argc, char** argv) {
   absl::ParseCommandLine(argc, argv);
@@ -15,7 +33,72 @@ int main(int argc, char** argv) {
     fprintf(stderr, "Invalid output file %s\n", argv[2]);
   }
 
-  zuckerli::UncompressedGraph g(absl::GetFlag(FLAGS_input_path));
+  zuckerli::NodeOrdering ordering;
+  if (!zuckerli::ParseNodeOrdering(absl::GetFlag(FLAGS_ordering), &ordering)) {
+    fprintf(stderr, "Invalid ordering %s\n",
+            absl::GetFlag(FLAGS_ordering).c_str());
+    return 1;
+  }
+  if (!zuckerli::CheckEncodeOptionFlags()) return 1;
+  if (absl::GetFlag(FLAGS_num_threads) < 0) {
+    fprintf(stderr, "Invalid --num_threads %d: must be at least 0\n",
+            absl::GetFlag(FLAGS_num_threads));
+    return 1;
+  }
+
+  zuckerli::UncompressedGraph input(absl::GetFlag(FLAGS_input_path));
+  std::unique_ptr<zuckerli::UncompressedGraph> permuted;
+  if (ordering != zuckerli::NodeOrdering::kIdentity) {
+    zuckerli::NodePermutation permutation =
+        zuckerli::ComputeNodeOrdering(input, ordering);
+    if (absl::GetFlag(FLAGS_permutation_path).empty()) {
+      fprintf(stderr, "Warning: the original ids will not be recoverable\n");
+    } else {
+      ZKR_ASSERT(permutation.Write(absl::GetFlag(FLAGS_permutation_path)));
+    }
+    permuted.reset(new zuckerli::UncompressedGraph(
+        zuckerli::PermuteGraph(input, permutation.new_ids())));
+  }
+  const zuckerli::UncompressedGraph& g = permuted ? *permuted : input;
+  bool symmetric = absl::GetFlag(FLAGS_symmetric);
+  if (absl::GetFlag(FLAGS_streaming) || symmetric) {
+    if (absl::GetFlag(FLAGS_allow_random_access)) {
+      fprintf(stderr,
+              "--streaming and --symmetric only write sequential graphs, "
+              "which do not allow random access\n");
+      fclose(out);
+      return 1;
+    }
+    zuckerli::StreamingEncoder encoder(
+        g.size(), zuckerli::StreamingNodesPerSegment(), out,
+        absl::GetFlag(FLAGS_degree_section),
+        absl::GetFlag(FLAGS_segment_hashes), symmetric);
+    for (size_t i = 0; i < g.size(); i++) {
+      zuckerli::span<const uint32_t> list = g.Neighbours(i);
+      if (symmetric) {
+        // Only the neighbours up to i are stored, so the others must be
+        // implied by the reverse edges.
+        for (uint32_t j : list) {
+          zuckerli::span<const uint32_t> reverse = g.Neighbours(j);
+          if (!std::binary_search(reverse.begin(), reverse.end(), i)) {
+            fprintf(stderr,
+                    "The input is not symmetric: edge %zu -> %u has no "
+                    "reverse edge\n",
+                    i, j);
+            fclose(out);
+            return 1;
+          }
+        }
+        list = zuckerli::span<const uint32_t>(
+            list.data(), std::upper_bound(list.begin(), list.end(), i) -
+                             list.begin());
+      }
+      ZKR_ASSERT(encoder.AddList(list));
+    }
+    ZKR_ASSERT(encoder.Finish());
+    fclose(out);
+    return 0;
+  }
   auto data =
       zuckerli::EncodeGraph(g, absl::GetFlag(FLAGS_allow_random_access));
   fwrite(data.data(), 1, data.size(), out);
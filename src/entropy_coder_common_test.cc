@@ -14,7 +14,6 @@
 #include "bit_writer.h"
 #include "integer_coder.h"
 #include "gtest/gtest.h"
-#include "absl/flags/flag.h"
 
 namespace zuckerli {
 namespace {
@@ -25,28 +24,62 @@ struct ByteCoder {
   }
 };
 
-void TestIntegerCoder(int k, int h) {
-  absl::SetFlag(&FLAGS_log2_num_explicit, k);
-  absl::SetFlag(&FLAGS_num_token_bits, h);
+template <typename Coder>
+void TestIntegerCoder() {
   for (size_t i = 0; i < (1 << 14); i++) {
     BitWriter writer;
     writer.Reserve(256);
     size_t token, nbits, bits;
-    IntegerCoder::Encode(i, &token, &nbits, &bits);
+    Coder::Encode(i, &token, &nbits, &bits);
     writer.Write(8, token);
     writer.Write(nbits, bits);
     std::vector<uint8_t> data = std::move(writer).GetData();
     BitReader reader(data.data(), data.size());
     ByteCoder coder;
-    EXPECT_EQ(i, IntegerCoder::Read(0, &reader, &coder));
+    EXPECT_EQ(i, Coder::Read(0, &reader, &coder));
   }
 }
 
-TEST(IntegerCoderTest, Test00) { TestIntegerCoder(0, 0); }
-TEST(IntegerCoderTest, Test40) { TestIntegerCoder(4, 0); }
-TEST(IntegerCoderTest, Test41) { TestIntegerCoder(4, 1); }
-TEST(IntegerCoderTest, Test42) { TestIntegerCoder(4, 2); }
-TEST(IntegerCoderTest, Test43) { TestIntegerCoder(4, 3); }
-TEST(IntegerCoderTest, Test44) { TestIntegerCoder(4, 4); }
+TEST(IntegerCoderTest, Test00) {
+  TestIntegerCoder<FixedIntegerCoder<0, 0, 0>>();
+}
+
+TEST(IntegerCoderTest, Test40) {
+  TestIntegerCoder<FixedIntegerCoder<4, 0, 0>>();
+}
+
+TEST(IntegerCoderTest, Test41) {
+  TestIntegerCoder<FixedIntegerCoder<4, 1, 0>>();
+}
+
+TEST(IntegerCoderTest, Test42) {
+  TestIntegerCoder<FixedIntegerCoder<4, 2, 0>>();
+}
+
+TEST(IntegerCoderTest, Test43) {
+  TestIntegerCoder<FixedIntegerCoder<4, 3, 0>>();
+}
+
+TEST(IntegerCoderTest, Test44) {
+  TestIntegerCoder<FixedIntegerCoder<4, 4, 0>>();
+}
+
+TEST(IntegerCoderTest, Test421) {
+  TestIntegerCoder<FixedIntegerCoder<4, 2, 1>>();
+}
+
+TEST(IntegerCoderTest, TestDefault) { TestIntegerCoder<IntegerCoder>(); }
+
+TEST(IntegerCoderTest, TestDispatch) {
+  IntegerCoderParams params;
+  params.log2_num_explicit = 4;
+  params.num_token_msb = 1;
+  params.num_token_lsb = 0;
+  EXPECT_TRUE(WithIntegerCoder(params, [&](auto coder) {
+    return decltype(coder)::GetParams() == params;
+  }));
+  params.log2_num_explicit = 7;
+  EXPECT_FALSE(WithIntegerCoder(params, [](auto coder) { return true; }));
+}
 }  // namespace
 }  // namespace zuckerli
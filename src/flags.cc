@@ -5,11 +5,37 @@
 
 ABSL_FLAG(int32_t, log2_num_explicit, 4,
           "Number of direct-coded tokens (pow2)");
-ABSL_FLAG(int32_t, num_token_bits, 1, "Number of MSBs in token");
+ABSL_FLAG(int32_t, num_token_bits, 2, "Number of MSBs in token");
+ABSL_FLAG(int32_t, num_token_lsb, 1, "Number of LSBs in token");
 ABSL_FLAG(int32_t, ref_block, 32,
           "Number of previous lists to try to copy from");
+ABSL_FLAG(int32_t, ref_candidates, 0,
+          "Only compute the cost of using this many of the previous lists as a "
+          "reference, the ones whose neighbours are most similar according to "
+          "a sketch (0 to try all)");
 
 ABSL_FLAG(int32_t, num_rounds, 1, "Number of rounds for reference finding");
 ABSL_FLAG(bool, allow_random_access, false, "Allow random access");
 ABSL_FLAG(bool, greedy_random_access, false,
           "Greedy heuristic for random access");
+ABSL_FLAG(int32_t, max_chain_length, 3,
+          "Maximum length of the chains of references of random-access graphs "
+          "(at most 7); longer chains make random access slower");
+ABSL_FLAG(int32_t, degree_chunk_size, 32,
+          "Number of nodes of random-access graphs whose degrees and "
+          "references are delta-coded together (a power of two, at most "
+          "32768); larger chunks make random access slower");
+ABSL_FLAG(bool, offset_index, true,
+          "Store the position of each node in random-access files");
+ABSL_FLAG(uint64_t, nodes_per_segment, 0,
+          "Split sequential graphs in independently decodable segments of this "
+          "many nodes (0 for a single segment, or for segments of 65536 nodes "
+          "when streaming, to bound memory use)");
+ABSL_FLAG(int32_t, num_threads, 1,
+          "Number of threads to use (0 for one per hardware thread)");
+ABSL_FLAG(bool, degree_section, false,
+          "Code the degrees of sequential graphs in a separate section, so "
+          "that they can be decoded without the adjacency lists");
+ABSL_FLAG(bool, segment_hashes, false,
+          "Store the checksum of the edges of each segment (or of the whole "
+          "graph), which is then verified when decoding");
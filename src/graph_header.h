@@ -0,0 +1,307 @@
+// Copyright 2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#ifndef ZUCKERLI_GRAPH_HEADER_H
+#define ZUCKERLI_GRAPH_HEADER_H
+#include <stdint.h>
+#include <stdlib.h>
+
+#include <vector>
+
+#include "bit_reader.h"
+#include "bit_writer.h"
+#include "common.h"
+#include "context_model.h"
+#include "integer_coder.h"
+#include "offset_index.h"
+
+namespace zuckerli {
+
+// Layout of a compressed graph:
+// - the bytes "ZKR" and the format version, kGraphFormatVersion
+// - the header fields below, padded to a whole byte
+// - if the graph is split in segments, the size in bytes of each segment, as
+//   64-bit values
+// - if `has_degree_section`, the size in bytes of the degree section of each
+//   segment (of the whole graph if it is not split), as 64-bit values
+// - if `has_segment_hashes`, the checksum (see checksum.h) of the edges of each
+//   segment (of the whole graph if it is not split), as 64-bit values
+// - if `has_offset_index`, an offset index (see offset_index.h)
+// - the data section: entropy coding tables followed by the encoded graph.
+//   For graphs split in segments, this is the concatenation of segments, each
+//   with its own entropy coding tables.
+// Positions of nodes in the offset index are relative to the start of the data
+// section.
+//
+// Segments are only used by sequential (non random-access) graphs. Each
+// segment covers `nodes_per_segment` consecutive nodes (the last one possibly
+// fewer), and can be decoded on its own: the first node of a segment is coded
+// as if it was the first node of the graph, and no node uses a node of a
+// previous segment as a reference.
+//
+// `integer_coder` and `search_num` record the IntegerCoder parameters and the
+// maximum reference offset used by the encoder, which may be changed with
+// flags in ZKR_HONOR_FLAGS builds.
+//
+// Random-access graphs also record their granularity, chosen at encoding time:
+// degrees and reference offsets are delta-coded within chunks of
+// `degree_chunk_size` nodes, so decoding a list first decodes the degrees of
+// the previous nodes of its chunk, and following references to decode a list
+// never takes more than `max_chain_length` steps. Small values make random
+// access faster, and large ones make the graph smaller.
+//
+// If `has_degree_section`, each segment of a sequential graph starts with a
+// separately entropy-coded section that holds only the degree tokens (contexts
+// below kReferenceContextBase), followed by the rest of the tokens. Degrees
+// can then be decoded without decoding the adjacency lists.
+//
+// If `has_segment_hashes`, decoding a segment fails if the checksum of its
+// edges does not match the stored one.
+//
+// If `symmetric`, the graph is undirected and only stores each edge once: the
+// list of each node only contains the neighbours with an id that is not
+// larger than its own. Such graphs are always sequential. The functions of
+// decode.h report the stored edges; DecodeToUncompressedGraph and the
+// transposition in transpose.h reconstruct the full lists.
+//
+// Graphs with a different format version, including the ones written before
+// the version was stored, are rejected.
+static constexpr uint32_t kGraphMagic = 0x524B5A;  // "ZKR"
+static constexpr uint32_t kGraphFormatVersion = 2;
+
+struct GraphHeader {
+  size_t num_nodes = 0;
+  bool allow_random_access = false;
+  IntegerCoderParams integer_coder;
+  // At most kMaxSearchNum.
+  size_t search_num = 32;
+  // Only for random-access graphs. A power of two, at most
+  // kMaxDegreeChunkSize.
+  size_t degree_chunk_size = kDegreeReferenceChunkSize;
+  // Only for random-access graphs. At most kMaxChainLength.
+  size_t max_chain_length = kDefaultMaxChainLength;
+  bool has_offset_index = false;
+  // Only for sequential graphs.
+  bool has_degree_section = false;
+  // 0 if the graph is a single segment.
+  size_t nodes_per_segment = 0;
+  std::vector<size_t> segment_sizes;
+  // One per segment if `has_degree_section`, otherwise empty.
+  std::vector<size_t> degree_section_sizes;
+  bool has_segment_hashes = false;
+  // One per segment if `has_segment_hashes`, otherwise empty.
+  std::vector<uint64_t> segment_hashes;
+  // Only for sequential graphs.
+  bool symmetric = false;
+
+  // Byte positions of the sections; only set by ReadGraphHeader.
+  size_t offset_index_start = 0;
+  size_t data_start = 0;
+
+  size_t NumSegments() const {
+    if (nodes_per_segment == 0) return 1;
+    return DivCeil(num_nodes, nodes_per_segment);
+  }
+  // Whether `node_id` is the first node of a chunk of a random-access graph.
+  bool IsFirstInChunk(size_t node_id) const {
+    return (node_id & (degree_chunk_size - 1)) == 0;
+  }
+  // First node of the segment that contains `node_id`.
+  size_t SegmentStart(size_t node_id) const {
+    if (nodes_per_segment == 0) return 0;
+    return node_id - node_id % nodes_per_segment;
+  }
+};
+
+inline void WriteGraphHeader(const GraphHeader& header, BitWriter* writer) {
+  ZKR_ASSERT(header.nodes_per_segment == 0 || !header.allow_random_access);
+  ZKR_ASSERT(header.nodes_per_segment == 0 ||
+             header.segment_sizes.size() == header.NumSegments());
+  ZKR_ASSERT(!header.has_degree_section || !header.allow_random_access);
+  ZKR_ASSERT(!header.has_degree_section ||
+             header.degree_section_sizes.size() == header.NumSegments());
+  ZKR_ASSERT(!header.has_segment_hashes ||
+             header.segment_hashes.size() == header.NumSegments());
+  ZKR_ASSERT(!header.symmetric || !header.allow_random_access);
+  writer->Reserve(192 + header.segment_sizes.size() * 64 +
+                  header.degree_section_sizes.size() * 64 +
+                  header.segment_hashes.size() * 64);
+  writer->Write(24, kGraphMagic);
+  writer->Write(8, kGraphFormatVersion);
+  writer->Write(48, header.num_nodes);
+  writer->Write(1, header.allow_random_access);
+  ZKR_ASSERT(header.integer_coder.log2_num_explicit < 16 &&
+             header.integer_coder.num_token_msb < 16 &&
+             header.integer_coder.num_token_lsb < 16);
+  writer->Write(4, header.integer_coder.log2_num_explicit);
+  writer->Write(4, header.integer_coder.num_token_msb);
+  writer->Write(4, header.integer_coder.num_token_lsb);
+  ZKR_ASSERT(header.search_num <= kMaxSearchNum);
+  writer->Write(10, header.search_num);
+  if (header.allow_random_access) {
+    ZKR_ASSERT(header.degree_chunk_size <= kMaxDegreeChunkSize &&
+               (header.degree_chunk_size &
+                (header.degree_chunk_size - 1)) == 0);
+    ZKR_ASSERT(header.max_chain_length <= kMaxChainLength);
+    writer->Write(4, FloorLog2Nonzero(header.degree_chunk_size));
+    writer->Write(3, header.max_chain_length);
+  }
+  writer->Write(1, header.has_offset_index);
+  writer->Write(1, header.has_degree_section);
+  writer->Write(1, header.has_segment_hashes);
+  writer->Write(1, header.symmetric);
+  writer->Write(1, header.nodes_per_segment != 0);
+  if (header.nodes_per_segment != 0) {
+    writer->Write(48, header.nodes_per_segment);
+  }
+  writer->ZeroPad();
+  if (header.nodes_per_segment != 0) {
+    for (size_t size : header.segment_sizes) {
+      writer->Write(32, size & 0xFFFFFFFF);
+      writer->Write(32, size >> 32);
+    }
+  }
+  if (header.has_degree_section) {
+    for (size_t size : header.degree_section_sizes) {
+      writer->Write(32, size & 0xFFFFFFFF);
+      writer->Write(32, size >> 32);
+    }
+  }
+  if (header.has_segment_hashes) {
+    for (uint64_t hash : header.segment_hashes) {
+      writer->Write(32, hash & 0xFFFFFFFF);
+      writer->Write(32, hash >> 32);
+    }
+  }
+}
+
+inline bool ReadGraphHeader(const uint8_t* data, size_t size,
+                            GraphHeader* header) {
+  if (size < 4) return ZKR_FAILURE("Invalid header");
+  BitReader reader(data, size);
+  if (reader.ReadBits(24) != kGraphMagic) {
+    return ZKR_FAILURE("Not a compressed graph");
+  }
+  size_t version = reader.ReadBits(8);
+  if (version != kGraphFormatVersion) {
+    return ZKR_FAILURE("Unsupported format version %zu", version);
+  }
+  header->num_nodes = reader.ReadBits(48);
+  header->allow_random_access = reader.ReadBits(1);
+  header->integer_coder.log2_num_explicit = reader.ReadBits(4);
+  header->integer_coder.num_token_msb = reader.ReadBits(4);
+  header->integer_coder.num_token_lsb = reader.ReadBits(4);
+  header->search_num = reader.ReadBits(10);
+  if (header->search_num > kMaxSearchNum) {
+    return ZKR_FAILURE("Invalid search_num");
+  }
+  if (header->allow_random_access) {
+    header->degree_chunk_size = size_t{1} << reader.ReadBits(4);
+    header->max_chain_length = reader.ReadBits(3);
+  } else {
+    header->degree_chunk_size = kDegreeReferenceChunkSize;
+    header->max_chain_length = kDefaultMaxChainLength;
+  }
+  header->has_offset_index = reader.ReadBits(1);
+  header->has_degree_section = reader.ReadBits(1);
+  if (header->allow_random_access && header->has_degree_section) {
+    return ZKR_FAILURE("Degree section with random access");
+  }
+  header->has_segment_hashes = reader.ReadBits(1);
+  header->symmetric = reader.ReadBits(1);
+  if (header->allow_random_access && header->symmetric) {
+    return ZKR_FAILURE("Symmetric graph with random access");
+  }
+  bool has_segments = reader.ReadBits(1);
+  header->nodes_per_segment = has_segments ? reader.ReadBits(48) : 0;
+  size_t pos = DivCeil(reader.NumBitsRead(), 8);
+  if (pos > size) return ZKR_FAILURE("Invalid header");
+  header->segment_sizes.clear();
+  if (has_segments) {
+    if (header->allow_random_access) {
+      return ZKR_FAILURE("Segments with random access");
+    }
+    if (header->nodes_per_segment == 0) {
+      return ZKR_FAILURE("Invalid segment size");
+    }
+    size_t num_segments = header->NumSegments();
+    if (num_segments > (size - pos) / sizeof(uint64_t)) {
+      return ZKR_FAILURE("Invalid segment directory");
+    }
+    BitReader directory_reader(data + pos, num_segments * sizeof(uint64_t));
+    for (size_t i = 0; i < num_segments; i++) {
+      size_t segment_size = directory_reader.ReadBits(32);
+      segment_size |= directory_reader.ReadBits(32) << 32;
+      header->segment_sizes.push_back(segment_size);
+    }
+    pos += num_segments * sizeof(uint64_t);
+  }
+  header->degree_section_sizes.clear();
+  if (header->has_degree_section) {
+    size_t num_segments = header->NumSegments();
+    if (num_segments > (size - pos) / sizeof(uint64_t)) {
+      return ZKR_FAILURE("Invalid degree section directory");
+    }
+    BitReader directory_reader(data + pos, num_segments * sizeof(uint64_t));
+    for (size_t i = 0; i < num_segments; i++) {
+      size_t section_size = directory_reader.ReadBits(32);
+      section_size |= directory_reader.ReadBits(32) << 32;
+      header->degree_section_sizes.push_back(section_size);
+    }
+    pos += num_segments * sizeof(uint64_t);
+  }
+  header->segment_hashes.clear();
+  if (header->has_segment_hashes) {
+    size_t num_segments = header->NumSegments();
+    if (num_segments > (size - pos) / sizeof(uint64_t)) {
+      return ZKR_FAILURE("Invalid segment hashes");
+    }
+    BitReader hash_reader(data + pos, num_segments * sizeof(uint64_t));
+    for (size_t i = 0; i < num_segments; i++) {
+      uint64_t hash = hash_reader.ReadBits(32);
+      hash |= hash_reader.ReadBits(32) << 32;
+      header->segment_hashes.push_back(hash);
+    }
+    pos += num_segments * sizeof(uint64_t);
+  }
+  header->offset_index_start = pos;
+  if (header->has_offset_index) {
+    if (!header->allow_random_access) {
+      return ZKR_FAILURE("Offset index without random access");
+    }
+    if (pos >= size) return ZKR_FAILURE("Invalid offset index");
+    pos += OffsetIndex::EncodedSize(header->num_nodes, data[pos]);
+    if (pos > size) return ZKR_FAILURE("Invalid offset index");
+  }
+  header->data_start = pos;
+  if (has_segments) {
+    for (size_t segment_size : header->segment_sizes) {
+      if (segment_size > size - pos) {
+        return ZKR_FAILURE("Invalid segment directory");
+      }
+      pos += segment_size;
+    }
+  } else {
+    header->segment_sizes.assign(1, size - pos);
+  }
+  for (size_t i = 0; i < header->degree_section_sizes.size(); i++) {
+    if (header->degree_section_sizes[i] > header->segment_sizes[i]) {
+      return ZKR_FAILURE("Invalid degree section directory");
+    }
+  }
+  return true;
+}
+
+}  // namespace zuckerli
+
+#endif  // ZUCKERLI_GRAPH_HEADER_H
@@ -198,6 +198,36 @@ void ComputeSymbolNumBits(const std::vector<size_t>& histogram,
 
 }  // namespace
 
+HuffmanEncoder::HuffmanEncoder(
+    const std::vector<std::vector<size_t>>& histograms)
+    : num_contexts_(histograms.size()),
+      nbits_(histograms.size() * kNumSymbols),
+      bits_(histograms.size() * kNumSymbols) {
+  ZKR_ASSERT(num_contexts_ <= kMaxNumContexts);
+  for (size_t i = 0; i < num_contexts_; i++) {
+    HuffmanSymbolInfo info[kNumSymbols] = {};
+    ComputeSymbolNumBits(histograms[i], &info[0]);
+    ZKR_ASSERT(ComputeSymbolBits(&info[0]));
+    for (size_t s = 0; s < kNumSymbols; s++) {
+      if (!info[s].present) continue;
+      nbits_[i * kNumSymbols + s] = info[s].nbits;
+      bits_[i * kNumSymbols + s] = info[s].bits;
+    }
+  }
+}
+
+void HuffmanEncoder::WriteTables(BitWriter* writer) const {
+  writer->Reserve(num_contexts_ * kNumSymbols * 4);
+  for (size_t i = 0; i < num_contexts_; i++) {
+    HuffmanSymbolInfo info[kNumSymbols] = {};
+    for (size_t s = 0; s < kNumSymbols; s++) {
+      info[s].present = nbits_[i * kNumSymbols + s] != 0;
+      info[s].nbits = nbits_[i * kNumSymbols + s];
+    }
+    EncodeSymbolNBits(&info[0], writer);
+  }
+}
+
 std::vector<size_t> HuffmanEncode(
     const IntegerData& integers, size_t num_contexts, BitWriter* writer,
     const std::vector<size_t>& node_degree_indices,
@@ -211,21 +241,16 @@ std::vector<size_t> HuffmanEncode(
   std::vector<std::vector<size_t>> histograms;
   histograms.resize(num_contexts);
   integers.Histograms(&histograms);
+  ZKR_ASSERT(histograms.size() == num_contexts);
 
-  writer->Reserve(num_contexts * kNumSymbols * 4);
   bits_per_ctx->resize(num_contexts);
   if (extra_bits_per_ctx) {
     extra_bits_per_ctx->resize(num_contexts);
   }
 
   // Compute and encode symbol length and bits for each symbol.
-  ZKR_ASSERT(histograms.size() == num_contexts);
-  HuffmanSymbolInfo info[kMaxNumContexts][kNumSymbols] = {};
-  for (size_t i = 0; i < histograms.size(); i++) {
-    ComputeSymbolNumBits(histograms[i], &info[i][0]);
-    ZKR_ASSERT(ComputeSymbolBits(&info[i][0]));
-    EncodeSymbolNBits(&info[i][0], writer);
-  }
+  HuffmanEncoder encoder(histograms);
+  encoder.WriteTables(writer);
 
   // Pre-compute the number of bits needed.
   size_t nbits_histo = writer->NumBitsWritten();
@@ -238,7 +263,7 @@ std::vector<size_t> HuffmanEncode(
       node_degree_bit_pos.push_back(total_nbits + nbits_histo);
       ++current_node;
     }
-    total_nbits += info[ctx][token].nbits;
+    total_nbits += encoder.NumBits(ctx, token);
     total_nbits += nextrabits;
   });
 
@@ -247,9 +272,8 @@ std::vector<size_t> HuffmanEncode(
   // Encode the actual data.
   integers.ForEach([&](size_t ctx, size_t token, size_t nextrabits,
                        size_t extrabits, size_t i) {
-    writer->Write(info[ctx][token].nbits, info[ctx][token].bits);
-    writer->Write(nextrabits, extrabits);
-    (*bits_per_ctx)[ctx] += nextrabits + info[ctx][token].nbits;
+    encoder.Write(ctx, token, nextrabits, extrabits, writer);
+    (*bits_per_ctx)[ctx] += nextrabits + encoder.NumBits(ctx, token);
     if (extra_bits_per_ctx) {
       (*extra_bits_per_ctx)[ctx] += nextrabits;
     }
@@ -269,7 +293,7 @@ bool HuffmanReader::Init(size_t num_contexts, BitReader* ZKR_RESTRICT br) {
   return true;
 }
 
-size_t HuffmanReader::Read(size_t ctx, BitReader* ZKR_RESTRICT br) {
+size_t HuffmanReader::Read(size_t ctx, BitReader* ZKR_RESTRICT br) const {
   const uint32_t bits = br->PeekBits(kMaxHuffmanBits);
   br->Advance(info_[ctx][bits].nbits);
   return info_[ctx][bits].symbol;
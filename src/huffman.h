@@ -15,7 +15,9 @@
 #define ZUCKERLI_HUFFMAN_H
 
 #include <cstddef>
+#include <vector>
 
+#include "bit_reader.h"
 #include "bit_writer.h"
 #include "integer_coder.h"
 
@@ -28,6 +30,74 @@ struct HuffmanDecoderInfo {
   uint8_t symbol;
 };
 
+// Number of bits looked up at once in multi-symbol tables.
+static constexpr size_t kMultiSymbolBits = 11;
+static constexpr size_t kMaxSymbolsPerLookup = 3;
+
+// Up to kMaxSymbolsPerLookup consecutive symbols decoded by a single lookup in
+// a multi-symbol table. All symbols but the first one are below 16.
+class HuffmanSymbols {
+ public:
+  HuffmanSymbols() = default;
+  explicit HuffmanSymbols(uint32_t packed) : packed_(packed) {}
+
+  ZKR_INLINE size_t count() const { return packed_ & 3; }
+  ZKR_INLINE size_t symbol(size_t i) const {
+    return i == 0 ? (packed_ >> 14) & 0xFF : (packed_ >> (18 + 4 * i)) & 0xF;
+  }
+  // Number of bits used by symbols 0 to i.
+  ZKR_INLINE size_t nbits(size_t i) const {
+    return (packed_ >> (2 + 4 * i)) & 0xF;
+  }
+
+  uint32_t packed() const { return packed_; }
+
+  // Returns the symbols with `symbol`, using `nbits` bits in total, appended.
+  HuffmanSymbols Append(size_t symbol, size_t nbits) const {
+    size_t i = count();
+    uint32_t packed = packed_ + 1;
+    packed |= nbits << (2 + 4 * i);
+    packed |= symbol << (i == 0 ? 14 : 18 + 4 * i);
+    return HuffmanSymbols(packed);
+  }
+
+ private:
+  // Bits 0-1: count, 2-13: nbits, 14-21: first symbol, 22-29: other symbols.
+  uint32_t packed_ = 0;
+};
+
+// Huffman codes of the symbols of each context, computed from their number of
+// occurrences. Allows coding integers with the same tables in several pieces.
+class HuffmanEncoder {
+ public:
+  // `histograms[ctx][symbol]` is the number of occurrences of `symbol` in
+  // context `ctx`; symbols that do not occur get no code.
+  explicit HuffmanEncoder(const std::vector<std::vector<size_t>>& histograms);
+
+  // Writes the tables of all the contexts, as read by HuffmanReader::Init.
+  void WriteTables(BitWriter* writer) const;
+
+  // Number of bits of the code of `token` in context `ctx`.
+  size_t NumBits(size_t ctx, size_t token) const {
+    return nbits_[ctx * kNumSymbols + token];
+  }
+
+  // Writes `token`, followed by `nextrabits` extra bits. `writer` must have
+  // been reserved enough space.
+  void Write(size_t ctx, size_t token, size_t nextrabits, size_t extrabits,
+             BitWriter* writer) const {
+    writer->Write(nbits_[ctx * kNumSymbols + token],
+                  bits_[ctx * kNumSymbols + token]);
+    writer->Write(nextrabits, extrabits);
+  }
+
+ private:
+  size_t num_contexts_;
+  // Indexed by ctx * kNumSymbols + symbol; `nbits_` is 0 for absent symbols.
+  std::vector<uint8_t> nbits_;
+  std::vector<uint8_t> bits_;
+};
+
 // Encodes the given sequence of integers into a BitWriter. The context id
 // for each integer must be in the range [0, num_contexts).
 // Returns a vector of sorted indices of bits where nodes start.
@@ -46,18 +116,70 @@ class HuffmanReader {
 
   // Decodes a single symbol from the bitstream, using distribution of index
   // `ctx`.
-  size_t Read(size_t ctx, BitReader* ZKR_RESTRICT br);
+  size_t Read(size_t ctx, BitReader* ZKR_RESTRICT br) const;
 
   // For interface compatibilty with ANS reader.
   bool CheckFinalState() const { return true; }
 
+  // Builds tables that decode several consecutive symbols with a single
+  // lookup, for the contexts in [begin, end). `next_context(ctx, symbol)`
+  // returns the context of the symbol that follows `symbol` in context `ctx`,
+  // or a context outside of [begin, end) if it is not known or if decoding
+  // should stop after `symbol`.
+  template <typename NextContext>
+  void BuildMultiSymbolTables(size_t begin, size_t end,
+                              const NextContext& next_context);
+
+  // Returns the symbols at the start of `br`, starting with a symbol in
+  // context `ctx`, without consuming them. `br` must have been refilled, and
+  // the multi-symbol tables built for `ctx`.
+  ZKR_INLINE HuffmanSymbols PeekSymbols(size_t ctx,
+                                        BitReader* ZKR_RESTRICT br) const {
+    return HuffmanSymbols(
+        multi_symbol_info_[((ctx - multi_symbol_begin_) << kMultiSymbolBits) |
+                           br->PeekBits(kMultiSymbolBits)]);
+  }
+
  private:
   // For each context, maps the next kMaxHuffmanBits in the bitstream into a
   // symbol and the number of bits that should actually be consumed from the
   // bitstream.
   HuffmanDecoderInfo info_[kMaxNumContexts][1 << kMaxHuffmanBits];
+  // Packed HuffmanSymbols for each context in the multi-symbol range, and each
+  // value of the next kMultiSymbolBits in the bitstream.
+  std::vector<uint32_t> multi_symbol_info_;
+  size_t multi_symbol_begin_ = 0;
 };
 
+template <typename NextContext>
+void HuffmanReader::BuildMultiSymbolTables(size_t begin, size_t end,
+                                           const NextContext& next_context) {
+  ZKR_ASSERT(begin <= end && end <= kMaxNumContexts);
+  multi_symbol_begin_ = begin;
+  multi_symbol_info_.resize((end - begin) << kMultiSymbolBits);
+  for (size_t ctx = begin; ctx < end; ctx++) {
+    for (size_t bits = 0; bits < (1 << kMultiSymbolBits); bits++) {
+      HuffmanSymbols symbols;
+      size_t nbits = 0;
+      size_t symbol_ctx = ctx;
+      while (symbols.count() < kMaxSymbolsPerLookup) {
+        // Bits after the first kMultiSymbolBits are unknown (zero here), so
+        // only symbols whose code fits in the known bits are decoded.
+        const HuffmanDecoderInfo& info =
+            info_[symbol_ctx][(bits >> nbits) & ((1 << kMaxHuffmanBits) - 1)];
+        if (nbits + info.nbits > kMultiSymbolBits) break;
+        if (symbols.count() != 0 && info.symbol >= 16) break;
+        nbits += info.nbits;
+        symbols = symbols.Append(info.symbol, nbits);
+        symbol_ctx = next_context(symbol_ctx, info.symbol);
+        if (symbol_ctx < begin || symbol_ctx >= end) break;
+      }
+      multi_symbol_info_[((ctx - begin) << kMultiSymbolBits) | bits] =
+          symbols.packed();
+    }
+  }
+}
+
 };  // namespace zuckerli
 
 #endif  // ZUCKERLI_HUFFMAN_H
@@ -56,5 +56,56 @@ TEST(HuffmanTest, TestRoundtrip) {
   }
 }
 
+TEST(HuffmanTest, TestMultiSymbol) {
+  constexpr size_t kNumIntegers = 1 << 16;
+  constexpr size_t kNumContexts = 4;
+
+  // Small values, where the context of each value is given by the previous
+  // one; values above 3 end a chain and are followed by a value in context 0.
+  const auto next_context = [](size_t ctx, size_t symbol) {
+    return symbol < kNumContexts ? symbol : kNumContexts;
+  };
+  IntegerData data;
+  std::mt19937 rng;
+  std::geometric_distribution<uint32_t> dist(0.4);
+  size_t ctx = 0;
+  for (size_t i = 0; i < kNumIntegers; i++) {
+    uint32_t value = std::min<uint32_t>(dist(rng), 40);
+    data.Add(ctx, value);
+    ctx = next_context(ctx, value) % kNumContexts;
+  }
+
+  BitWriter writer;
+  std::vector<double> unused_bits_per_ctx;
+  HuffmanEncode(data, kNumContexts, &writer, {}, &unused_bits_per_ctx);
+
+  std::vector<uint8_t> encoded = std::move(writer).GetData();
+  BitReader reader(encoded.data(), encoded.size());
+  HuffmanReader symbol_reader;
+  ASSERT_TRUE(symbol_reader.Init(kNumContexts, &reader));
+  symbol_reader.BuildMultiSymbolTables(0, kNumContexts, next_context);
+
+  size_t num_lookups = 0;
+  for (size_t i = 0; i < kNumIntegers;) {
+    reader.Refill();
+    HuffmanSymbols symbols =
+        symbol_reader.PeekSymbols(data.Context(i), &reader);
+    ASSERT_GT(symbols.count(), 0);
+    num_lookups++;
+    size_t nbits = 0;
+    for (size_t j = 0; j < symbols.count() && i < kNumIntegers; j++, i++) {
+      reader.Advance(symbols.nbits(j) - nbits);
+      nbits = symbols.nbits(j);
+      EXPECT_EQ(IntegerCoder::DecodeToken(symbols.symbol(j), &reader),
+                data.Value(i));
+      // Raw bits of large values end the lookup.
+      if (symbols.symbol(j) >= 16) {
+        ASSERT_EQ(j + 1, symbols.count());
+      }
+    }
+  }
+  EXPECT_LT(num_lookups, kNumIntegers / 2);
+}
+
 }  // namespace
 }  // namespace zuckerli
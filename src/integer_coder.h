@@ -25,6 +25,7 @@
 
 ABSL_DECLARE_FLAG(int32_t, log2_num_explicit);
 ABSL_DECLARE_FLAG(int32_t, num_token_bits);
+ABSL_DECLARE_FLAG(int32_t, num_token_lsb);
 
 namespace zuckerli {
 
@@ -35,32 +36,66 @@ static constexpr size_t kNumSymbols = 1 << kLogNumSymbols;
 // Only context ids smaller than this value are supported.
 static constexpr size_t kMaxNumContexts = 256;
 
-// Variable integer encoding scheme that puts bits either in an entropy-coded
-// symbol or as raw bits, depending on the specified configuration.
-// TODO: The behavior of IntegerCoder<0, 0> is a bit weird - both 0
-// and 1 get their own symbol.
-class IntegerCoder {
- public:
+// Parameters of an IntegerCoder, as stored in the graph header.
+struct IntegerCoderParams {
+  size_t log2_num_explicit = 4;
+  size_t num_token_msb = 2;
+  size_t num_token_lsb = 1;
+
+  bool operator==(const IntegerCoderParams &other) const {
+    return log2_num_explicit == other.log2_num_explicit &&
+           num_token_msb == other.num_token_msb &&
+           num_token_lsb == other.num_token_lsb;
+  }
+  bool operator!=(const IntegerCoderParams &other) const {
+    return !(*this == other);
+  }
+};
+
+// Compile-time parameters for IntegerCoderImpl.
+template <size_t kLog2NumExplicit, size_t kNumTokenMSB, size_t kNumTokenLSB>
+struct FixedIntegerCoderParams {
+  static_assert(kLog2NumExplicit >= kNumTokenMSB + kNumTokenLSB,
+                "Invalid integer coder parameters");
+  static constexpr ZKR_INLINE size_t Log2NumExplicit() {
+    return kLog2NumExplicit;
+  }
+  static constexpr ZKR_INLINE size_t NumTokenMSB() { return kNumTokenMSB; }
+  static constexpr ZKR_INLINE size_t NumTokenLSB() { return kNumTokenLSB; }
+};
+
+// Parameters read from the command line flags on every call, for
+// experimenting with them.
+struct FlagIntegerCoderParams {
   static ZKR_INLINE size_t Log2NumExplicit() {
-#if ZKR_HONOR_FLAGS
     return absl::GetFlag(FLAGS_log2_num_explicit);
-#else
-    return 4;
-#endif
   }
   static ZKR_INLINE size_t NumTokenMSB() {
-#if ZKR_HONOR_FLAGS
     return absl::GetFlag(FLAGS_num_token_bits);
-#else
-    return 2;
-#endif
   }
   static ZKR_INLINE size_t NumTokenLSB() {
-#if ZKR_HONOR_FLAGS
     return absl::GetFlag(FLAGS_num_token_lsb);
-#else
-    return 1;
-#endif
+  }
+};
+
+// Variable integer encoding scheme that puts bits either in an entropy-coded
+// symbol or as raw bits, depending on the specified configuration.
+// TODO: The behavior of IntegerCoder<0, 0> is a bit weird - both 0
+// and 1 get their own symbol.
+template <typename Params>
+class IntegerCoderImpl {
+ public:
+  static ZKR_INLINE size_t Log2NumExplicit() {
+    return Params::Log2NumExplicit();
+  }
+  static ZKR_INLINE size_t NumTokenMSB() { return Params::NumTokenMSB(); }
+  static ZKR_INLINE size_t NumTokenLSB() { return Params::NumTokenLSB(); }
+  static IntegerCoderParams GetParams() {
+    IntegerCoderParams params;
+    params.log2_num_explicit = Log2NumExplicit();
+    params.num_token_msb = NumTokenMSB();
+    params.num_token_lsb = NumTokenLSB();
+    return params;
   }
   static ZKR_INLINE void Encode(uint64_t value, size_t *ZKR_RESTRICT token,
                                 size_t *ZKR_RESTRICT nbits,
@@ -88,12 +123,17 @@ class IntegerCoder {
   template <typename EntropyCoder>
   static ZKR_INLINE size_t Read(size_t ctx, BitReader *ZKR_RESTRICT reader,
                                 EntropyCoder *ZKR_RESTRICT entropy_coder) {
+    reader->Refill();
+    return DecodeToken(entropy_coder->Read(ctx, reader), reader);
+  }
+  // Returns the value corresponding to `token`, reading its raw bits from
+  // `reader`.
+  static ZKR_INLINE size_t DecodeToken(size_t token,
+                                       BitReader *ZKR_RESTRICT reader) {
     uint32_t split_exponent = Log2NumExplicit();
     uint32_t split_token = 1 << split_exponent;
     uint32_t msb_in_token = NumTokenMSB();
     uint32_t lsb_in_token = NumTokenLSB();
-    reader->Refill();
-    size_t token = entropy_coder->Read(ctx, reader);
     if (token < split_token) return token;
     uint32_t nbits = split_exponent - (msb_in_token + lsb_in_token) +
                      ((token - split_token) >> (msb_in_token + lsb_in_token));
@@ -123,9 +163,48 @@ class IntegerCoder {
   }
 };
 
+template <size_t kLog2NumExplicit, size_t kNumTokenMSB, size_t kNumTokenLSB>
+using FixedIntegerCoder = IntegerCoderImpl<
+    FixedIntegerCoderParams<kLog2NumExplicit, kNumTokenMSB, kNumTokenLSB>>;
+
+// The coder used by the encoder. Unless ZKR_HONOR_FLAGS is set, its parameters
+// are compile-time constants.
+#if ZKR_HONOR_FLAGS
+using IntegerCoder = IntegerCoderImpl<FlagIntegerCoderParams>;
+#else
+using IntegerCoder = FixedIntegerCoder<4, 2, 1>;
+#endif
+
+// Calls `func(Coder())`, where Coder is an IntegerCoderImpl type with the given
+// parameters, and returns its result. Only common configurations (and, with
+// ZKR_HONOR_FLAGS, the one of the flags) are instantiated; returns false for
+// the others.
+template <typename Func>
+bool WithIntegerCoder(const IntegerCoderParams &params, const Func &func) {
+  if (params == FixedIntegerCoder<4, 2, 1>::GetParams()) {
+    return func(FixedIntegerCoder<4, 2, 1>());
+  }
+  if (params == FixedIntegerCoder<4, 1, 1>::GetParams()) {
+    return func(FixedIntegerCoder<4, 1, 1>());
+  }
+  if (params == FixedIntegerCoder<4, 2, 0>::GetParams()) {
+    return func(FixedIntegerCoder<4, 2, 0>());
+  }
+  if (params == FixedIntegerCoder<4, 1, 0>::GetParams()) {
+    return func(FixedIntegerCoder<4, 1, 0>());
+  }
+  if (params == FixedIntegerCoder<5, 2, 1>::GetParams()) {
+    return func(FixedIntegerCoder<5, 2, 1>());
+  }
+#if ZKR_HONOR_FLAGS
+  if (params == IntegerCoder::GetParams()) return func(IntegerCoder());
+#endif
+  return ZKR_FAILURE("Unsupported integer coder parameters");
+}
+
 class IntegerData {
  public:
-  size_t Size() {
+  size_t Size() const {
     ZKR_ASSERT(ctxs_.size() == values_.size());
     return values_.size();
   }
@@ -0,0 +1,105 @@
+// Copyright 2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#ifndef ZUCKERLI_LIST_WINDOW_H
+#define ZUCKERLI_LIST_WINDOW_H
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <vector>
+
+#include "common.h"
+
+namespace zuckerli {
+
+// Adjacency lists of the last `window` nodes decoded in order, stored one
+// after the other in a single arena. Slots are indexed by node modulo a power
+// of two, and the arena is compacted (and only grown if needed) when it is
+// full, so that the memory used by previous lists is reused once they are out
+// of the window.
+class ListWindow {
+ public:
+  explicit ListWindow(size_t window) : window_(window) {
+    ZKR_ASSERT(window > 0);
+    size_t num_slots = 1;
+    while (num_slots < window) num_slots *= 2;
+    slots_.resize(num_slots);
+    mask_ = num_slots - 1;
+  }
+
+  // Starts the list of `node`, which must be the node after the one of the
+  // previous call, and will have exactly `size` elements. Lists of nodes before
+  // node - window + 1 may be discarded. Afterwards, List() remains valid until
+  // the next call.
+  ZKR_INLINE void StartList(size_t node, size_t size) {
+    if (end_ + size > arena_.size()) MakeRoom(node, size);
+    Slot& slot = slots_[node & mask_];
+    slot.begin = end_;
+    slot.size = size;
+    limit_ = end_ + size;
+  }
+
+  // Appends `value` to the list that was last started.
+  ZKR_INLINE void Append(uint32_t value) {
+    ZKR_DASSERT(end_ < limit_);
+    arena_[end_++] = value;
+  }
+
+  // Returns the list of `node`, which must be one of the last `window` nodes.
+  ZKR_INLINE span<const uint32_t> List(size_t node) const {
+    const Slot& slot = slots_[node & mask_];
+    return span<const uint32_t>(arena_.data() + slot.begin, slot.size);
+  }
+
+ private:
+  struct Slot {
+    size_t begin = 0;
+    size_t size = 0;
+  };
+
+  // Moves the lists of the previous window - 1 nodes to the start of the
+  // arena, growing it if this does not leave room for `size` more values.
+  void MakeRoom(size_t node, size_t size) {
+    size_t first = node - std::min(node, window_ - 1);
+    size_t live_begin = first == node ? end_ : slots_[first & mask_].begin;
+    size_t live_size = end_ - live_begin;
+    if (live_begin != 0) {
+      memmove(arena_.data(), arena_.data() + live_begin,
+              live_size * sizeof(uint32_t));
+      for (size_t i = first; i < node; i++) {
+        slots_[i & mask_].begin -= live_begin;
+      }
+    }
+    end_ = live_size;
+    // At least twice the live data, so that compactions copy O(1) values per
+    // appended value on average.
+    if (2 * (live_size + size) > arena_.size()) {
+      arena_.resize(2 * (live_size + size));
+    }
+  }
+
+  size_t window_;
+  size_t mask_;
+  std::vector<Slot> slots_;
+  std::vector<uint32_t> arena_;
+  // End of the values in the arena.
+  size_t end_ = 0;
+  // End of the list that was last started.
+  size_t limit_ = 0;
+};
+
+}  // namespace zuckerli
+
+#endif  // ZUCKERLI_LIST_WINDOW_H
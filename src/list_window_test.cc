@@ -0,0 +1,58 @@
+// Copyright 2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#include "list_window.h"
+
+#include <random>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+namespace zuckerli {
+namespace {
+
+void TestListWindow(size_t window, size_t first_node) {
+  std::mt19937 rng(window);
+  ListWindow list_window(window);
+  std::vector<std::vector<uint32_t>> lists;
+  for (size_t i = 0; i < 5000; i++) {
+    size_t node = first_node + i;
+    // Mostly short lists, with a few long ones that force the arena to grow.
+    size_t size = rng() % 64 == 0 ? rng() % 5000 : rng() % 20;
+    list_window.StartList(node, size);
+    lists.emplace_back();
+    for (size_t j = 0; j < size; j++) {
+      lists.back().push_back(rng());
+      list_window.Append(lists.back().back());
+    }
+    for (size_t k = 0; k < window && k <= i; k++) {
+      span<const uint32_t> list = list_window.List(node - k);
+      const std::vector<uint32_t>& expected = lists[i - k];
+      ASSERT_EQ(list.size(), expected.size()) << "node " << node - k;
+      for (size_t j = 0; j < expected.size(); j++) {
+        ASSERT_EQ(list[j], expected[j]) << "node " << node - k;
+      }
+    }
+  }
+}
+
+TEST(ListWindowTest, TestSingleList) { TestListWindow(1, 0); }
+
+TEST(ListWindowTest, TestPowerOfTwo) { TestListWindow(32, 0); }
+
+TEST(ListWindowTest, TestWindow) { TestListWindow(33, 0); }
+
+TEST(ListWindowTest, TestFirstNodeNotZero) { TestListWindow(33, 1234); }
+
+}  // namespace
+}  // namespace zuckerli
@@ -0,0 +1,104 @@
+// Copyright 2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#include "memory_mapped_file.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <utility>
+
+#include "common.h"
+
+namespace zuckerli {
+
+MemoryMappedFile::MemoryMappedFile(const std::string &filename,
+                                   bool populate) {
+  struct stat st;
+  int ret = stat(filename.c_str(), &st);
+  ZKR_ASSERT(ret == 0);
+  size_ = st.st_size;
+  fd_ = open(filename.c_str(), O_RDONLY, 0);
+  ZKR_ASSERT(fd_ >= 0);
+  // Mapping an empty file is not allowed.
+  if (size_ == 0) return;
+  auto flags = MAP_SHARED;
+#ifdef __linux__
+  if (populate) flags |= MAP_POPULATE;
+#endif
+  data_ = (const uint8_t *)mmap(NULL, size_, PROT_READ, flags, fd_, 0);
+  ZKR_ASSERT(data_ != MAP_FAILED);
+}
+
+MemoryMappedFile::MemoryMappedFile(MemoryMappedFile &&other)
+    : size_(other.size_), data_(other.data_), fd_(other.fd_) {
+  other.size_ = 0;
+  other.data_ = nullptr;
+  other.fd_ = -1;
+}
+
+MemoryMappedFile &MemoryMappedFile::operator=(MemoryMappedFile &&other) {
+  if (this != &other) {
+    Unmap();
+    std::swap(size_, other.size_);
+    std::swap(data_, other.data_);
+    std::swap(fd_, other.fd_);
+  }
+  return *this;
+}
+
+MemoryMappedFile::~MemoryMappedFile() { Unmap(); }
+
+void MemoryMappedFile::Unmap() {
+  if (data_ != nullptr) munmap((void *)data_, size_);
+  if (fd_ >= 0) close(fd_);
+  data_ = nullptr;
+  size_ = 0;
+  fd_ = -1;
+}
+
+bool WritableMemoryMappedFile::Create(const std::string &filename,
+                                      size_t size) {
+  ZKR_RETURN_IF_ERROR(Close());
+  fd_ = open(filename.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (fd_ < 0) return ZKR_FAILURE("Could not create %s", filename.c_str());
+  if (ftruncate(fd_, size) != 0) {
+    return ZKR_FAILURE("Could not resize %s", filename.c_str());
+  }
+  size_ = size;
+  // Mapping an empty file is not allowed.
+  if (size_ == 0) return true;
+  void *data = mmap(NULL, size_, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+  if (data == MAP_FAILED) {
+    return ZKR_FAILURE("Could not map %s", filename.c_str());
+  }
+  data_ = static_cast<uint8_t *>(data);
+  return true;
+}
+
+bool WritableMemoryMappedFile::Close() {
+  bool ok = true;
+  if (data_ != nullptr && munmap(data_, size_) != 0) ok = false;
+  if (fd_ >= 0 && close(fd_) != 0) ok = false;
+  data_ = nullptr;
+  size_ = 0;
+  fd_ = -1;
+  if (!ok) return ZKR_FAILURE("Could not write the output file");
+  return true;
+}
+
+WritableMemoryMappedFile::~WritableMemoryMappedFile() { Close(); }
+
+}  // namespace zuckerli
@@ -0,0 +1,77 @@
+// Copyright 2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#ifndef ZUCKERLI_MEMORY_MAPPED_FILE_H
+#define ZUCKERLI_MEMORY_MAPPED_FILE_H
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#include <string>
+
+#include "common.h"
+
+namespace zuckerli {
+
+// Read-only, shared memory mapping of a whole file. Several processes mapping
+// the same file share a single copy of it in the page cache.
+class MemoryMappedFile {
+ public:
+  // If `populate` is true, the whole file is read in memory immediately (on
+  // Linux); otherwise, pages are only read when first accessed.
+  explicit MemoryMappedFile(const std::string &filename, bool populate = true);
+  // Empty, not backed by any file.
+  MemoryMappedFile() = default;
+  ~MemoryMappedFile();
+  MemoryMappedFile(const MemoryMappedFile &) = delete;
+  void operator=(const MemoryMappedFile &) = delete;
+  MemoryMappedFile(MemoryMappedFile &&other);
+  MemoryMappedFile &operator=(MemoryMappedFile &&other);
+  ZKR_INLINE const uint8_t *data() const { return data_; }
+  // Size of the file in bytes.
+  ZKR_INLINE size_t size() const { return size_; }
+
+ private:
+  void Unmap();
+
+  size_t size_ = 0;
+  const uint8_t *ZKR_RESTRICT data_ = nullptr;
+  int fd_ = -1;
+};
+
+// Writable, shared memory mapping of a new file of a given size, for writing
+// large outputs in place (possibly from several threads) without going through
+// stdio buffers.
+class WritableMemoryMappedFile {
+ public:
+  WritableMemoryMappedFile() = default;
+  ~WritableMemoryMappedFile();
+  WritableMemoryMappedFile(const WritableMemoryMappedFile &) = delete;
+  void operator=(const WritableMemoryMappedFile &) = delete;
+
+  // Creates (or truncates) `filename` with the given size, and maps it.
+  bool Create(const std::string &filename, size_t size);
+  // Unmaps the file, after which its contents are visible to other readers.
+  bool Close();
+
+  ZKR_INLINE uint8_t *data() const { return data_; }
+  ZKR_INLINE size_t size() const { return size_; }
+
+ private:
+  size_t size_ = 0;
+  uint8_t *ZKR_RESTRICT data_ = nullptr;
+  int fd_ = -1;
+};
+
+}  // namespace zuckerli
+#endif  // ZUCKERLI_MEMORY_MAPPED_FILE_H
@@ -0,0 +1,210 @@
+// Copyright 2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#include "node_ordering.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+#include <limits>
+#include <numeric>
+#include <tuple>
+#include <utility>
+
+#include "checksum.h"
+#include "common.h"
+
+namespace zuckerli {
+
+namespace {
+
+constexpr uint32_t kNoId = std::numeric_limits<uint32_t>::max();
+
+bool IsPermutation(const std::vector<uint32_t>& ids) {
+  std::vector<bool> seen(ids.size());
+  for (uint32_t id : ids) {
+    if (id >= ids.size() || seen[id]) return false;
+    seen[id] = true;
+  }
+  return true;
+}
+
+// Returns the new ids of the nodes listed in `order`, in new id order.
+std::vector<uint32_t> NewIdsFromOrder(const std::vector<uint32_t>& order) {
+  std::vector<uint32_t> new_ids(order.size());
+  for (size_t i = 0; i < order.size(); i++) new_ids[order[i]] = i;
+  return new_ids;
+}
+
+std::vector<uint32_t> BfsOrder(const UncompressedGraph& g) {
+  std::vector<uint32_t> order;
+  order.reserve(g.size());
+  std::vector<bool> visited(g.size());
+  for (size_t start = 0; start < g.size(); start++) {
+    if (visited[start]) continue;
+    visited[start] = true;
+    // `order` doubles as the queue of the visit.
+    size_t head = order.size();
+    order.push_back(start);
+    while (head < order.size()) {
+      for (uint32_t next : g.Neighbours(order[head++])) {
+        if (visited[next]) continue;
+        visited[next] = true;
+        order.push_back(next);
+      }
+    }
+  }
+  return order;
+}
+
+std::vector<uint32_t> DegreeOrder(const UncompressedGraph& g) {
+  std::vector<uint32_t> order(g.size());
+  std::iota(order.begin(), order.end(), 0);
+  std::stable_sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) {
+    return g.Degree(a) > g.Degree(b);
+  });
+  return order;
+}
+
+std::vector<uint32_t> ShingleOrder(const UncompressedGraph& g) {
+  // Two MinHash values of each list, computed with EdgeHash as a family of
+  // hash functions of the neighbours. Empty lists go last.
+  using Key = std::tuple<uint64_t, uint64_t, uint32_t>;
+  std::vector<Key> keys(g.size());
+  for (size_t i = 0; i < g.size(); i++) {
+    uint64_t min0 = std::numeric_limits<uint64_t>::max();
+    uint64_t min1 = std::numeric_limits<uint64_t>::max();
+    for (uint32_t neighbour : g.Neighbours(i)) {
+      min0 = std::min(min0, EdgeHash(0, neighbour));
+      min1 = std::min(min1, EdgeHash(1, neighbour));
+    }
+    keys[i] = Key(min0, min1, i);
+  }
+  std::sort(keys.begin(), keys.end());
+  std::vector<uint32_t> order(g.size());
+  for (size_t i = 0; i < g.size(); i++) order[i] = std::get<2>(keys[i]);
+  return order;
+}
+
+}  // namespace
+
+bool ParseNodeOrdering(const std::string& name, NodeOrdering* ordering) {
+  if (name == "identity") {
+    *ordering = NodeOrdering::kIdentity;
+  } else if (name == "bfs") {
+    *ordering = NodeOrdering::kBfs;
+  } else if (name == "degree") {
+    *ordering = NodeOrdering::kDegree;
+  } else if (name == "shingle") {
+    *ordering = NodeOrdering::kShingle;
+  } else {
+    return ZKR_FAILURE("Unknown node ordering %s", name.c_str());
+  }
+  return true;
+}
+
+NodePermutation::NodePermutation(std::vector<uint32_t> new_ids)
+    : new_ids_(std::move(new_ids)), original_ids_(new_ids_.size(), kNoId) {
+  ZKR_ASSERT(IsPermutation(new_ids_));
+  for (size_t i = 0; i < new_ids_.size(); i++) {
+    original_ids_[new_ids_[i]] = i;
+  }
+}
+
+bool NodePermutation::Write(const std::string& path) const {
+  FILE* f = fopen(path.c_str(), "wb");
+  if (f == nullptr) return ZKR_FAILURE("Could not create %s", path.c_str());
+  uint32_t num_nodes = size();
+  bool ok = fwrite(&num_nodes, sizeof(num_nodes), 1, f) == 1 &&
+            fwrite(new_ids_.data(), sizeof(uint32_t), size(), f) == size();
+  ok = fclose(f) == 0 && ok;
+  if (!ok) return ZKR_FAILURE("Could not write %s", path.c_str());
+  return true;
+}
+
+bool NodePermutation::Read(const std::string& path,
+                           NodePermutation* permutation) {
+  FILE* f = fopen(path.c_str(), "rb");
+  if (f == nullptr) return ZKR_FAILURE("Could not open %s", path.c_str());
+  uint32_t num_nodes = 0;
+  std::vector<uint32_t> new_ids;
+  bool ok = fread(&num_nodes, sizeof(num_nodes), 1, f) == 1;
+  if (ok) {
+    new_ids.resize(num_nodes);
+    ok = fread(new_ids.data(), sizeof(uint32_t), num_nodes, f) == num_nodes &&
+         fgetc(f) == EOF;
+  }
+  fclose(f);
+  if (!ok || !IsPermutation(new_ids)) {
+    return ZKR_FAILURE("Invalid permutation file %s", path.c_str());
+  }
+  *permutation = NodePermutation(std::move(new_ids));
+  return true;
+}
+
+NodePermutation ComputeNodeOrdering(const UncompressedGraph& g,
+                                    NodeOrdering ordering) {
+  std::vector<uint32_t> order;
+  switch (ordering) {
+    case NodeOrdering::kIdentity:
+      order.resize(g.size());
+      std::iota(order.begin(), order.end(), 0);
+      break;
+    case NodeOrdering::kBfs:
+      order = BfsOrder(g);
+      break;
+    case NodeOrdering::kDegree:
+      order = DegreeOrder(g);
+      break;
+    case NodeOrdering::kShingle:
+      order = ShingleOrder(g);
+      break;
+  }
+  return NodePermutation(NewIdsFromOrder(order));
+}
+
+std::vector<uint8_t> PermuteGraph(const UncompressedGraph& g,
+                                  const std::vector<uint32_t>& new_ids) {
+  ZKR_ASSERT(new_ids.size() == g.size());
+  size_t num_nodes = g.size();
+  std::vector<uint32_t> original_ids(num_nodes);
+  for (size_t i = 0; i < num_nodes; i++) original_ids[new_ids[i]] = i;
+  std::vector<uint64_t> offsets(num_nodes + 1);
+  for (size_t i = 0; i < num_nodes; i++) {
+    offsets[i + 1] = offsets[i] + g.Degree(original_ids[i]);
+  }
+
+  uint64_t fingerprint = UncompressedGraph::kFingerprint;
+  uint32_t n = num_nodes;
+  size_t offsets_start = sizeof(fingerprint) + sizeof(n);
+  size_t edges_start = offsets_start + offsets.size() * sizeof(uint64_t);
+  std::vector<uint8_t> data(edges_start +
+                            offsets[num_nodes] * sizeof(uint32_t));
+  memcpy(data.data(), &fingerprint, sizeof(fingerprint));
+  memcpy(data.data() + sizeof(fingerprint), &n, sizeof(n));
+  memcpy(data.data() + offsets_start, offsets.data(),
+         offsets.size() * sizeof(uint64_t));
+  uint32_t* edges = reinterpret_cast<uint32_t*>(data.data() + edges_start);
+  for (size_t i = 0; i < num_nodes; i++) {
+    uint32_t* list = edges + offsets[i];
+    size_t degree = 0;
+    for (uint32_t neighbour : g.Neighbours(original_ids[i])) {
+      list[degree++] = new_ids[neighbour];
+    }
+    std::sort(list, list + degree);
+  }
+  return data;
+}
+
+}  // namespace zuckerli
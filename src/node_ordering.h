@@ -0,0 +1,87 @@
+// Copyright 2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#ifndef ZUCKERLI_NODE_ORDERING_H
+#define ZUCKERLI_NODE_ORDERING_H
+#include <stdint.h>
+#include <stdlib.h>
+
+#include <string>
+#include <vector>
+
+#include "common.h"
+#include "uncompressed_graph.h"
+
+namespace zuckerli {
+
+// Orders in which nodes can be renumbered before encoding. Copy blocks and
+// residual gaps depend on nodes with similar adjacency lists having close ids,
+// which the original ids may not provide.
+enum class NodeOrdering {
+  // Keeps the original ids.
+  kIdentity,
+  // Breadth-first visit order, following edges in increasing order of the
+  // destination and starting a new visit from the first unvisited node.
+  kBfs,
+  // Decreasing degree, ties broken by the original id.
+  kDegree,
+  // Nodes sorted by two MinHash values of their adjacency list, so that nodes
+  // with overlapping lists are likely to be next to each other.
+  kShingle,
+};
+
+// Parses "identity", "bfs", "degree" or "shingle".
+bool ParseNodeOrdering(const std::string& name, NodeOrdering* ordering);
+
+// A renumbering of the nodes of a graph.
+class NodePermutation {
+ public:
+  NodePermutation() = default;
+  // `new_ids[i]` is the new id of the node with original id i. Aborts if this
+  // is not a permutation.
+  explicit NodePermutation(std::vector<uint32_t> new_ids);
+
+  ZKR_INLINE size_t size() const { return new_ids_.size(); }
+  ZKR_INLINE uint32_t NewId(size_t original_id) const {
+    ZKR_DASSERT(original_id < size());
+    return new_ids_[original_id];
+  }
+  ZKR_INLINE uint32_t OriginalId(size_t new_id) const {
+    ZKR_DASSERT(new_id < size());
+    return original_ids_[new_id];
+  }
+  const std::vector<uint32_t>& new_ids() const { return new_ids_; }
+  const std::vector<uint32_t>& original_ids() const { return original_ids_; }
+
+  // Side file format: the number of nodes N as a 32-bit value, followed by
+  // the N new ids in order of original id, as 32-bit values.
+  bool Write(const std::string& path) const;
+  static bool Read(const std::string& path, NodePermutation* permutation);
+
+ private:
+  std::vector<uint32_t> new_ids_;
+  std::vector<uint32_t> original_ids_;
+};
+
+NodePermutation ComputeNodeOrdering(const UncompressedGraph& g,
+                                    NodeOrdering ordering);
+
+// Returns `g` with node i renamed to `new_ids[i]` (and its adjacency lists
+// sorted again), in the format described in uncompressed_graph.h. Renaming
+// with the original ids of a permutation undoes it.
+std::vector<uint8_t> PermuteGraph(const UncompressedGraph& g,
+                                  const std::vector<uint32_t>& new_ids);
+
+}  // namespace zuckerli
+
+#endif  // ZUCKERLI_NODE_ORDERING_H
@@ -0,0 +1,120 @@
+// Copyright 2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#include "node_ordering.h"
+
+#include <algorithm>
+#include <numeric>
+#include <random>
+
+#include "gtest/gtest.h"
+#include "synthetic_graph.h"
+#include "test_utils.h"
+
+namespace zuckerli {
+namespace {
+
+// A synthetic graph whose ids have been shuffled, so that it has no locality.
+std::vector<std::vector<uint32_t>> ShuffledGraph(size_t num_nodes) {
+  std::vector<std::vector<uint32_t>> graph = SyntheticGraph(num_nodes, 1);
+  std::vector<uint32_t> new_ids(num_nodes);
+  std::iota(new_ids.begin(), new_ids.end(), 0);
+  std::shuffle(new_ids.begin(), new_ids.end(), std::mt19937(0));
+  std::vector<std::vector<uint32_t>> shuffled(num_nodes);
+  for (size_t i = 0; i < num_nodes; i++) {
+    for (uint32_t neighbour : graph[i]) {
+      shuffled[new_ids[i]].push_back(new_ids[neighbour]);
+    }
+    std::sort(shuffled[new_ids[i]].begin(), shuffled[new_ids[i]].end());
+  }
+  return shuffled;
+}
+
+void TestOrdering(NodeOrdering ordering, const std::string& name) {
+  std::vector<std::vector<uint32_t>> graph = ShuffledGraph(500);
+  UncompressedGraph g(WriteTestGraph("node_ordering_test_" + name, graph));
+  NodePermutation permutation = ComputeNodeOrdering(g, ordering);
+  ASSERT_EQ(permutation.size(), g.size());
+  UncompressedGraph permuted(PermuteGraph(g, permutation.new_ids()));
+  ASSERT_EQ(permuted.size(), g.size());
+  for (size_t i = 0; i < g.size(); i++) {
+    ASSERT_EQ(permutation.OriginalId(permutation.NewId(i)), i);
+    ASSERT_EQ(permuted.Degree(permutation.NewId(i)), g.Degree(i));
+    span<const uint32_t> list = permuted.Neighbours(permutation.NewId(i));
+    EXPECT_TRUE(std::is_sorted(list.begin(), list.end()));
+    for (uint32_t neighbour : g.Neighbours(i)) {
+      EXPECT_TRUE(std::binary_search(list.begin(), list.end(),
+                                     permutation.NewId(neighbour)));
+    }
+  }
+  // Renaming back with the original ids gives the same graph.
+  EXPECT_EQ(PermuteGraph(permuted, permutation.original_ids()),
+            SerializeUncompressedGraph(graph));
+}
+
+TEST(NodeOrderingTest, TestIdentity) {
+  TestOrdering(NodeOrdering::kIdentity, "identity");
+}
+
+TEST(NodeOrderingTest, TestBfs) { TestOrdering(NodeOrdering::kBfs, "bfs"); }
+
+TEST(NodeOrderingTest, TestDegree) {
+  TestOrdering(NodeOrdering::kDegree, "degree");
+}
+
+TEST(NodeOrderingTest, TestShingle) {
+  TestOrdering(NodeOrdering::kShingle, "shingle");
+}
+
+TEST(NodeOrderingTest, TestBfsOrder) {
+  // 0 -> 3 -> 1, and 2 -> 4, which is only reached by a second visit.
+  UncompressedGraph g(
+      WriteTestGraph("node_ordering_test_bfs_order", {{3}, {}, {4}, {1}, {}}));
+  NodePermutation permutation = ComputeNodeOrdering(g, NodeOrdering::kBfs);
+  EXPECT_EQ(permutation.original_ids(),
+            std::vector<uint32_t>({0, 3, 1, 2, 4}));
+}
+
+TEST(NodeOrderingTest, TestDegreeOrder) {
+  UncompressedGraph g(WriteTestGraph("node_ordering_test_degree_order",
+                                     {{1}, {0, 1, 2}, {}, {0, 2}}));
+  NodePermutation permutation = ComputeNodeOrdering(g, NodeOrdering::kDegree);
+  EXPECT_EQ(permutation.original_ids(),
+            std::vector<uint32_t>({1, 3, 0, 2}));
+}
+
+TEST(NodeOrderingTest, TestReadWrite) {
+  NodePermutation permutation({2, 0, 3, 1});
+  std::string path = ::testing::TempDir() + "/node_ordering_test.perm";
+  ASSERT_TRUE(permutation.Write(path));
+  NodePermutation read;
+  ASSERT_TRUE(NodePermutation::Read(path, &read));
+  EXPECT_EQ(read.new_ids(), permutation.new_ids());
+  EXPECT_EQ(read.original_ids(), std::vector<uint32_t>({1, 3, 0, 2}));
+
+  // Not a permutation.
+  std::string invalid =
+      WriteTestFile("node_ordering_test_invalid.perm",
+                    {3, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 2, 0, 0, 0});
+  EXPECT_FALSE(NodePermutation::Read(invalid, &read));
+}
+
+TEST(NodeOrderingTest, TestParse) {
+  NodeOrdering ordering;
+  ASSERT_TRUE(ParseNodeOrdering("shingle", &ordering));
+  EXPECT_EQ(ordering, NodeOrdering::kShingle);
+  EXPECT_FALSE(ParseNodeOrdering("random", &ordering));
+}
+
+}  // namespace
+}  // namespace zuckerli
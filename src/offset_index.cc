@@ -0,0 +1,84 @@
+// Copyright 2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#include "offset_index.h"
+
+#include <algorithm>
+
+#include "common.h"
+
+namespace zuckerli {
+
+namespace {
+// Limited so that a delta never spans more than 8 bytes.
+static constexpr size_t kMaxDeltaBits = BitWriter::kMaxBitsPerCall;
+}  // namespace
+
+void EncodeOffsetIndex(const std::vector<size_t>& positions,
+                       BitWriter* writer) {
+  size_t width = 0;
+  for (size_t i = 0; i < positions.size(); i++) {
+    size_t base = positions[i - i % kOffsetIndexChunkSize];
+    ZKR_ASSERT(positions[i] >= base);
+    size_t delta = positions[i] - base;
+    if (delta != 0) {
+      width = std::max<size_t>(width, FloorLog2Nonzero(delta) + 1);
+    }
+  }
+  ZKR_ASSERT(width <= kMaxDeltaBits);
+
+  writer->ZeroPad();
+  writer->Reserve(OffsetIndex::EncodedSize(positions.size(), width) * 8);
+  writer->Write(8, width);
+  for (size_t i = 0; i < positions.size(); i += kOffsetIndexChunkSize) {
+    writer->Write(32, positions[i] & 0xFFFFFFFF);
+    writer->Write(32, positions[i] >> 32);
+  }
+  for (size_t i = 0; i < positions.size(); i++) {
+    size_t base = positions[i - i % kOffsetIndexChunkSize];
+    writer->Write(width, positions[i] - base);
+  }
+  writer->ZeroPad();
+  writer->Write(32, 0);
+  writer->Write(32, 0);
+}
+
+size_t OffsetIndex::EncodedSize(size_t num_nodes, size_t width) {
+  return 1 + DivCeil(num_nodes, kOffsetIndexChunkSize) * sizeof(uint64_t) +
+         DivCeil(num_nodes * width, 8) + sizeof(uint64_t);
+}
+
+bool OffsetIndex::Init(size_t num_nodes, const uint8_t* data, size_t size) {
+  if (size < 1) return ZKR_FAILURE("Offset index too short");
+  size_t width = data[0];
+  if (width > kMaxDeltaBits) return ZKR_FAILURE("Invalid offset index width");
+  if (EncodedSize(num_nodes, width) > size) {
+    return ZKR_FAILURE("Offset index too short");
+  }
+  num_nodes_ = num_nodes;
+  width_ = width;
+  delta_mask_ = (uint64_t{1} << width) - 1;
+  bases_ = data + 1;
+  deltas_ =
+      bases_ + DivCeil(num_nodes, kOffsetIndexChunkSize) * sizeof(uint64_t);
+  return true;
+}
+
+void OffsetIndex::Build(const std::vector<size_t>& positions) {
+  BitWriter writer;
+  EncodeOffsetIndex(positions, &writer);
+  storage_ = std::move(writer).GetData();
+  ZKR_ASSERT(Init(positions.size(), storage_.data(), storage_.size()));
+}
+
+}  // namespace zuckerli
@@ -0,0 +1,91 @@
+// Copyright 2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#ifndef ZUCKERLI_OFFSET_INDEX_H
+#define ZUCKERLI_OFFSET_INDEX_H
+#include <stdint.h>
+#include <string.h>
+
+#include <vector>
+
+#include "bit_writer.h"
+#include "common.h"
+
+namespace zuckerli {
+
+// Number of consecutive nodes that share the same absolute base position.
+static constexpr size_t kOffsetIndexChunkSize = 64;
+
+// Compact index of the (bit) positions at which the adjacency list of each
+// node starts, so that random-access readers do not need to decode the whole
+// graph to find them.
+// Format description (starts and ends at a byte boundary):
+// - 1 byte with the number of bits W used for each per-node delta
+// - ceil(N/kOffsetIndexChunkSize) 8-byte integers with the position of the
+//   first node of each chunk
+// - N W-bit integers with the difference between the position of each node and
+//   the position of the first node in its chunk, padded to a whole byte
+// - 8 bytes of zero padding, so that deltas can be read with a single
+//   unaligned 64-bit load.
+// `positions` must be non-decreasing.
+void EncodeOffsetIndex(const std::vector<size_t>& positions, BitWriter* writer);
+
+class OffsetIndex {
+ public:
+  OffsetIndex() = default;
+  OffsetIndex(const OffsetIndex&) = delete;
+  OffsetIndex& operator=(const OffsetIndex&) = delete;
+  OffsetIndex(OffsetIndex&&) = default;
+  OffsetIndex& operator=(OffsetIndex&&) = default;
+
+  // Size in bytes of the encoded index for `num_nodes` nodes with deltas of
+  // `width` bits.
+  static size_t EncodedSize(size_t num_nodes, size_t width);
+
+  // Uses the encoded index for `num_nodes` nodes at `data`, of which `size`
+  // bytes are available, without copying it: `data` must outlive this object.
+  // Only the chunk header is validated, so this takes constant time.
+  bool Init(size_t num_nodes, const uint8_t* data, size_t size);
+
+  // Builds an index that owns its storage from a list of positions.
+  void Build(const std::vector<size_t>& positions);
+
+  ZKR_INLINE size_t operator[](size_t node) const {
+    ZKR_DASSERT(node < num_nodes_);
+    uint64_t base;
+    memcpy(&base, bases_ + node / kOffsetIndexChunkSize * sizeof(uint64_t),
+           sizeof(base));
+    const size_t bit_pos = node * width_;
+    uint64_t delta;
+    memcpy(&delta, deltas_ + bit_pos / 8, sizeof(delta));
+    return base + ((delta >> (bit_pos % 8)) & delta_mask_);
+  }
+
+  // Prefetches the memory read by operator[](node).
+  ZKR_INLINE void Prefetch(size_t node) const {
+    ZKR_PREFETCH(bases_ + node / kOffsetIndexChunkSize * sizeof(uint64_t));
+    ZKR_PREFETCH(deltas_ + node * width_ / 8);
+  }
+
+ private:
+  std::vector<uint8_t> storage_;
+  const uint8_t* bases_ = nullptr;
+  const uint8_t* deltas_ = nullptr;
+  size_t num_nodes_ = 0;
+  size_t width_ = 0;
+  uint64_t delta_mask_ = 0;
+};
+
+}  // namespace zuckerli
+
+#endif  // ZUCKERLI_OFFSET_INDEX_H
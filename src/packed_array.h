@@ -0,0 +1,74 @@
+// Copyright 2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#ifndef ZUCKERLI_PACKED_ARRAY_H
+#define ZUCKERLI_PACKED_ARRAY_H
+#include <stdint.h>
+#include <stdlib.h>
+
+#include <vector>
+
+#include "common.h"
+
+namespace zuckerli {
+
+// Array of integers that are stored with a fixed number of bits each (at most
+// 64), so that reading one takes at most two memory accesses.
+class PackedArray {
+ public:
+  PackedArray() = default;
+  PackedArray(size_t size, size_t width)
+      : size_(size),
+        width_(width),
+        mask_(width == 64 ? ~uint64_t{0} : (uint64_t{1} << width) - 1),
+        // One extra word, so that Get can always read two words.
+        words_(DivCeil(size * width, 64) + 1) {
+    ZKR_ASSERT(width <= 64);
+  }
+
+  ZKR_INLINE size_t size() const { return size_; }
+  ZKR_INLINE size_t width() const { return width_; }
+  // Largest value that can be stored.
+  ZKR_INLINE uint64_t max_value() const { return mask_; }
+
+  ZKR_INLINE uint64_t Get(size_t i) const {
+    ZKR_DASSERT(i < size_);
+    const size_t bit = i * width_;
+    const size_t shift = bit % 64;
+    const uint64_t* word = &words_[bit / 64];
+    // The second shift is split in two to avoid shifting by 64 bits.
+    return ((word[0] >> shift) | ((word[1] << 1) << (63 - shift))) & mask_;
+  }
+
+  ZKR_INLINE void Set(size_t i, uint64_t value) {
+    ZKR_DASSERT(i < size_);
+    ZKR_DASSERT(value <= mask_);
+    const size_t bit = i * width_;
+    const size_t shift = bit % 64;
+    uint64_t* word = &words_[bit / 64];
+    word[0] = (word[0] & ~(mask_ << shift)) | (value << shift);
+    if (shift + width_ > 64) {
+      word[1] = (word[1] & ~(mask_ >> (64 - shift))) | (value >> (64 - shift));
+    }
+  }
+
+ private:
+  size_t size_ = 0;
+  size_t width_ = 0;
+  uint64_t mask_ = 0;
+  std::vector<uint64_t> words_;
+};
+
+}  // namespace zuckerli
+
+#endif  // ZUCKERLI_PACKED_ARRAY_H
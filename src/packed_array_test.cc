@@ -0,0 +1,46 @@
+// Copyright 2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#include "packed_array.h"
+
+#include <random>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+namespace zuckerli {
+namespace {
+
+TEST(PackedArrayTest, TestSetGet) {
+  std::mt19937_64 rng;
+  for (size_t width = 1; width <= 64; width++) {
+    constexpr size_t kSize = 1000;
+    PackedArray array(kSize, width);
+    std::vector<uint64_t> values(kSize);
+    for (size_t i = 0; i < kSize; i++) {
+      values[i] = rng() & array.max_value();
+      array.Set(i, values[i]);
+    }
+    // Overwrite some values, to check that neighbours are not affected.
+    for (size_t i = 0; i < kSize; i += 3) {
+      values[i] = rng() & array.max_value();
+      array.Set(i, values[i]);
+    }
+    for (size_t i = 0; i < kSize; i++) {
+      ASSERT_EQ(array.Get(i), values[i]) << "width " << width << " index " << i;
+    }
+  }
+}
+
+}  // namespace
+}  // namespace zuckerli
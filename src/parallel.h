@@ -0,0 +1,63 @@
+// Copyright 2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#ifndef ZUCKERLI_PARALLEL_H
+#define ZUCKERLI_PARALLEL_H
+#include <stdlib.h>
+
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+namespace zuckerli {
+
+// Returns `num_threads`, or the number of hardware threads if it is 0.
+inline size_t NumThreads(size_t num_threads) {
+  if (num_threads != 0) return num_threads;
+  return std::max<size_t>(1, std::thread::hardware_concurrency());
+}
+
+// Calls `func(thread, task)` for every task in [0, num_tasks), using up to
+// `num_threads` threads (0 means one per hardware thread). `thread` is in
+// [0, num_threads) and is the same for all the calls made by the same thread,
+// so it can be used to index per-thread state. Tasks are handed out in
+// increasing order. Returns false if any call returned false; the remaining
+// tasks are skipped in that case.
+template <typename Func>
+bool ParallelFor(size_t num_tasks, size_t num_threads, const Func& func) {
+  num_threads = std::min(NumThreads(num_threads), num_tasks);
+  std::atomic<size_t> next_task{0};
+  std::atomic<bool> ok{true};
+  auto run = [&](size_t thread) {
+    while (ok.load(std::memory_order_relaxed)) {
+      size_t task = next_task.fetch_add(1, std::memory_order_relaxed);
+      if (task >= num_tasks) return;
+      if (!func(thread, task)) ok.store(false, std::memory_order_relaxed);
+    }
+  };
+  if (num_threads <= 1) {
+    run(0);
+    return ok.load();
+  }
+  std::vector<std::thread> threads;
+  threads.reserve(num_threads - 1);
+  for (size_t i = 1; i < num_threads; i++) threads.emplace_back(run, i);
+  run(0);
+  for (std::thread& thread : threads) thread.join();
+  return ok.load();
+}
+
+}  // namespace zuckerli
+
+#endif  // ZUCKERLI_PARALLEL_H
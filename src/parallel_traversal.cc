@@ -0,0 +1,263 @@
+// Copyright 2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#include "parallel_traversal.h"
+
+#include <algorithm>
+#include <chrono>
+
+#include "common.h"
+#include "parallel.h"
+
+namespace zuckerli {
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+double SecondsSince(Clock::time_point start) {
+  return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+// Frontier nodes expanded by each top-down task.
+constexpr size_t kTopDownNodesPerTask = 256;
+// Nodes scanned by each bottom-up or connected components task. Nodes of the
+// same degree chunk share the decoding of its degrees in a batch.
+constexpr size_t kNodesPerTask = 4096;
+// The BFS goes bottom-up when the frontier has more than 1/kAlpha of the
+// unvisited nodes, and back top-down when it has less than 1/kBeta of all the
+// nodes. These are the thresholds of Beamer et al., "Direction-Optimizing
+// Breadth-First Search", applied to numbers of nodes instead of numbers of
+// edges, which are not known without decoding the lists.
+constexpr size_t kAlpha = 14;
+constexpr size_t kBeta = 24;
+
+// State owned by a single thread.
+struct ThreadState {
+  // Lists to decode, and their neighbours once decoded.
+  std::vector<uint32_t> nodes;
+  NeighboursBatchResult result;
+  // Nodes added to the next frontier by this thread.
+  std::vector<uint32_t> next;
+  double decode_seconds = 0;
+  size_t lists_decoded = 0;
+  size_t edges_decoded = 0;
+
+  void Decode(const CompressedGraph& graph) {
+    auto start = Clock::now();
+    graph.NeighboursBatch(span<const uint32_t>(nodes.data(), nodes.size()),
+                          &result);
+    decode_seconds += SecondsSince(start);
+    lists_decoded += result.size();
+    for (size_t i = 0; i < result.size(); i++) {
+      edges_decoded += result.neighbours(i).size();
+    }
+  }
+};
+
+void FillStats(const std::vector<ThreadState>& threads,
+               Clock::time_point start, TraversalStats* stats) {
+  if (stats == nullptr) return;
+  stats->wall_seconds = SecondsSince(start);
+  stats->decode_seconds = 0;
+  stats->lists_decoded = 0;
+  stats->edges_decoded = 0;
+  for (const ThreadState& state : threads) {
+    stats->decode_seconds += state.decode_seconds;
+    stats->lists_decoded += state.lists_decoded;
+    stats->edges_decoded += state.edges_decoded;
+  }
+  stats->traversal_seconds =
+      stats->wall_seconds * threads.size() - stats->decode_seconds;
+}
+
+// Lock-free union-find, where the root of each set is its smallest element.
+// Parents only ever decrease, so concurrent updates cannot create cycles.
+class ConcurrentUnionFind {
+ public:
+  explicit ConcurrentUnionFind(size_t size)
+      : parents_(new std::atomic<uint32_t>[size]) {
+    for (size_t i = 0; i < size; i++) {
+      parents_[i].store(i, std::memory_order_relaxed);
+    }
+  }
+
+  uint32_t Find(uint32_t x) {
+    while (true) {
+      uint32_t parent = parents_[x].load(std::memory_order_relaxed);
+      if (parent == x) return x;
+      uint32_t grandparent = parents_[parent].load(std::memory_order_relaxed);
+      // Path halving: failing just means that someone else updated `x`.
+      if (grandparent != parent) {
+        parents_[x].compare_exchange_weak(parent, grandparent,
+                                          std::memory_order_relaxed);
+      }
+      x = grandparent;
+    }
+  }
+
+  void Union(uint32_t a, uint32_t b) {
+    while (true) {
+      a = Find(a);
+      b = Find(b);
+      if (a == b) return;
+      if (a < b) std::swap(a, b);
+      // Fails if `a` stopped being a root in the meantime.
+      if (parents_[a].compare_exchange_strong(a, b,
+                                              std::memory_order_relaxed)) {
+        return;
+      }
+    }
+  }
+
+ private:
+  std::unique_ptr<std::atomic<uint32_t>[]> parents_;
+};
+
+}  // namespace
+
+std::vector<uint32_t> ParallelBFS(const CompressedGraph& graph,
+                                  const CompressedGraph* transpose,
+                                  uint32_t root, size_t num_threads,
+                                  TraversalStats* stats) {
+  const size_t num_nodes = graph.size();
+  ZKR_ASSERT(root < num_nodes);
+  ZKR_ASSERT(transpose == nullptr || transpose->size() == num_nodes);
+  auto start = Clock::now();
+  num_threads = NumThreads(num_threads);
+  std::vector<ThreadState> threads(num_threads);
+  // Each entry is written by the thread that discovers the node.
+  std::vector<uint32_t> distances(num_nodes, kUnreachable);
+  AtomicBitmap visited(num_nodes);
+  AtomicBitmap in_frontier(transpose ? num_nodes : 0);
+  std::vector<uint32_t> frontier = {root};
+  visited.Set(root);
+  distances[root] = 0;
+  size_t num_visited = 1;
+  bool bottom_up = false;
+  if (stats) stats->top_down_levels = stats->bottom_up_levels = 0;
+
+  for (uint32_t distance = 1; !frontier.empty(); distance++) {
+    if (transpose && !bottom_up &&
+        frontier.size() * kAlpha > num_nodes - num_visited) {
+      bottom_up = true;
+    } else if (bottom_up && frontier.size() * kBeta < num_nodes) {
+      bottom_up = false;
+    }
+
+    if (bottom_up) {
+      in_frontier.Clear();
+      ParallelFor(DivCeil(frontier.size(), kNodesPerTask), num_threads,
+                  [&](size_t thread, size_t task) {
+                    size_t end = std::min(frontier.size(),
+                                          (task + 1) * kNodesPerTask);
+                    for (size_t i = task * kNodesPerTask; i < end; i++) {
+                      in_frontier.Set(frontier[i]);
+                    }
+                    return true;
+                  });
+      ParallelFor(
+          DivCeil(num_nodes, kNodesPerTask), num_threads,
+          [&](size_t thread, size_t task) {
+            ThreadState& state = threads[thread];
+            state.nodes.clear();
+            size_t end = std::min(num_nodes, (task + 1) * kNodesPerTask);
+            for (size_t i = task * kNodesPerTask; i < end; i++) {
+              if (!visited.Get(i)) state.nodes.push_back(i);
+            }
+            if (state.nodes.empty()) return true;
+            state.Decode(*transpose);
+            for (size_t i = 0; i < state.result.size(); i++) {
+              for (uint32_t parent : state.result.neighbours(i)) {
+                if (!in_frontier.Get(parent)) continue;
+                uint32_t node = state.result.node(i);
+                visited.Set(node);
+                distances[node] = distance;
+                state.next.push_back(node);
+                break;
+              }
+            }
+            return true;
+          });
+      if (stats) stats->bottom_up_levels++;
+    } else {
+      ParallelFor(
+          DivCeil(frontier.size(), kTopDownNodesPerTask), num_threads,
+          [&](size_t thread, size_t task) {
+            ThreadState& state = threads[thread];
+            size_t begin = task * kTopDownNodesPerTask;
+            size_t end =
+                std::min(frontier.size(), begin + kTopDownNodesPerTask);
+            state.nodes.assign(frontier.begin() + begin,
+                               frontier.begin() + end);
+            state.Decode(graph);
+            for (size_t i = 0; i < state.result.size(); i++) {
+              for (uint32_t node : state.result.neighbours(i)) {
+                if (!visited.TestAndSet(node)) continue;
+                distances[node] = distance;
+                state.next.push_back(node);
+              }
+            }
+            return true;
+          });
+      if (stats) stats->top_down_levels++;
+    }
+
+    frontier.clear();
+    for (ThreadState& state : threads) {
+      frontier.insert(frontier.end(), state.next.begin(), state.next.end());
+      state.next.clear();
+    }
+    num_visited += frontier.size();
+  }
+  FillStats(threads, start, stats);
+  return distances;
+}
+
+std::vector<uint32_t> ParallelConnectedComponents(const CompressedGraph& graph,
+                                                  size_t num_threads,
+                                                  TraversalStats* stats) {
+  const size_t num_nodes = graph.size();
+  auto start = Clock::now();
+  num_threads = NumThreads(num_threads);
+  std::vector<ThreadState> threads(num_threads);
+  ConcurrentUnionFind components(num_nodes);
+  size_t num_tasks = DivCeil(num_nodes, kNodesPerTask);
+  ParallelFor(num_tasks, num_threads, [&](size_t thread, size_t task) {
+    ThreadState& state = threads[thread];
+    state.nodes.clear();
+    size_t end = std::min(num_nodes, (task + 1) * kNodesPerTask);
+    for (size_t i = task * kNodesPerTask; i < end; i++) {
+      state.nodes.push_back(i);
+    }
+    state.Decode(graph);
+    for (size_t i = 0; i < state.result.size(); i++) {
+      for (uint32_t neighbour : state.result.neighbours(i)) {
+        components.Union(state.result.node(i), neighbour);
+      }
+    }
+    return true;
+  });
+  std::vector<uint32_t> labels(num_nodes);
+  ParallelFor(num_tasks, num_threads, [&](size_t thread, size_t task) {
+    size_t end = std::min(num_nodes, (task + 1) * kNodesPerTask);
+    for (size_t i = task * kNodesPerTask; i < end; i++) {
+      labels[i] = components.Find(i);
+    }
+    return true;
+  });
+  FillStats(threads, start, stats);
+  return labels;
+}
+
+}  // namespace zuckerli
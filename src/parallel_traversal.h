@@ -0,0 +1,104 @@
+// Copyright 2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#ifndef ZUCKERLI_PARALLEL_TRAVERSAL_H
+#define ZUCKERLI_PARALLEL_TRAVERSAL_H
+#include <stdint.h>
+#include <stdlib.h>
+
+#include <atomic>
+#include <memory>
+#include <vector>
+
+#include "compressed_graph.h"
+
+namespace zuckerli {
+
+// Fixed-size set of bits that can be set concurrently by several threads.
+class AtomicBitmap {
+ public:
+  explicit AtomicBitmap(size_t size)
+      : words_(new std::atomic<uint64_t>[(size + 63) / 64]()),
+        num_words_((size + 63) / 64) {}
+
+  bool Get(size_t i) const {
+    return (words_[i / 64].load(std::memory_order_relaxed) >> (i % 64)) & 1;
+  }
+  void Set(size_t i) {
+    words_[i / 64].fetch_or(uint64_t{1} << (i % 64),
+                            std::memory_order_relaxed);
+  }
+  // Sets bit `i`, and returns true if this call changed it.
+  bool TestAndSet(size_t i) {
+    uint64_t bit = uint64_t{1} << (i % 64);
+    if (words_[i / 64].load(std::memory_order_relaxed) & bit) return false;
+    return !(words_[i / 64].fetch_or(bit, std::memory_order_relaxed) & bit);
+  }
+  // Not thread-safe.
+  void Clear() {
+    for (size_t i = 0; i < num_words_; i++) {
+      words_[i].store(0, std::memory_order_relaxed);
+    }
+  }
+
+ private:
+  std::unique_ptr<std::atomic<uint64_t>[]> words_;
+  size_t num_words_;
+};
+
+// Where the time of a parallel traversal went. Thread times are summed over
+// all threads, so they can exceed the wall time.
+struct TraversalStats {
+  double wall_seconds = 0;
+  // Thread time spent in CompressedGraph::NeighboursBatch.
+  double decode_seconds = 0;
+  // Thread time spent on everything else: visiting nodes, building frontiers,
+  // and waiting for other threads at the end of each level.
+  double traversal_seconds = 0;
+  size_t lists_decoded = 0;
+  size_t edges_decoded = 0;
+  // Number of BFS levels expanded from the frontier (top-down) and from the
+  // unvisited nodes (bottom-up).
+  size_t top_down_levels = 0;
+  size_t bottom_up_levels = 0;
+};
+
+// Distance of nodes that cannot be reached from the root.
+constexpr uint32_t kUnreachable = ~uint32_t{0};
+
+// Level-synchronous BFS from `root`, using up to `num_threads` threads (0 for
+// one per hardware thread) that share `graph`. Returns the distance of each
+// node from `root`.
+//
+// Small frontiers are expanded top-down, by decoding their lists. If
+// `transpose` is not null, it must hold the transpose of `graph` (`graph`
+// itself if all its edges go both ways): large frontiers are then expanded
+// bottom-up, with each unvisited node looking for a parent in the frontier
+// among its in-neighbours. This decodes the lists of the unvisited nodes
+// instead of the ones of the frontier, which is cheaper when the frontier
+// holds a large part of the graph.
+std::vector<uint32_t> ParallelBFS(const CompressedGraph& graph,
+                                  const CompressedGraph* transpose,
+                                  uint32_t root, size_t num_threads,
+                                  TraversalStats* stats = nullptr);
+
+// Weakly connected components of `graph`, using up to `num_threads` threads.
+// Returns the smallest node of the component of each node. Every list is
+// decoded exactly once.
+std::vector<uint32_t> ParallelConnectedComponents(
+    const CompressedGraph& graph, size_t num_threads,
+    TraversalStats* stats = nullptr);
+
+}  // namespace zuckerli
+
+#endif  // ZUCKERLI_PARALLEL_TRAVERSAL_H
@@ -0,0 +1,187 @@
+// Copyright 2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#include "parallel_traversal.h"
+
+#include <algorithm>
+#include <numeric>
+#include <queue>
+#include <thread>
+
+#include "encode.h"
+#include "gtest/gtest.h"
+#include "test_utils.h"
+#include "uncompressed_graph.h"
+
+namespace zuckerli {
+namespace {
+
+using Graph = std::vector<std::vector<uint32_t>>;
+
+std::unique_ptr<CompressedGraph> Compress(const std::string& name,
+                                          const Graph& graph) {
+  UncompressedGraph g(WriteTestGraph(name, graph));
+  return std::unique_ptr<CompressedGraph>(new CompressedGraph(WriteTestFile(
+      name + ".zkr", EncodeGraph(g, /*allow_random_access=*/true))));
+}
+
+Graph Transpose(const Graph& graph) {
+  Graph transpose(graph.size());
+  for (size_t i = 0; i < graph.size(); i++) {
+    for (uint32_t j : graph[i]) transpose[j].push_back(i);
+  }
+  return transpose;
+}
+
+std::vector<uint32_t> BFS(const Graph& graph, uint32_t root) {
+  std::vector<uint32_t> distances(graph.size(), kUnreachable);
+  std::queue<uint32_t> queue;
+  distances[root] = 0;
+  queue.push(root);
+  while (!queue.empty()) {
+    uint32_t node = queue.front();
+    queue.pop();
+    for (uint32_t neighbour : graph[node]) {
+      if (distances[neighbour] != kUnreachable) continue;
+      distances[neighbour] = distances[node] + 1;
+      queue.push(neighbour);
+    }
+  }
+  return distances;
+}
+
+TEST(ParallelTraversalTest, TestAtomicBitmap) {
+  constexpr size_t kSize = 1000;
+  AtomicBitmap bitmap(kSize);
+  // Threads set every second or every third bit, so some bits are contended.
+  const size_t strides[] = {2, 3, 2, 3};
+  std::vector<std::vector<uint32_t>> set_by(4);
+  std::vector<std::thread> threads;
+  for (size_t t = 0; t < set_by.size(); t++) {
+    threads.emplace_back([&, t]() {
+      for (size_t i = 0; i < kSize; i += strides[t]) {
+        if (bitmap.TestAndSet(i)) set_by[t].push_back(i);
+      }
+    });
+  }
+  for (std::thread& thread : threads) thread.join();
+  // TestAndSet returned true exactly once for each bit that was set.
+  std::vector<uint32_t> set;
+  for (const auto& bits : set_by) {
+    set.insert(set.end(), bits.begin(), bits.end());
+  }
+  std::sort(set.begin(), set.end());
+  std::vector<uint32_t> expected;
+  for (size_t i = 0; i < kSize; i++) {
+    EXPECT_EQ(bitmap.Get(i), i % 2 == 0 || i % 3 == 0) << i;
+    if (bitmap.Get(i)) expected.push_back(i);
+  }
+  EXPECT_EQ(set, expected);
+  bitmap.Clear();
+  for (size_t i = 0; i < kSize; i++) EXPECT_FALSE(bitmap.Get(i));
+}
+
+void TestBFS(bool bottom_up, size_t num_threads) {
+  std::string name = "parallel_traversal_test_bfs" +
+                     std::string(bottom_up ? "_bottom_up" : "") +
+                     std::to_string(num_threads);
+  Graph graph = SyntheticGraph(3000, 9);
+  std::unique_ptr<CompressedGraph> compressed = Compress(name, graph);
+  std::unique_ptr<CompressedGraph> transpose =
+      bottom_up ? Compress(name + "_t", Transpose(graph)) : nullptr;
+  size_t bottom_up_levels = 0;
+  for (uint32_t root : {0, 1500, 2999}) {
+    TraversalStats stats;
+    std::vector<uint32_t> distances = ParallelBFS(
+        *compressed, transpose.get(), root, num_threads, &stats);
+    EXPECT_EQ(distances, BFS(graph, root)) << "root " << root;
+    EXPECT_GT(stats.top_down_levels, 0);
+    EXPECT_GT(stats.lists_decoded, 0);
+    bottom_up_levels += stats.bottom_up_levels;
+  }
+  // Not all roots reach enough nodes to switch direction.
+  EXPECT_EQ(bottom_up_levels > 0, bottom_up);
+}
+
+TEST(ParallelTraversalTest, TestTopDownBFS) {
+  TestBFS(/*bottom_up=*/false, /*num_threads=*/1);
+}
+
+TEST(ParallelTraversalTest, TestTopDownBFSThreads) {
+  TestBFS(/*bottom_up=*/false, /*num_threads=*/4);
+}
+
+TEST(ParallelTraversalTest, TestDirectionOptimizingBFS) {
+  TestBFS(/*bottom_up=*/true, /*num_threads=*/1);
+}
+
+TEST(ParallelTraversalTest, TestDirectionOptimizingBFSThreads) {
+  TestBFS(/*bottom_up=*/true, /*num_threads=*/4);
+}
+
+void TestConnectedComponents(size_t num_threads) {
+  // Three copies of a graph, plus a few edges from the second copy to the
+  // third one, and isolated nodes.
+  Graph part = SyntheticGraph(1000, 10);
+  Graph graph;
+  for (size_t copy = 0; copy < 3; copy++) {
+    for (const std::vector<uint32_t>& list : part) {
+      graph.emplace_back();
+      for (uint32_t node : list) graph.back().push_back(node + copy * 1000);
+    }
+  }
+  for (size_t i = 1000; i < 1100; i++) graph[i].push_back(2000 + i % 7);
+  for (std::vector<uint32_t>& list : graph) {
+    std::sort(list.begin(), list.end());
+    list.erase(std::unique(list.begin(), list.end()), list.end());
+  }
+  graph.resize(3100);
+
+  // Smallest node reachable in the undirected graph.
+  Graph undirected = Transpose(graph);
+  for (size_t i = 0; i < graph.size(); i++) {
+    undirected[i].insert(undirected[i].end(), graph[i].begin(),
+                         graph[i].end());
+  }
+  std::vector<uint32_t> expected(graph.size(), kUnreachable);
+  for (size_t i = 0; i < graph.size(); i++) {
+    if (expected[i] != kUnreachable) continue;
+    std::vector<uint32_t> distances = BFS(undirected, i);
+    for (size_t j = 0; j < graph.size(); j++) {
+      if (distances[j] != kUnreachable) expected[j] = i;
+    }
+  }
+
+  std::unique_ptr<CompressedGraph> compressed = Compress(
+      "parallel_traversal_test_cc" + std::to_string(num_threads), graph);
+  TraversalStats stats;
+  EXPECT_EQ(ParallelConnectedComponents(*compressed, num_threads, &stats),
+            expected);
+  EXPECT_EQ(stats.lists_decoded, graph.size());
+  EXPECT_EQ(stats.edges_decoded,
+            std::accumulate(graph.begin(), graph.end(), size_t{0},
+                            [](size_t sum, const std::vector<uint32_t>& list) {
+                              return sum + list.size();
+                            }));
+}
+
+TEST(ParallelTraversalTest, TestConnectedComponents) {
+  TestConnectedComponents(/*num_threads=*/1);
+}
+
+TEST(ParallelTraversalTest, TestConnectedComponentsThreads) {
+  TestConnectedComponents(/*num_threads=*/4);
+}
+
+}  // namespace
+}  // namespace zuckerli
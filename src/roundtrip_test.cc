@@ -11,14 +11,39 @@
 // WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
 // See the License for the specific language governing permissions and
 // limitations under the License.
+#include <algorithm>
+#include <numeric>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "absl/flags/flag.h"
+#include "checksum.h"
 #include "decode.h"
+#include "decode_uncompressed.h"
 #include "encode.h"
 #include "gtest/gtest.h"
+#include "memory_mapped_file.h"
+#include "test_utils.h"
 #include "uncompressed_graph.h"
 
 namespace zuckerli {
 namespace {
 
+void CheckDegrees(const uint8_t* compressed, size_t compressed_size,
+                  const UncompressedGraph& g) {
+  std::vector<size_t> degrees;
+  ASSERT_TRUE(DecodeDegrees(compressed, compressed_size,
+                            [&](size_t node, size_t degree) {
+                              ASSERT_EQ(node, degrees.size());
+                              degrees.push_back(degree);
+                            }));
+  ASSERT_EQ(degrees.size(), g.size());
+  for (size_t i = 0; i < g.size(); i++) {
+    EXPECT_EQ(degrees[i], g.Degree(i)) << "node " << i;
+  }
+}
+
 TEST(RoundtripTest, TestSmallGraphSequential) {
   UncompressedGraph g(
                       TESTDATA "/small");
@@ -40,5 +65,415 @@ TEST(RoundtripTest, TestSmallGraphRandomAccess) {
   EXPECT_EQ(checksum, decoder_checksum);
 }
 
+void TestSegments(size_t nodes_per_segment) {
+  absl::SetFlag(&FLAGS_nodes_per_segment, nodes_per_segment);
+  std::string name =
+      "roundtrip_test_segments" + std::to_string(nodes_per_segment);
+  UncompressedGraph g(WriteTestGraph(name, SyntheticGraph(2000, 1)));
+  size_t checksum = 0, decoder_checksum = 0;
+  std::vector<uint8_t> compressed =
+      EncodeGraph(g, /*allow_random_access=*/false, &checksum);
+  absl::SetFlag(&FLAGS_nodes_per_segment, 0);
+  EXPECT_TRUE(DecodeGraph(compressed, &decoder_checksum));
+  EXPECT_EQ(checksum, decoder_checksum);
+
+  constexpr size_t kNumThreads = 4;
+  std::vector<std::vector<std::pair<uint32_t, uint32_t>>> thread_edges(
+      kNumThreads);
+  EXPECT_TRUE(DecodeGraphParallel(
+      compressed.data(), compressed.size(), kNumThreads,
+      [&](size_t thread, size_t a, size_t b) {
+        thread_edges[thread].emplace_back(a, b);
+      }));
+  std::vector<std::vector<uint32_t>> lists(g.size());
+  for (const auto& edges : thread_edges) {
+    for (const auto& edge : edges) lists[edge.first].push_back(edge.second);
+  }
+  for (size_t i = 0; i < g.size(); i++) {
+    ASSERT_EQ(lists[i].size(), g.Degree(i)) << "node " << i;
+    for (size_t j = 0; j < g.Degree(i); j++) {
+      EXPECT_EQ(lists[i][j], g.Neighbours(i)[j]) << "node " << i;
+    }
+  }
+}
+
+TEST(RoundtripTest, TestFormatVersion) {
+  UncompressedGraph g(WriteTestGraph("roundtrip_test_version",
+                                     SyntheticGraph(100, 5)));
+  std::vector<uint8_t> compressed =
+      EncodeGraph(g, /*allow_random_access=*/false);
+  GraphHeader header;
+  ASSERT_TRUE(ReadGraphHeader(compressed.data(), compressed.size(), &header));
+  EXPECT_EQ(header.num_nodes, 100u);
+  // Unknown version.
+  std::vector<uint8_t> other_version = compressed;
+  other_version[3]++;
+  EXPECT_FALSE(
+      ReadGraphHeader(other_version.data(), other_version.size(), &header));
+  // Files without a version start with the number of nodes.
+  std::vector<uint8_t> unversioned(compressed.begin() + 4, compressed.end());
+  EXPECT_FALSE(
+      ReadGraphHeader(unversioned.data(), unversioned.size(), &header));
+  EXPECT_FALSE(DecodeGraph(unversioned));
+}
+
+TEST(RoundtripTest, TestSingleNodeSegments) { TestSegments(1); }
+
+TEST(RoundtripTest, TestSegments) { TestSegments(100); }
+
+TEST(RoundtripTest, TestUnevenSegments) { TestSegments(777); }
+
+void TestStreaming(size_t nodes_per_segment, bool degree_section = false,
+                   bool segment_hashes = false) {
+  std::vector<std::vector<uint32_t>> graph = SyntheticGraph(3000, 3);
+  std::string name = "roundtrip_test_streaming" +
+                     std::string(degree_section ? "_degrees" : "") +
+                     std::string(segment_hashes ? "_hashes" : "") +
+                     std::to_string(nodes_per_segment);
+  UncompressedGraph g(WriteTestGraph(name, graph));
+  size_t checksum = 0, decoder_checksum = 0;
+  EncodeGraph(g, /*allow_random_access=*/false, &checksum);
+
+  std::string path = ::testing::TempDir() + "/" + name + ".zkr";
+  FILE* out = fopen(path.c_str(), "wb");
+  ASSERT_TRUE(out);
+  {
+    StreamingEncoder encoder(graph.size(), nodes_per_segment, out,
+                             degree_section, segment_hashes);
+    for (const std::vector<uint32_t>& list : graph) {
+      ASSERT_TRUE(
+          encoder.AddList(span<const uint32_t>(list.data(), list.size())));
+    }
+    size_t streaming_checksum = 0;
+    ASSERT_TRUE(encoder.Finish(&streaming_checksum));
+    EXPECT_EQ(checksum, streaming_checksum);
+  }
+  fclose(out);
+
+  MemoryMappedFile compressed(path);
+  EXPECT_TRUE(
+      DecodeGraph(compressed.data(), compressed.size(), &decoder_checksum));
+  EXPECT_EQ(checksum, decoder_checksum);
+  CheckDegrees(compressed.data(), compressed.size(), g);
+}
+
+TEST(RoundtripTest, TestStreaming) { TestStreaming(/*nodes_per_segment=*/0); }
+
+TEST(RoundtripTest, TestStreamingNodesPerSegment) {
+  absl::SetFlag(&FLAGS_nodes_per_segment, 0);
+  EXPECT_EQ(StreamingNodesPerSegment(), kDefaultStreamingNodesPerSegment);
+  absl::SetFlag(&FLAGS_nodes_per_segment, 300);
+  EXPECT_EQ(StreamingNodesPerSegment(), 300);
+  absl::SetFlag(&FLAGS_nodes_per_segment, 0);
+}
+
+TEST(RoundtripTest, TestStreamingDegreeSection) {
+  TestStreaming(/*nodes_per_segment=*/0, /*degree_section=*/true);
+}
+
+TEST(RoundtripTest, TestStreamingSegmentsDegreeSection) {
+  TestStreaming(/*nodes_per_segment=*/256, /*degree_section=*/true);
+}
+
+TEST(RoundtripTest, TestStreamingSegmentHashes) {
+  TestStreaming(/*nodes_per_segment=*/256, /*degree_section=*/false,
+                /*segment_hashes=*/true);
+}
+
+TEST(RoundtripTest, TestStreamingSegments) {
+  TestStreaming(/*nodes_per_segment=*/256);
+}
+
+void TestRandomAccessStreaming(size_t degree_chunk_size,
+                               size_t max_chain_length) {
+  std::vector<std::vector<uint32_t>> graph = SyntheticGraph(3000, 4);
+  std::string name = "roundtrip_test_ra_streaming" +
+                     std::to_string(degree_chunk_size) + "_" +
+                     std::to_string(max_chain_length);
+  UncompressedGraph g(WriteTestGraph(name, graph));
+  std::string path = ::testing::TempDir() + "/" + name + ".zkr";
+  FILE* out = fopen(path.c_str(), "wb");
+  ASSERT_TRUE(out);
+  EncodeOptions options;
+  options.allow_random_access = true;
+  options.degree_chunk_size = degree_chunk_size;
+  options.max_chain_length = max_chain_length;
+  size_t checksum = 0, decoder_checksum = 0;
+  {
+    RandomAccessStreamingEncoder encoder(graph.size(), options, out,
+                                         ::testing::TempDir());
+    for (size_t pass = 0; pass < 2; pass++) {
+      for (const std::vector<uint32_t>& list : graph) {
+        ASSERT_TRUE(
+            encoder.AddList(span<const uint32_t>(list.data(), list.size())));
+      }
+      if (pass == 0) {
+        ASSERT_TRUE(encoder.StartSecondPass());
+      }
+    }
+    ASSERT_TRUE(encoder.Finish(&checksum));
+  }
+  fclose(out);
+
+  MemoryMappedFile compressed(path);
+  GraphHeader header;
+  ASSERT_TRUE(ReadGraphHeader(compressed.data(), compressed.size(), &header));
+  EXPECT_TRUE(header.allow_random_access);
+  EXPECT_EQ(header.degree_chunk_size, degree_chunk_size);
+  EXPECT_EQ(header.max_chain_length, max_chain_length);
+  EXPECT_TRUE(
+      DecodeGraph(compressed.data(), compressed.size(), &decoder_checksum));
+  EXPECT_EQ(checksum, decoder_checksum);
+  CheckDegrees(compressed.data(), compressed.size(), g);
+}
+
+TEST(RoundtripTest, TestRandomAccessStreaming) {
+  TestRandomAccessStreaming(kDegreeReferenceChunkSize, kDefaultMaxChainLength);
+}
+
+TEST(RoundtripTest, TestRandomAccessStreamingSmallChunks) {
+  TestRandomAccessStreaming(/*degree_chunk_size=*/4, /*max_chain_length=*/1);
+}
+
+TEST(RoundtripTest, TestRandomAccessStreamingNoReferences) {
+  TestRandomAccessStreaming(kDegreeReferenceChunkSize,
+                            /*max_chain_length=*/0);
+}
+
+TEST(RoundtripTest, TestRandomAccessStreamingChangedLists) {
+  std::vector<std::vector<uint32_t>> graph = SyntheticGraph(300, 5);
+  std::string path = ::testing::TempDir() + "/roundtrip_test_ra_changed.zkr";
+  FILE* out = fopen(path.c_str(), "wb");
+  ASSERT_TRUE(out);
+  RandomAccessStreamingEncoder encoder(
+      graph.size(), EncodeOptions::FromFlags(/*allow_random_access=*/true),
+      out, ::testing::TempDir());
+  for (const std::vector<uint32_t>& list : graph) {
+    ASSERT_TRUE(
+        encoder.AddList(span<const uint32_t>(list.data(), list.size())));
+  }
+  ASSERT_TRUE(encoder.StartSecondPass());
+  graph[100] = {0, 1, 2, 3, 299};
+  for (const std::vector<uint32_t>& list : graph) {
+    ASSERT_TRUE(
+        encoder.AddList(span<const uint32_t>(list.data(), list.size())));
+  }
+  EXPECT_FALSE(encoder.Finish());
+  fclose(out);
+}
+
+void TestThreads(bool allow_random_access) {
+  std::string name = std::string("roundtrip_test_threads") +
+                     (allow_random_access ? "_ra" : "");
+  UncompressedGraph g(WriteTestGraph(name, SyntheticGraph(5000, 2)));
+  absl::SetFlag(&FLAGS_num_rounds, 2);
+  absl::SetFlag(&FLAGS_num_threads, 1);
+  std::vector<uint8_t> single_threaded = EncodeGraph(g, allow_random_access);
+  absl::SetFlag(&FLAGS_num_threads, 4);
+  size_t checksum = 0, decoder_checksum = 0;
+  std::vector<uint8_t> multi_threaded =
+      EncodeGraph(g, allow_random_access, &checksum);
+  absl::SetFlag(&FLAGS_num_threads, 1);
+  absl::SetFlag(&FLAGS_num_rounds, 1);
+  EXPECT_EQ(single_threaded, multi_threaded);
+  EXPECT_TRUE(DecodeGraph(multi_threaded, &decoder_checksum));
+  EXPECT_EQ(checksum, decoder_checksum);
+}
+
+TEST(RoundtripTest, TestThreadsSequential) {
+  TestThreads(/*allow_random_access=*/false);
+}
+
+TEST(RoundtripTest, TestThreadsRandomAccess) {
+  TestThreads(/*allow_random_access=*/true);
+}
+
+void TestDegreeSection(size_t nodes_per_segment) {
+  absl::SetFlag(&FLAGS_degree_section, true);
+  absl::SetFlag(&FLAGS_nodes_per_segment, nodes_per_segment);
+  std::string name =
+      "roundtrip_test_degree_section" + std::to_string(nodes_per_segment);
+  UncompressedGraph g(WriteTestGraph(name, SyntheticGraph(2000, 6)));
+  size_t checksum = 0, decoder_checksum = 0;
+  std::vector<uint8_t> compressed =
+      EncodeGraph(g, /*allow_random_access=*/false, &checksum);
+  absl::SetFlag(&FLAGS_degree_section, false);
+  absl::SetFlag(&FLAGS_nodes_per_segment, 0);
+  EXPECT_TRUE(DecodeGraph(compressed, &decoder_checksum));
+  EXPECT_EQ(checksum, decoder_checksum);
+  CheckDegrees(compressed.data(), compressed.size(), g);
+}
+
+TEST(RoundtripTest, TestDegreeSection) {
+  TestDegreeSection(/*nodes_per_segment=*/0);
+}
+
+TEST(RoundtripTest, TestDegreeSectionSegments) {
+  TestDegreeSection(/*nodes_per_segment=*/300);
+}
+
+TEST(RoundtripTest, TestDegreesWithoutDegreeSection) {
+  UncompressedGraph g(WriteTestGraph("roundtrip_test_degrees",
+                                     SyntheticGraph(1000, 7)));
+  for (bool allow_random_access : {false, true}) {
+    std::vector<uint8_t> compressed = EncodeGraph(g, allow_random_access);
+    CheckDegrees(compressed.data(), compressed.size(), g);
+  }
+}
+
+void TestRefCandidates(bool allow_random_access) {
+  std::string name = std::string("roundtrip_test_ref_candidates") +
+                     (allow_random_access ? "_ra" : "");
+  UncompressedGraph g(WriteTestGraph(name, SyntheticGraph(2000, 9)));
+  std::vector<uint8_t> exhaustive = EncodeGraph(g, allow_random_access);
+  absl::SetFlag(&FLAGS_ref_candidates, 4);
+  size_t checksum = 0, decoder_checksum = 0;
+  std::vector<uint8_t> compressed =
+      EncodeGraph(g, allow_random_access, &checksum);
+  absl::SetFlag(&FLAGS_ref_candidates, 0);
+  EXPECT_TRUE(DecodeGraph(compressed, &decoder_checksum));
+  EXPECT_EQ(checksum, decoder_checksum);
+  // Only a few candidates, but the most promising ones.
+  EXPECT_LE(compressed.size(), exhaustive.size() * 1.02);
+}
+
+TEST(RoundtripTest, TestRefCandidatesSequential) {
+  TestRefCandidates(/*allow_random_access=*/false);
+}
+
+TEST(RoundtripTest, TestRefCandidatesRandomAccess) {
+  TestRefCandidates(/*allow_random_access=*/true);
+}
+
+TEST(RoundtripTest, TestMaxChainLength) {
+  UncompressedGraph g(WriteTestGraph("roundtrip_test_max_chain_length",
+                                     SyntheticGraph(2000, 10)));
+  std::vector<size_t> sizes;
+  for (size_t max_chain_length = 0; max_chain_length <= 7;
+       max_chain_length++) {
+    absl::SetFlag(&FLAGS_max_chain_length, max_chain_length);
+    size_t checksum = 0, decoder_checksum = 0;
+    std::vector<uint8_t> compressed =
+        EncodeGraph(g, /*allow_random_access=*/true, &checksum);
+    EXPECT_TRUE(DecodeGraph(compressed, &decoder_checksum));
+    EXPECT_EQ(checksum, decoder_checksum);
+    sizes.push_back(compressed.size());
+  }
+  absl::SetFlag(&FLAGS_max_chain_length, 3);
+  // Without chains, no list can use a reference.
+  EXPECT_GT(sizes[0], sizes[1]);
+  EXPECT_GT(sizes[1], sizes[7]);
+}
+
+void TestSegmentHashes(bool allow_random_access, size_t nodes_per_segment) {
+  absl::SetFlag(&FLAGS_segment_hashes, true);
+  absl::SetFlag(&FLAGS_nodes_per_segment, nodes_per_segment);
+  std::string name = "roundtrip_test_hashes" +
+                     std::string(allow_random_access ? "_ra" : "") +
+                     std::to_string(nodes_per_segment);
+  UncompressedGraph g(WriteTestGraph(name, SyntheticGraph(2000, 8)));
+  size_t checksum = 0, decoder_checksum = 0;
+  std::vector<uint8_t> compressed =
+      EncodeGraph(g, allow_random_access, &checksum);
+  absl::SetFlag(&FLAGS_segment_hashes, false);
+  absl::SetFlag(&FLAGS_nodes_per_segment, 0);
+  EXPECT_TRUE(DecodeGraph(compressed, &decoder_checksum));
+  EXPECT_EQ(checksum, decoder_checksum);
+
+  // The checksum does not depend on the order of the edges.
+  std::vector<size_t> thread_checksums(4);
+  EXPECT_TRUE(DecodeGraphParallel(compressed.data(), compressed.size(),
+                                  thread_checksums.size(),
+                                  [&](size_t thread, size_t a, size_t b) {
+                                    thread_checksums[thread] += EdgeHash(a, b);
+                                  }));
+  EXPECT_EQ(std::accumulate(thread_checksums.begin(), thread_checksums.end(),
+                            size_t{0}),
+            checksum);
+
+  // Hashes are stored just before the offset index.
+  GraphHeader header;
+  ASSERT_TRUE(ReadGraphHeader(compressed.data(), compressed.size(), &header));
+  ASSERT_EQ(header.segment_hashes.size(), header.NumSegments());
+  compressed[header.offset_index_start - 1] ^= 1;
+  EXPECT_FALSE(DecodeGraph(compressed));
+}
+
+TEST(RoundtripTest, TestSegmentHashes) {
+  TestSegmentHashes(/*allow_random_access=*/false, /*nodes_per_segment=*/300);
+}
+
+TEST(RoundtripTest, TestSegmentHashesRandomAccess) {
+  TestSegmentHashes(/*allow_random_access=*/true, /*nodes_per_segment=*/0);
+}
+
+void TestDecodeToUncompressed(bool allow_random_access, size_t num_threads,
+                              bool degree_section = false) {
+  absl::SetFlag(&FLAGS_nodes_per_segment, 300);
+  absl::SetFlag(&FLAGS_degree_section, degree_section);
+  std::string name = "roundtrip_test_uncompressed" +
+                     std::string(allow_random_access ? "_ra" : "") +
+                     std::string(degree_section ? "_degrees" : "") +
+                     std::to_string(num_threads);
+  std::vector<std::vector<uint32_t>> graph = SyntheticGraph(2000, 5);
+  // Trailing nodes without edges.
+  graph.resize(graph.size() + 3);
+  UncompressedGraph g(WriteTestGraph(name, graph));
+  std::vector<uint8_t> compressed = EncodeGraph(g, allow_random_access);
+  absl::SetFlag(&FLAGS_nodes_per_segment, 0);
+  absl::SetFlag(&FLAGS_degree_section, false);
+  std::string path = ::testing::TempDir() + "/" + name + ".out";
+  ASSERT_TRUE(DecodeToUncompressedGraph(compressed.data(), compressed.size(),
+                                        path, num_threads));
+  std::vector<uint8_t> expected = SerializeUncompressedGraph(graph);
+  MemoryMappedFile f(path);
+  ASSERT_EQ(f.size(), expected.size());
+  EXPECT_TRUE(std::equal(expected.begin(), expected.end(), f.data()));
+}
+
+TEST(RoundtripTest, TestDecodeToUncompressedSequential) {
+  TestDecodeToUncompressed(/*allow_random_access=*/false, /*num_threads=*/1);
+}
+
+TEST(RoundtripTest, TestDecodeToUncompressedThreads) {
+  TestDecodeToUncompressed(/*allow_random_access=*/false, /*num_threads=*/4);
+}
+
+TEST(RoundtripTest, TestDecodeToUncompressedRandomAccess) {
+  TestDecodeToUncompressed(/*allow_random_access=*/true, /*num_threads=*/4);
+}
+
+TEST(RoundtripTest, TestDecodeToUncompressedDegreeSection) {
+  TestDecodeToUncompressed(/*allow_random_access=*/false, /*num_threads=*/4,
+                           /*degree_section=*/true);
+}
+
+TEST(RoundtripTest, TestDecodeToUncompressedRenumbered) {
+  absl::SetFlag(&FLAGS_nodes_per_segment, 300);
+  absl::SetFlag(&FLAGS_degree_section, true);
+  std::string name = "roundtrip_test_uncompressed_renumbered";
+  std::vector<std::vector<uint32_t>> graph = SyntheticGraph(2003, 5);
+  UncompressedGraph g(WriteTestGraph(name, graph));
+  std::vector<uint8_t> compressed =
+      EncodeGraph(g, /*allow_random_access=*/false);
+  absl::SetFlag(&FLAGS_nodes_per_segment, 0);
+  absl::SetFlag(&FLAGS_degree_section, false);
+  // 2003 is prime, so this is a permutation.
+  std::vector<uint32_t> new_ids(graph.size());
+  for (size_t i = 0; i < graph.size(); i++) new_ids[i] = i * 7 % graph.size();
+  std::vector<std::vector<uint32_t>> renumbered(graph.size());
+  for (size_t i = 0; i < graph.size(); i++) {
+    for (uint32_t j : graph[i]) renumbered[new_ids[i]].push_back(new_ids[j]);
+    std::sort(renumbered[new_ids[i]].begin(), renumbered[new_ids[i]].end());
+  }
+  std::string path = ::testing::TempDir() + "/" + name + ".out";
+  ASSERT_TRUE(DecodeToUncompressedGraph(compressed.data(), compressed.size(),
+                                        path, /*num_threads=*/4, &new_ids));
+  std::vector<uint8_t> expected = SerializeUncompressedGraph(renumbered);
+  MemoryMappedFile f(path);
+  ASSERT_EQ(f.size(), expected.size());
+  EXPECT_TRUE(std::equal(expected.begin(), expected.end(), f.data()));
+}
+
 }  // namespace
 }  // namespace zuckerli
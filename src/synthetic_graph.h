@@ -0,0 +1,91 @@
+// Copyright 2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#ifndef ZUCKERLI_SYNTHETIC_GRAPH_H
+#define ZUCKERLI_SYNTHETIC_GRAPH_H
+#include <stdint.h>
+
+#include <algorithm>
+#include <random>
+#include <vector>
+
+#include "uncompressed_graph.h"
+
+namespace zuckerli {
+
+// Generates a graph with some of the structure of web graphs: locality of
+// neighbours, similarity between the lists of nearby nodes, runs of
+// consecutive neighbours and empty lists.
+inline std::vector<std::vector<uint32_t>> SyntheticGraph(size_t N,
+                                                         uint32_t seed) {
+  std::mt19937 rng(seed);
+  std::vector<std::vector<uint32_t>> graph(N);
+  auto node_near = [&](size_t i, size_t window) -> uint32_t {
+    std::uniform_int_distribution<int64_t> dist(-int64_t(window), window);
+    return std::min<int64_t>(std::max<int64_t>(int64_t(i) + dist(rng), 0),
+                             N - 1);
+  };
+  for (size_t i = 0; i < N; i++) {
+    std::vector<uint32_t>& list = graph[i];
+    if (rng() % 8 == 0) continue;
+    if (i > 0 && rng() % 2 == 0) {
+      size_t other = i - 1 - rng() % std::min<size_t>(i, 8);
+      for (uint32_t x : graph[other]) {
+        if (rng() % 4 != 0) list.push_back(x);
+      }
+    }
+    size_t num_local = rng() % 12;
+    for (size_t j = 0; j < num_local; j++) list.push_back(node_near(i, 64));
+    if (rng() % 4 == 0) {
+      size_t start = node_near(i, 16);
+      for (size_t j = start; j < std::min(N, start + 2 + rng() % 16); j++) {
+        list.push_back(j);
+      }
+    }
+    if (rng() % 64 == 0) {
+      for (size_t j = 0; j < N; j += 1 + rng() % 4) list.push_back(j);
+    }
+    if (rng() % 2 == 0) list.push_back(rng() % N);
+    std::sort(list.begin(), list.end());
+    list.erase(std::unique(list.begin(), list.end()), list.end());
+  }
+  return graph;
+}
+
+// Returns `graph` in the format described in uncompressed_graph.h.
+inline std::vector<uint8_t> SerializeUncompressedGraph(
+    const std::vector<std::vector<uint32_t>>& graph) {
+  std::vector<uint8_t> data;
+  auto append = [&](const void* ptr, size_t size) {
+    const uint8_t* bytes = static_cast<const uint8_t*>(ptr);
+    data.insert(data.end(), bytes, bytes + size);
+  };
+  uint64_t fingerprint = UncompressedGraph::kFingerprint;
+  append(&fingerprint, sizeof(fingerprint));
+  uint32_t num_nodes = graph.size();
+  append(&num_nodes, sizeof(num_nodes));
+  uint64_t start = 0;
+  for (const auto& list : graph) {
+    append(&start, sizeof(start));
+    start += list.size();
+  }
+  append(&start, sizeof(start));
+  for (const auto& list : graph) {
+    append(list.data(), list.size() * sizeof(uint32_t));
+  }
+  return data;
+}
+
+}  // namespace zuckerli
+
+#endif  // ZUCKERLI_SYNTHETIC_GRAPH_H
@@ -0,0 +1,47 @@
+// Copyright 2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#ifndef ZUCKERLI_TEST_UTILS_H
+#define ZUCKERLI_TEST_UTILS_H
+#include <stdint.h>
+#include <stdio.h>
+
+#include <string>
+#include <vector>
+
+#include "common.h"
+#include "gtest/gtest.h"
+#include "synthetic_graph.h"
+
+namespace zuckerli {
+
+inline std::string WriteTestFile(const std::string& name,
+                                 const std::vector<uint8_t>& data) {
+  std::string path = ::testing::TempDir() + "/" + name;
+  FILE* f = fopen(path.c_str(), "wb");
+  ZKR_ASSERT(f);
+  ZKR_ASSERT(fwrite(data.data(), 1, data.size(), f) == data.size());
+  fclose(f);
+  return path;
+}
+
+// Writes `graph` in the format described in uncompressed_graph.h, and returns
+// the path of the file.
+inline std::string WriteTestGraph(
+    const std::string& name, const std::vector<std::vector<uint32_t>>& graph) {
+  return WriteTestFile(name, SerializeUncompressedGraph(graph));
+}
+
+}  // namespace zuckerli
+
+#endif  // ZUCKERLI_TEST_UTILS_H
@@ -0,0 +1,130 @@
+// Copyright 2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#include "transpose.h"
+
+#include "absl/flags/flag.h"
+#include "decode.h"
+#include "encode.h"
+#include "graph_header.h"
+
+namespace zuckerli {
+
+ExternalEdgeSorter::ExternalEdgeSorter(const std::string& temp_dir,
+                                       size_t max_edges_in_memory)
+    : temp_dir_(temp_dir),
+      max_edges_in_memory_(std::max<size_t>(1, max_edges_in_memory)) {}
+
+ExternalEdgeSorter::~ExternalEdgeSorter() {
+  for (Run& run : runs_) fclose(run.file);
+}
+
+bool ExternalEdgeSorter::WriteRun() {
+  std::sort(buffer_.begin(), buffer_.end());
+  buffer_.erase(std::unique(buffer_.begin(), buffer_.end()), buffer_.end());
+  FILE* file = CreateTemporaryFile(temp_dir_);
+  if (file == nullptr) {
+    return ZKR_FAILURE("Could not create a temporary file");
+  }
+  runs_.emplace_back();
+  runs_.back().file = file;
+  runs_.back().size = buffer_.size();
+  if (fwrite(buffer_.data(), sizeof(uint64_t), buffer_.size(), file) !=
+          buffer_.size() ||
+      fflush(file) != 0) {
+    return ZKR_FAILURE("Write error");
+  }
+  buffer_.clear();
+  return true;
+}
+
+bool ExternalEdgeSorter::ReadBlock(Run* run, size_t block_size) {
+  run->block.resize(std::min(block_size, run->remaining));
+  run->pos = 0;
+  if (fread(run->block.data(), sizeof(uint64_t), run->block.size(),
+            run->file) != run->block.size()) {
+    return ZKR_FAILURE("Read error");
+  }
+  run->remaining -= run->block.size();
+  return true;
+}
+
+namespace {
+
+// Adds to `encoder` the lists of the `num_nodes` nodes, with the edges of
+// `sorter`.
+template <typename Encoder>
+bool AddSortedLists(ExternalEdgeSorter* sorter, size_t num_nodes,
+                    Encoder* encoder) {
+  bool ok = true;
+  size_t node = 0;
+  std::vector<uint32_t> list;
+  auto add_lists_until = [&](size_t end) {
+    for (; ok && node < end; node++) {
+      ok = encoder->AddList(span<const uint32_t>(list.data(), list.size()));
+      list.clear();
+    }
+  };
+  ZKR_RETURN_IF_ERROR(sorter->Merge([&](uint32_t a, uint32_t b) {
+    add_lists_until(a);
+    list.push_back(b);
+  }));
+  add_lists_until(num_nodes);
+  return ok;
+}
+
+}  // namespace
+
+bool TransposeGraph(const uint8_t* compressed, size_t compressed_size,
+                    bool symmetric, const std::string& temp_dir,
+                    size_t max_edges_in_memory, FILE* out, size_t* checksum) {
+  if (symmetric && absl::GetFlag(FLAGS_allow_random_access)) {
+    return ZKR_FAILURE("Symmetric graphs cannot have random access");
+  }
+  GraphHeader header;
+  ZKR_RETURN_IF_ERROR(ReadGraphHeader(compressed, compressed_size, &header));
+  if (header.num_nodes > (size_t{1} << 32)) {
+    return ZKR_FAILURE("Too many nodes");
+  }
+  ExternalEdgeSorter sorter(temp_dir, max_edges_in_memory);
+  bool ok = true;
+  // Adds (a, b) to the output graph.
+  auto add = [&](uint32_t a, uint32_t b) {
+    if (symmetric && b > a) std::swap(a, b);
+    if (ok && !sorter.Add(a, b)) ok = false;
+  };
+  ZKR_RETURN_IF_ERROR(DecodeGraphParallel(
+      compressed, compressed_size, /*num_threads=*/1,
+      [&](size_t thread, size_t a, size_t b) {
+        add(b, a);
+        if (header.symmetric && a != b) add(a, b);
+      }));
+  ZKR_RETURN_IF_ERROR(ok);
+
+  if (absl::GetFlag(FLAGS_allow_random_access)) {
+    RandomAccessStreamingEncoder encoder(
+        header.num_nodes,
+        EncodeOptions::FromFlags(/*allow_random_access=*/true), out, temp_dir);
+    ZKR_RETURN_IF_ERROR(AddSortedLists(&sorter, header.num_nodes, &encoder));
+    ZKR_RETURN_IF_ERROR(encoder.StartSecondPass());
+    ZKR_RETURN_IF_ERROR(AddSortedLists(&sorter, header.num_nodes, &encoder));
+    return encoder.Finish(checksum);
+  }
+  StreamingEncoder encoder(header.num_nodes, StreamingNodesPerSegment(), out,
+                           absl::GetFlag(FLAGS_degree_section),
+                           absl::GetFlag(FLAGS_segment_hashes), symmetric);
+  ZKR_RETURN_IF_ERROR(AddSortedLists(&sorter, header.num_nodes, &encoder));
+  return encoder.Finish(checksum);
+}
+
+}  // namespace zuckerli
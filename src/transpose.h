@@ -0,0 +1,148 @@
+// Copyright 2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#ifndef ZUCKERLI_TRANSPOSE_H
+#define ZUCKERLI_TRANSPOSE_H
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <algorithm>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "common.h"
+
+namespace zuckerli {
+
+// Sorts edges that may not fit in memory. Added edges are buffered until there
+// are `max_edges_in_memory` of them; the buffer is then sorted and written as a
+// run to an (already unlinked) temporary file in `temp_dir`. Merge() reads the
+// runs back in blocks that together hold at most `max_edges_in_memory` edges,
+// so that memory use does not depend on the number of edges.
+class ExternalEdgeSorter {
+ public:
+  ExternalEdgeSorter(const std::string& temp_dir, size_t max_edges_in_memory);
+  ~ExternalEdgeSorter();
+
+  ExternalEdgeSorter(const ExternalEdgeSorter&) = delete;
+  ExternalEdgeSorter& operator=(const ExternalEdgeSorter&) = delete;
+
+  // Returns false on write errors.
+  bool Add(uint32_t a, uint32_t b) {
+    buffer_.push_back(uint64_t{a} << 32 | b);
+    if (buffer_.size() >= max_edges_in_memory_) return WriteRun();
+    return true;
+  }
+
+  // Calls `cb(a, b)` for every distinct edge that was added, in increasing
+  // order of a and then of b. No edges can be added after the first call.
+  template <typename CB>
+  bool Merge(const CB& cb);
+
+  size_t NumRuns() const { return runs_.size(); }
+
+ private:
+  struct Run {
+    FILE* file = nullptr;
+    size_t size = 0;
+    // Edges left in the file.
+    size_t remaining = 0;
+    std::vector<uint64_t> block;
+    size_t pos = 0;
+  };
+
+  bool WriteRun();
+  // Reads the next block of `run`; returns false on read errors.
+  bool ReadBlock(Run* run, size_t block_size);
+
+  std::string temp_dir_;
+  size_t max_edges_in_memory_;
+  std::vector<uint64_t> buffer_;
+  std::vector<Run> runs_;
+};
+
+template <typename CB>
+bool ExternalEdgeSorter::Merge(const CB& cb) {
+  std::sort(buffer_.begin(), buffer_.end());
+  if (runs_.empty()) {
+    for (size_t i = 0; i < buffer_.size(); i++) {
+      if (i != 0 && buffer_[i] == buffer_[i - 1]) continue;
+      cb(buffer_[i] >> 32, buffer_[i] & 0xFFFFFFFF);
+    }
+    return true;
+  }
+  if (!buffer_.empty()) ZKR_RETURN_IF_ERROR(WriteRun());
+  std::vector<uint64_t>().swap(buffer_);
+  for (Run& run : runs_) {
+    if (fseek(run.file, 0, SEEK_SET) != 0) return ZKR_FAILURE("Read error");
+    run.remaining = run.size;
+  }
+  size_t block_size = std::max<size_t>(1, max_edges_in_memory_ / runs_.size());
+  // Min-heap of (next edge, run).
+  std::vector<std::pair<uint64_t, size_t>> heap;
+  auto greater = [](const std::pair<uint64_t, size_t>& a,
+                    const std::pair<uint64_t, size_t>& b) { return a > b; };
+  for (size_t i = 0; i < runs_.size(); i++) {
+    ZKR_RETURN_IF_ERROR(ReadBlock(&runs_[i], block_size));
+    heap.emplace_back(runs_[i].block[0], i);
+  }
+  std::make_heap(heap.begin(), heap.end(), greater);
+  bool first = true;
+  uint64_t last = 0;
+  while (!heap.empty()) {
+    std::pop_heap(heap.begin(), heap.end(), greater);
+    uint64_t edge = heap.back().first;
+    Run& run = runs_[heap.back().second];
+    if (first || edge != last) cb(edge >> 32, edge & 0xFFFFFFFF);
+    first = false;
+    last = edge;
+    if (++run.pos == run.block.size()) {
+      if (run.remaining == 0) {
+        heap.pop_back();
+        continue;
+      }
+      ZKR_RETURN_IF_ERROR(ReadBlock(&run, block_size));
+    }
+    heap.back().first = run.block[run.pos];
+    std::push_heap(heap.begin(), heap.end(), greater);
+  }
+  return true;
+}
+
+// Writes the transpose of the compressed graph `compressed` to `out`, encoded
+// with the parameters given by the flags. Edges go through an
+// ExternalEdgeSorter, so memory use does not depend on the number of edges,
+// other than through `compressed` itself, which can be a memory mapping, and
+// through the size of the segments of the encoder:
+// - by default, as a sequential graph encoded by a StreamingEncoder
+//   (StreamingNodesPerSegment(), --degree_section, --segment_hashes);
+// - with --allow_random_access, as a random-access graph that can be opened by
+//   CompressedGraph, encoded by a RandomAccessStreamingEncoder
+//   (EncodeOptions::FromFlags(), --offset_index, --segment_hashes). The sorted
+//   edges are then read twice, and the encoder uses a few bytes per node.
+//
+// If `symmetric`, writes instead the symmetric graph with the edges of the
+// input in both directions, storing each undirected edge once (see
+// graph_header.h); symmetric graphs are always sequential. Symmetric inputs
+// are read with their full lists, so their transpose is the same graph, but
+// not marked as symmetric.
+bool TransposeGraph(const uint8_t* compressed, size_t compressed_size,
+                    bool symmetric, const std::string& temp_dir,
+                    size_t max_edges_in_memory, FILE* out,
+                    size_t* checksum = nullptr);
+
+}  // namespace zuckerli
+
+#endif  // ZUCKERLI_TRANSPOSE_H
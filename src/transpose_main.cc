@@ -0,0 +1,60 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <chrono>
+#include <string>
+
+#include "absl/flags/flag.h"
+#include "absl/flags/parse.h"
+#include "encode.h"
+#include "memory_mapped_file.h"
+#include "transpose.h"
+
+ABSL_FLAG(std::string, input_path, "", "Input compressed graph");
+ABSL_FLAG(std::string, output_path, "",
+          "Output compressed graph: a sequential graph, or with "
+          "--allow_random_access, a random-access graph that can be queried "
+          "with CompressedGraph (the sorted edges are then read twice)");
+ABSL_FLAG(bool, symmetric, false,
+          "Write the symmetric graph with the edges of the input in both "
+          "directions, storing each undirected edge once, instead of the "
+          "transpose. Incompatible with --allow_random_access");
+ABSL_FLAG(std::string, temp_dir, "/tmp",
+          "Directory for the sorted runs of edges");
+ABSL_FLAG(uint64_t, max_edges_in_memory, uint64_t{1} << 27,
+          "Number of edges (8 bytes each) to sort in memory before writing a "
+          "run to --temp_dir. The encoder also holds one segment of "
+          "--nodes_per_segment nodes (65536 if 0), or a few bytes per node "
+          "with --allow_random_access");
+
+int main(int argc, char** argv) {
+  absl::ParseCommandLine(argc, argv);
+  if (absl::GetFlag(FLAGS_allow_random_access) &&
+      !zuckerli::CheckEncodeOptionFlags()) {
+    return EXIT_FAILURE;
+  }
+  zuckerli::MemoryMappedFile in(absl::GetFlag(FLAGS_input_path),
+                                /*populate=*/false);
+  FILE* out = fopen(absl::GetFlag(FLAGS_output_path).c_str(), "wb");
+  if (out == nullptr) {
+    fprintf(stderr, "Invalid output file %s\n",
+            absl::GetFlag(FLAGS_output_path).c_str());
+    return EXIT_FAILURE;
+  }
+  auto start = std::chrono::high_resolution_clock::now();
+  if (!zuckerli::TransposeGraph(in.data(), in.size(),
+                                absl::GetFlag(FLAGS_symmetric),
+                                absl::GetFlag(FLAGS_temp_dir),
+                                absl::GetFlag(FLAGS_max_edges_in_memory),
+                                out)) {
+    fprintf(stderr, "Transposition failed\n");
+    fclose(out);
+    return EXIT_FAILURE;
+  }
+  auto stop = std::chrono::high_resolution_clock::now();
+  fclose(out);
+  fprintf(stderr, "Wrote %s in %.3fs\n",
+          absl::GetFlag(FLAGS_output_path).c_str(),
+          std::chrono::duration<double>(stop - start).count());
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,237 @@
+// Copyright 2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#include "transpose.h"
+
+#include <algorithm>
+#include <random>
+#include <vector>
+
+#include "absl/flags/flag.h"
+#include "compressed_graph.h"
+#include "decode.h"
+#include "decode_uncompressed.h"
+#include "encode.h"
+#include "gtest/gtest.h"
+#include "memory_mapped_file.h"
+#include "test_utils.h"
+#include "uncompressed_graph.h"
+
+namespace zuckerli {
+namespace {
+
+TEST(TransposeTest, TestExternalEdgeSorter) {
+  std::mt19937 rng(0);
+  std::vector<uint64_t> edges;
+  // Several runs, and duplicates both within and across runs.
+  ExternalEdgeSorter sorter(::testing::TempDir(), /*max_edges_in_memory=*/1000);
+  for (size_t i = 0; i < 10000; i++) {
+    uint32_t a = rng() % 100, b = rng() % 1000;
+    edges.push_back(uint64_t{a} << 32 | b);
+    ASSERT_TRUE(sorter.Add(a, b));
+  }
+  EXPECT_EQ(sorter.NumRuns(), 10);
+  std::sort(edges.begin(), edges.end());
+  edges.erase(std::unique(edges.begin(), edges.end()), edges.end());
+  std::vector<uint64_t> sorted;
+  ASSERT_TRUE(sorter.Merge([&](uint32_t a, uint32_t b) {
+    sorted.push_back(uint64_t{a} << 32 | b);
+  }));
+  EXPECT_EQ(sorted, edges);
+}
+
+// Sets --allow_random_access until the end of the scope, which selects the
+// output mode of TransposeGraph.
+class ScopedAllowRandomAccess {
+ public:
+  explicit ScopedAllowRandomAccess(bool value)
+      : saved_(absl::GetFlag(FLAGS_allow_random_access)) {
+    absl::SetFlag(&FLAGS_allow_random_access, value);
+  }
+  ~ScopedAllowRandomAccess() {
+    absl::SetFlag(&FLAGS_allow_random_access, saved_);
+  }
+
+ private:
+  bool saved_;
+};
+
+// Transposes (or symmetrizes) the encoding of `graph` into a random-access
+// graph if `to_random_access`, and checks that decoding the result gives
+// `expected`.
+void CheckTranspose(const std::string& name,
+                    const std::vector<std::vector<uint32_t>>& graph,
+                    bool allow_random_access, bool symmetric,
+                    size_t max_edges_in_memory, bool to_random_access,
+                    const std::vector<std::vector<uint32_t>>& expected) {
+  UncompressedGraph g(WriteTestGraph(name, graph));
+  std::vector<uint8_t> compressed = EncodeGraph(g, allow_random_access);
+  std::string path = ::testing::TempDir() + "/" + name + ".zkr";
+  FILE* out = fopen(path.c_str(), "wb");
+  ASSERT_TRUE(out);
+  {
+    ScopedAllowRandomAccess output_mode(to_random_access);
+    ASSERT_TRUE(TransposeGraph(compressed.data(), compressed.size(),
+                               symmetric, ::testing::TempDir(),
+                               max_edges_in_memory, out));
+  }
+  fclose(out);
+
+  MemoryMappedFile transposed(path);
+  GraphHeader header;
+  ASSERT_TRUE(ReadGraphHeader(transposed.data(), transposed.size(), &header));
+  EXPECT_EQ(header.symmetric, symmetric);
+  EXPECT_EQ(header.allow_random_access, to_random_access);
+  if (header.allow_random_access) {
+    CompressedGraph compressed_graph(path);
+    ASSERT_EQ(compressed_graph.size(), expected.size());
+    for (size_t i = 0; i < expected.size(); i++) {
+      EXPECT_EQ(compressed_graph.Neighbours(i), expected[i]) << "node " << i;
+    }
+  }
+  std::string output_path = path + ".out";
+  ASSERT_TRUE(DecodeToUncompressedGraph(transposed.data(), transposed.size(),
+                                        output_path));
+  MemoryMappedFile decoded(output_path);
+  std::vector<uint8_t> expected_data = SerializeUncompressedGraph(expected);
+  ASSERT_EQ(decoded.size(), expected_data.size());
+  EXPECT_TRUE(std::equal(expected_data.begin(), expected_data.end(),
+                         decoded.data()));
+}
+
+std::vector<std::vector<uint32_t>> Transpose(
+    const std::vector<std::vector<uint32_t>>& graph) {
+  std::vector<std::vector<uint32_t>> transpose(graph.size());
+  for (size_t i = 0; i < graph.size(); i++) {
+    for (uint32_t j : graph[i]) transpose[j].push_back(i);
+  }
+  return transpose;
+}
+
+std::vector<std::vector<uint32_t>> Symmetrize(
+    const std::vector<std::vector<uint32_t>>& graph) {
+  std::vector<std::vector<uint32_t>> symmetric = Transpose(graph);
+  for (size_t i = 0; i < graph.size(); i++) {
+    std::vector<uint32_t>& list = symmetric[i];
+    list.insert(list.end(), graph[i].begin(), graph[i].end());
+    std::sort(list.begin(), list.end());
+    list.erase(std::unique(list.begin(), list.end()), list.end());
+  }
+  return symmetric;
+}
+
+// Each combination of parameters gets its own files, as tests may run
+// concurrently in separate processes.
+void TestTranspose(bool allow_random_access, bool symmetric,
+                   size_t max_edges_in_memory, bool to_random_access = false) {
+  std::string name = std::string("transpose_test") +
+                     (allow_random_access ? "_ra" : "") +
+                     (symmetric ? "_sym" : "") +
+                     (to_random_access ? "_to_ra" : "") +
+                     std::to_string(max_edges_in_memory);
+  std::vector<std::vector<uint32_t>> graph = SyntheticGraph(2000, 7);
+  CheckTranspose(name, graph, allow_random_access, symmetric,
+                 max_edges_in_memory, to_random_access,
+                 symmetric ? Symmetrize(graph) : Transpose(graph));
+}
+
+TEST(TransposeTest, TestTransposeInMemory) {
+  TestTranspose(/*allow_random_access=*/false, /*symmetric=*/false,
+                /*max_edges_in_memory=*/1 << 24);
+}
+
+TEST(TransposeTest, TestTransposeRuns) {
+  TestTranspose(/*allow_random_access=*/false, /*symmetric=*/false,
+                /*max_edges_in_memory=*/5000);
+}
+
+TEST(TransposeTest, TestTransposeRandomAccess) {
+  TestTranspose(/*allow_random_access=*/true, /*symmetric=*/false,
+                /*max_edges_in_memory=*/5000);
+}
+
+TEST(TransposeTest, TestTransposeToRandomAccess) {
+  TestTranspose(/*allow_random_access=*/false, /*symmetric=*/false,
+                /*max_edges_in_memory=*/5000, /*to_random_access=*/true);
+  TestTranspose(/*allow_random_access=*/true, /*symmetric=*/false,
+                /*max_edges_in_memory=*/1 << 24, /*to_random_access=*/true);
+}
+
+TEST(TransposeTest, TestSymmetricRandomAccess) {
+  UncompressedGraph g(WriteTestGraph("transpose_test_sym_ra",
+                                     SyntheticGraph(100, 7)));
+  std::vector<uint8_t> compressed =
+      EncodeGraph(g, /*allow_random_access=*/false);
+  std::string path = ::testing::TempDir() + "/transpose_test_sym_ra.zkr";
+  FILE* out = fopen(path.c_str(), "wb");
+  ASSERT_TRUE(out);
+  {
+    ScopedAllowRandomAccess output_mode(true);
+    EXPECT_FALSE(TransposeGraph(compressed.data(), compressed.size(),
+                                /*symmetric=*/true, ::testing::TempDir(),
+                                /*max_edges_in_memory=*/5000, out));
+  }
+  fclose(out);
+}
+
+TEST(TransposeTest, TestSymmetric) {
+  TestTranspose(/*allow_random_access=*/false, /*symmetric=*/true,
+                /*max_edges_in_memory=*/5000);
+}
+
+TEST(TransposeTest, TestSymmetricInput) {
+  // Transposing a symmetric graph gives back its full lists.
+  std::vector<std::vector<uint32_t>> graph =
+      Symmetrize(SyntheticGraph(2000, 8));
+  std::string name = "transpose_test_symmetric_input";
+  std::string path = ::testing::TempDir() + "/" + name + ".zkr";
+  FILE* out = fopen(path.c_str(), "wb");
+  ASSERT_TRUE(out);
+  {
+    StreamingEncoder encoder(graph.size(), /*nodes_per_segment=*/256, out,
+                             /*degree_section=*/false,
+                             /*segment_hashes=*/false, /*symmetric=*/true);
+    std::vector<uint32_t> upper = {0, 1};
+    EXPECT_FALSE(
+        encoder.AddList(span<const uint32_t>(upper.data(), upper.size())));
+    for (size_t i = 0; i < graph.size(); i++) {
+      const std::vector<uint32_t>& list = graph[i];
+      size_t size =
+          std::upper_bound(list.begin(), list.end(), i) - list.begin();
+      ASSERT_TRUE(encoder.AddList(span<const uint32_t>(list.data(), size)));
+    }
+    ASSERT_TRUE(encoder.Finish());
+  }
+  fclose(out);
+  MemoryMappedFile symmetric(path);
+  std::string transposed_path = path + ".t";
+  out = fopen(transposed_path.c_str(), "wb");
+  ASSERT_TRUE(out);
+  ASSERT_TRUE(TransposeGraph(symmetric.data(), symmetric.size(),
+                             /*symmetric=*/false, ::testing::TempDir(),
+                             /*max_edges_in_memory=*/5000, out));
+  fclose(out);
+  MemoryMappedFile transposed(transposed_path);
+  for (const MemoryMappedFile* file : {&symmetric, &transposed}) {
+    std::string output_path = transposed_path + ".out";
+    ASSERT_TRUE(
+        DecodeToUncompressedGraph(file->data(), file->size(), output_path));
+    MemoryMappedFile decoded(output_path);
+    std::vector<uint8_t> expected = SerializeUncompressedGraph(graph);
+    ASSERT_EQ(decoded.size(), expected.size());
+    EXPECT_TRUE(std::equal(expected.begin(), expected.end(), decoded.data()));
+  }
+}
+
+}  // namespace
+}  // namespace zuckerli
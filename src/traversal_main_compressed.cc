@@ -1,36 +1,80 @@
 #include <chrono>
 #include <iostream>
-#include <queue>
+#include <memory>
+#include <random>
 #include <stack>
 
 #include "compressed_graph.h"
 #include "absl/flags/flag.h"
 #include "absl/flags/parse.h"
+#include "parallel.h"
+#include "parallel_traversal.h"
 #include "uncompressed_graph.h"
 
 ABSL_FLAG(std::string, input_path, "", "Input file path.");
 ABSL_FLAG(bool, dfs, false, "Run DFS (as opposed to BFS)?");
 ABSL_FLAG(bool, print, false, "Print node indices during traversal?");
+ABSL_FLAG(bool, mmap, false, "Memory-map the graph instead of reading it?");
+ABSL_FLAG(bool, batch, false,
+          "Run a level-synchronous BFS that decodes each level as a batch?");
+ABSL_FLAG(uint64_t, reference_cache_edges, 0,
+          "Number of edges of reference lists to cache (0 to disable).");
+ABSL_FLAG(bool, multi_symbol, false,
+          "Decode several small residuals per Huffman table lookup?");
+ABSL_FLAG(uint64_t, random_queries, 0,
+          "If non-zero, instead of a traversal, decode the lists of this many "
+          "random nodes from --num_threads threads sharing the graph.");
+ABSL_FLAG(bool, parallel, false,
+          "Run a parallel level-synchronous BFS from --root instead?");
+ABSL_FLAG(bool, components, false,
+          "Compute weakly connected components in parallel instead?");
+ABSL_FLAG(uint32_t, root, 0, "Root of the parallel BFS.");
+ABSL_FLAG(std::string, transpose_path, "",
+          "Transpose of the input graph, encoded with random access (for "
+          "example by transpose_graph --allow_random_access), which lets the "
+          "parallel BFS expand large frontiers bottom-up.");
+ABSL_FLAG(uint64_t, prefetch_distance, 0,
+          "Number of queued nodes whose lists the BFS prefetches ahead of "
+          "decoding them (0 to disable).");
+ABSL_FLAG(int32_t, num_threads, 0,
+          "Number of threads for --random_queries, --parallel and "
+          "--components (0 for one per hardware thread).");
 
-void TimedBFS(zuckerli::CompressedGraph graph, bool print) {
-  std::queue<uint32_t> nodes;
+// If `prefetch_distance` is not zero, the lists of the next queued nodes are
+// prefetched in groups, so that between `prefetch_distance` and twice as many
+// nodes are prefetched ahead of the one being decoded.
+void TimedBFS(const zuckerli::CompressedGraph& graph, bool print,
+              size_t prefetch_distance) {
+  // Every node is queued once, so the queue is a vector that is never popped.
+  std::vector<uint32_t> nodes;
+  nodes.reserve(graph.size());
+  size_t head = 0;
+  size_t prefetched = 0;
   std::vector<bool> visited(graph.size(), false);
+  zuckerli::NeighboursContext context;
   int num_visited = 0;
 
   std::cout << "BFS..." << std::endl;
   auto t_start = std::chrono::high_resolution_clock::now();
   for (uint32_t root = 0; root < graph.size(); root++) {
     if (visited[root]) continue;
-    nodes.push(root);
+    nodes.push_back(root);
     visited[root] = true;
     ++num_visited;
-    while (!nodes.empty()) {
-      uint32_t current_node = nodes.front();
-      nodes.pop();
+    while (head < nodes.size()) {
+      if (prefetch_distance != 0 && prefetched < head + prefetch_distance) {
+        size_t end = std::min(nodes.size(), head + 2 * prefetch_distance);
+        if (end > prefetched) {
+          graph.Prefetch(zuckerli::span<const uint32_t>(
+              nodes.data() + prefetched, end - prefetched));
+          prefetched = end;
+        }
+      }
+      uint32_t current_node = nodes[head++];
       if (print) std::cout << current_node << " ";
-      for (uint32_t neighbour : graph.Neighbours(current_node)) {
+      for (uint32_t neighbour : graph.Neighbours(current_node, &context)) {
         if (!visited[neighbour]) {
-          nodes.push(neighbour);
+          nodes.push_back(neighbour);
           visited[neighbour] = true;
           ++num_visited;
         }
@@ -45,9 +89,53 @@ void TimedBFS(zuckerli::CompressedGraph graph, bool print) {
       << " ms" << std::endl;
 }
 
-void TimedDFS(zuckerli::CompressedGraph graph, bool print) {
+// Visits nodes one level at a time, decoding the lists of each level with a
+// single call to NeighboursBatch. Nodes of the same level are visited in
+// increasing order.
+void TimedBatchBFS(const zuckerli::CompressedGraph& graph, bool print) {
+  std::vector<uint32_t> frontier;
+  std::vector<uint32_t> next_frontier;
+  std::vector<bool> visited(graph.size(), false);
+  zuckerli::NeighboursBatchResult batch;
+  int num_visited = 0;
+
+  std::cout << "Batch BFS..." << std::endl;
+  auto t_start = std::chrono::high_resolution_clock::now();
+  for (uint32_t root = 0; root < graph.size(); root++) {
+    if (visited[root]) continue;
+    frontier.assign(1, root);
+    visited[root] = true;
+    ++num_visited;
+    while (!frontier.empty()) {
+      graph.NeighboursBatch(
+          zuckerli::span<const uint32_t>(frontier.data(), frontier.size()),
+          &batch);
+      next_frontier.clear();
+      for (size_t i = 0; i < batch.size(); i++) {
+        if (print) std::cout << batch.node(i) << " ";
+        for (uint32_t neighbour : batch.neighbours(i)) {
+          if (!visited[neighbour]) {
+            next_frontier.push_back(neighbour);
+            visited[neighbour] = true;
+            ++num_visited;
+          }
+        }
+      }
+      frontier.swap(next_frontier);
+    }
+  }
+  auto t_stop = std::chrono::high_resolution_clock::now();
+  if (print) std::cout << std::endl;
+  std::cout
+      << "Wall time elapsed: "
+      << std::chrono::duration<double, std::milli>(t_stop - t_start).count()
+      << " ms" << std::endl;
+}
+
+void TimedDFS(const zuckerli::CompressedGraph& graph, bool print) {
   std::stack<uint32_t> nodes;
   std::vector<bool> visited(graph.size(), false);
+  zuckerli::NeighboursContext context;
   int num_visited = 0;
 
   std::cout << "DFS..." << std::endl;
@@ -63,7 +151,7 @@ void TimedDFS(zuckerli::CompressedGraph graph, bool print) {
       uint32_t current_node = nodes.top();
       nodes.pop();
       if (print) std::cout << current_node << " ";
-      for (uint32_t neighbour : graph.Neighbours(current_node)) {
+      for (uint32_t neighbour : graph.Neighbours(current_node, &context)) {
         if (!visited[neighbour]) {
           nodes.push(neighbour);
           visited[neighbour] = true;
@@ -80,14 +168,129 @@ void TimedDFS(zuckerli::CompressedGraph graph, bool print) {
       << " ms" << std::endl;
 }
 
+// Answers `num_queries` neighbour queries for random nodes, as a server would:
+// all threads share the same graph, and each has its own context.
+void TimedRandomQueries(const zuckerli::CompressedGraph& graph,
+                        size_t num_queries, size_t num_threads) {
+  constexpr size_t kQueriesPerTask = 4096;
+  num_threads = zuckerli::NumThreads(num_threads);
+  std::vector<zuckerli::NeighboursContext> contexts(num_threads);
+  std::vector<size_t> num_edges(num_threads);
+  size_t num_tasks = (num_queries + kQueriesPerTask - 1) / kQueriesPerTask;
+
+  std::cout << "Random queries on " << num_threads << " threads..."
+            << std::endl;
+  auto t_start = std::chrono::high_resolution_clock::now();
+  zuckerli::ParallelFor(num_tasks, num_threads, [&](size_t thread,
+                                                    size_t task) {
+    std::mt19937_64 rng(task);
+    size_t end = std::min(num_queries, (task + 1) * kQueriesPerTask);
+    size_t edges = 0;
+    for (size_t i = task * kQueriesPerTask; i < end; i++) {
+      edges += graph.Neighbours(rng() % graph.size(), &contexts[thread]).size();
+    }
+    num_edges[thread] += edges;
+    return true;
+  });
+  auto t_stop = std::chrono::high_resolution_clock::now();
+  double elapsed =
+      std::chrono::duration<double, std::milli>(t_stop - t_start).count();
+  size_t total_edges = 0;
+  for (size_t edges : num_edges) total_edges += edges;
+  std::cout << "Decoded " << total_edges << " edges" << std::endl;
+  std::cout << "Wall time elapsed: " << elapsed << " ms ("
+            << num_queries / elapsed * 1000 << " queries/s)" << std::endl;
+}
+
+void PrintStats(const zuckerli::TraversalStats& stats, size_t num_threads) {
+  double thread_ms = stats.wall_seconds * num_threads * 1000;
+  std::cout << "Decoded " << stats.lists_decoded << " lists, "
+            << stats.edges_decoded << " edges" << std::endl;
+  std::cout << "Wall time elapsed: " << stats.wall_seconds * 1000 << " ms on "
+            << num_threads << " threads" << std::endl;
+  std::cout << "Decode time: " << stats.decode_seconds * 1000 << " ms ("
+            << stats.decode_seconds * 1000 / thread_ms * 100
+            << "% of thread time)" << std::endl;
+  std::cout << "Traversal time: " << stats.traversal_seconds * 1000 << " ms ("
+            << stats.traversal_seconds * 1000 / thread_ms * 100
+            << "% of thread time, including waiting)" << std::endl;
+}
+
+void TimedParallelBFS(const zuckerli::CompressedGraph& graph,
+                      const zuckerli::CompressedGraph* transpose,
+                      uint32_t root, size_t num_threads) {
+  num_threads = zuckerli::NumThreads(num_threads);
+  std::cout << "Parallel BFS..." << std::endl;
+  zuckerli::TraversalStats stats;
+  std::vector<uint32_t> distances =
+      zuckerli::ParallelBFS(graph, transpose, root, num_threads, &stats);
+  size_t num_reached = 0;
+  for (uint32_t distance : distances) {
+    if (distance != zuckerli::kUnreachable) num_reached++;
+  }
+  std::cout << "Reached " << num_reached << " nodes in "
+            << stats.top_down_levels << " top-down and "
+            << stats.bottom_up_levels << " bottom-up levels" << std::endl;
+  PrintStats(stats, num_threads);
+}
+
+void TimedConnectedComponents(const zuckerli::CompressedGraph& graph,
+                              size_t num_threads) {
+  num_threads = zuckerli::NumThreads(num_threads);
+  std::cout << "Connected components..." << std::endl;
+  zuckerli::TraversalStats stats;
+  std::vector<uint32_t> components =
+      zuckerli::ParallelConnectedComponents(graph, num_threads, &stats);
+  size_t num_components = 0;
+  for (size_t i = 0; i < components.size(); i++) {
+    if (components[i] == i) num_components++;
+  }
+  std::cout << "Found " << num_components << " components" << std::endl;
+  PrintStats(stats, num_threads);
+}
+
 int main(int argc, char* argv[]) {
   absl::ParseCommandLine(argc, argv);
-  zuckerli::CompressedGraph graph(absl::GetFlag(FLAGS_input_path));
+  if (absl::GetFlag(FLAGS_num_threads) < 0) {
+    std::cerr << "Invalid --num_threads " << absl::GetFlag(FLAGS_num_threads)
+              << ": must be at least 0" << std::endl;
+    return 1;
+  }
+  zuckerli::CompressedGraph graph(absl::GetFlag(FLAGS_input_path),
+                                  absl::GetFlag(FLAGS_mmap));
+  std::unique_ptr<zuckerli::CompressedGraph> transpose;
+  if (!absl::GetFlag(FLAGS_transpose_path).empty()) {
+    transpose.reset(new zuckerli::CompressedGraph(
+        absl::GetFlag(FLAGS_transpose_path), absl::GetFlag(FLAGS_mmap)));
+  }
+  for (zuckerli::CompressedGraph* g : {&graph, transpose.get()}) {
+    if (g == nullptr) continue;
+    if (absl::GetFlag(FLAGS_reference_cache_edges) != 0) {
+      g->EnableReferenceCache(absl::GetFlag(FLAGS_reference_cache_edges));
+    }
+    if (absl::GetFlag(FLAGS_multi_symbol)) g->EnableMultiSymbolDecoding();
+  }
   std::cout << "This graph has " << graph.size() << " nodes." << std::endl;
-  if (absl::GetFlag(FLAGS_dfs)) {
+  if (absl::GetFlag(FLAGS_random_queries) != 0) {
+    TimedRandomQueries(graph, absl::GetFlag(FLAGS_random_queries),
+                       absl::GetFlag(FLAGS_num_threads));
+  } else if (absl::GetFlag(FLAGS_parallel)) {
+    TimedParallelBFS(graph, transpose.get(), absl::GetFlag(FLAGS_root),
+                     absl::GetFlag(FLAGS_num_threads));
+  } else if (absl::GetFlag(FLAGS_components)) {
+    TimedConnectedComponents(graph, absl::GetFlag(FLAGS_num_threads));
+  } else if (absl::GetFlag(FLAGS_dfs)) {
     TimedDFS(graph, absl::GetFlag(FLAGS_print));
+  } else if (absl::GetFlag(FLAGS_batch)) {
+    TimedBatchBFS(graph, absl::GetFlag(FLAGS_print));
   } else {
-    TimedBFS(graph, absl::GetFlag(FLAGS_print));
+    TimedBFS(graph, absl::GetFlag(FLAGS_print),
+             absl::GetFlag(FLAGS_prefetch_distance));
+  }
+  if (graph.reference_cache()) {
+    std::cout << "Reference cache hits: " << graph.reference_cache()->Hits()
+              << ", misses: " << graph.reference_cache()->Misses()
+              << std::endl;
   }
   return 0;
 }
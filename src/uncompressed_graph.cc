@@ -13,40 +13,27 @@
 // limitations under the License.
 #include "uncompressed_graph.h"
 
-#include <fcntl.h>
-#include <sys/mman.h>
-#include <sys/stat.h>
-#include <unistd.h>
+#include <stdio.h>
+
+#include <utility>
 
 #include "common.h"
 
 namespace zuckerli {
 
-MemoryMappedFile::MemoryMappedFile(const std::string &filename) {
-  struct stat st;
-  int ret = stat(filename.c_str(), &st);
-  ZKR_ASSERT(ret == 0);
-  size_ = st.st_size;
-  ZKR_ASSERT(size_ % sizeof(uint32_t) == 0);
-  size_ /= sizeof(uint32_t);
-  fd_ = open(filename.c_str(), O_RDONLY, 0);
-  auto flags = MAP_SHARED;
-#ifdef __linux__
-  flags |= MAP_POPULATE;
-#endif
-  data_ = (const uint32_t *)mmap(NULL, size_ * sizeof(uint32_t), PROT_READ,
-                                 flags, fd_, 0);
-  ZKR_ASSERT(data_ != MAP_FAILED);
+UncompressedGraph::UncompressedGraph(const std::string &file) : f_(file) {
+  Init(f_.data(), f_.size());
 }
 
-MemoryMappedFile::~MemoryMappedFile() {
-  munmap((void *)data_, size_ * sizeof(uint32_t));
-  close(fd_);
+UncompressedGraph::UncompressedGraph(std::vector<uint8_t> data)
+    : data_(std::move(data)) {
+  Init(data_.data(), data_.size());
 }
 
-UncompressedGraph::UncompressedGraph(const std::string &file) : f_(file) {
-  const uint32_t *data = f_.data();
-  if (kFingerprint != *(uint64_t *)data) {
+void UncompressedGraph::Init(const uint8_t *bytes, size_t size) {
+  ZKR_ASSERT(size % sizeof(uint32_t) == 0);
+  const uint32_t *data = reinterpret_cast<const uint32_t *>(bytes);
+  if (size < sizeof(kFingerprint) || kFingerprint != *(uint64_t *)data) {
     fprintf(stderr, "ERROR: invalid fingerprint\n");
     exit(1);
   }
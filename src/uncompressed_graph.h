@@ -18,51 +18,13 @@
 #include <stdlib.h>
 
 #include <string>
+#include <vector>
 
 #include "common.h"
+#include "memory_mapped_file.h"
 
 namespace zuckerli {
 
-template <typename T>
-class span {
- public:
-  using iterator = const T *;
-  span(const T *data, size_t size) : data_(data), size_(size) {}
-  iterator begin() const { return data_; }
-  iterator end() const { return data_ + size_; }
-  const T &operator[](size_t pos) const { return data_[pos]; }
-  ZKR_INLINE T &at(size_t pos) {
-    ZKR_DASSERT(pos < size_);
-    return data_[pos];
-  }
-  ZKR_INLINE const T &at(size_t pos) const {
-    ZKR_DASSERT(pos < size_);
-    return data_[pos];
-  }
-  ZKR_INLINE size_t size() const { return size_; }
-
- private:
-  const T *data_;
-  size_t size_;
-};
-
-class MemoryMappedFile {
- public:
-  MemoryMappedFile(const std::string &filename);
-  ~MemoryMappedFile();
-  MemoryMappedFile(const MemoryMappedFile &) = delete;
-  void operator=(const MemoryMappedFile &) = delete;
-  MemoryMappedFile(MemoryMappedFile &&) = default;
-  MemoryMappedFile &operator=(MemoryMappedFile &&) = default;
-  ZKR_INLINE const uint32_t *data() const { return data_; }
-  ZKR_INLINE size_t size() const { return size_; }
-
- private:
-  size_t size_;
-  const uint32_t *ZKR_RESTRICT data_;
-  int fd_;
-};
-
 // Simple on-disk representation of a graph that can directly mapped into memory
 // (allowing reduced memory usage).
 // Format description:
@@ -79,6 +41,8 @@ class UncompressedGraph {
   static constexpr uint64_t kFingerprint =
       (sizeof(uint64_t) << 4) | sizeof(uint32_t);
   UncompressedGraph(const std::string &file);
+  // Graph held in memory, in the same format.
+  explicit UncompressedGraph(std::vector<uint8_t> data);
   ZKR_INLINE uint32_t size() const { return N; }
   ZKR_INLINE uint32_t Degree(size_t i) const {
     ZKR_DASSERT(i < size());
@@ -89,7 +53,11 @@ class UncompressedGraph {
   }
 
  private:
+  void Init(const uint8_t *data, size_t size);
+
+  // Only one of these holds the graph.
   MemoryMappedFile f_;
+  std::vector<uint8_t> data_;
   uint32_t N;
   const uint64_t *ZKR_RESTRICT neigh_start_;
   const uint32_t *ZKR_RESTRICT neighs_;